@@ -25,7 +25,11 @@ typedef struct {
 	nrm_string_t sensor_uuid;
 	nrm_string_t scope_uuid;
 	nrm_time_t since;
-	nrm_timeserie_t *timeserie;
+	/* events consumed so far, to read each of them once */
+	nrm_eventbase_cursor_t cursor;
+	/* where to read the events from, set by the daemon on each tick */
+	nrm_eventbase_t *events;
+	nrm_scope_t *scope;
 } nrm_control_input_t;
 
 typedef struct {
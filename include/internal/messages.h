@@ -36,7 +36,9 @@ typedef enum _Nrm__MSGTYPE nrm_msg_msgtype_e;
 #define NRM_MSG_TYPE_ACTUATE (NRM__MSGTYPE__ACTUATE)
 #define NRM_MSG_TYPE_EXIT (NRM__MSGTYPE__EXIT)
 #define NRM_MSG_TYPE_TICK (NRM__MSGTYPE__TICK)
-#define NRM_MSG_TYPE_MAX (8)
+#define NRM_MSG_TYPE_RESOLVE (NRM__MSGTYPE__RESOLVE)
+#define NRM_MSG_TYPE_NACK (NRM__MSGTYPE__NACK)
+#define NRM_MSG_TYPE_MAX (10)
 
 typedef enum _Nrm__TARGETTYPE nrm_msg_targettype_e;
 #define NRM_MSG_TARGET_TYPE_SLICE (NRM__TARGETTYPE__SLICE)
@@ -45,6 +47,11 @@ typedef enum _Nrm__TARGETTYPE nrm_msg_targettype_e;
 #define NRM_MSG_TARGET_TYPE_ACTUATOR (NRM__TARGETTYPE__ACTUATOR)
 #define NRM_MSG_TARGET_TYPE_MAX (4)
 
+#define NRM_MSG_LIST_FILTER_NONE (NRM__LIST__FILTER__NOT_SET)
+#define NRM_MSG_LIST_FILTER_UUID (NRM__LIST__FILTER_UUID)
+#define NRM_MSG_LIST_FILTER_PREFIX (NRM__LIST__FILTER_PREFIX)
+#define NRM_MSG_LIST_FILTER_PATTERN (NRM__LIST__FILTER_PATTERN)
+
 typedef enum _Nrm__ACTUATORTYPE nrm_msg_actuatortype_e;
 #define NRM_MSG_ACTUATOR_TYPE_DISCRETE (NRM__ACTUATORTYPE__DISCRETE)
 #define NRM_MSG_ACTUATOR_TYPE_CONTINUOUS (NRM__ACTUATORTYPE__CONTINUOUS)
@@ -90,6 +97,7 @@ typedef Nrm__TimeSerieList nrm_msg_timeserielist_t;
 #define nrm_msg_timeserielist_init(msg) nrm__time_serie_list__init(msg)
 
 nrm_msg_t *nrm_msg_create(void);
+nrm_msg_t *nrm_msg_reset(nrm_msg_t *msg);
 void nrm_msg_destroy_created(nrm_msg_t **msg);
 void nrm_msg_destroy_received(nrm_msg_t **msg);
 void nrm_log_printmsg(int level, nrm_msg_t *msg);
@@ -101,11 +109,17 @@ int nrm_msg_set_add_actuator(nrm_msg_t *msg, nrm_actuator_t *actuator);
 int nrm_msg_set_add_scope(nrm_msg_t *msg, nrm_scope_t *scope);
 int nrm_msg_set_add_sensor(nrm_msg_t *msg, nrm_sensor_t *sensor);
 int nrm_msg_set_add_slice(nrm_msg_t *msg, nrm_slice_t *slice);
+int nrm_msg_set_add_actuators(nrm_msg_t *msg, nrm_vector_t *actuators);
+int nrm_msg_set_add_scopes(nrm_msg_t *msg, nrm_vector_t *scopes);
+int nrm_msg_set_add_sensors(nrm_msg_t *msg, nrm_vector_t *sensors);
+int nrm_msg_set_add_slices(nrm_msg_t *msg, nrm_vector_t *slices);
 int nrm_msg_set_list_actuators(nrm_msg_t *msg, nrm_vector_t *actuators);
 int nrm_msg_set_list_scopes(nrm_msg_t *msg, nrm_vector_t *scopes);
 int nrm_msg_set_list_sensors(nrm_msg_t *msg, nrm_vector_t *sensors);
 int nrm_msg_set_list_slices(nrm_msg_t *msg, nrm_vector_t *slices);
+int nrm_msg_set_list_filter(nrm_msg_t *msg, int filter, const char *value);
 int nrm_msg_set_remove(nrm_msg_t *msg, int type, nrm_string_t uuid);
+int nrm_msg_set_resolve(nrm_msg_t *msg, nrm_scope_t *scope);
 int nrm_msg_is_reply(nrm_msg_t *msg);
 
 nrm_actuator_t *nrm_actuator_create_frommsg(nrm_msg_actuator_t *msg);
@@ -114,6 +128,14 @@ nrm_slice_t *nrm_slice_create_frommsg(nrm_msg_slice_t *msg);
 nrm_sensor_t *nrm_sensor_create_frommsg(nrm_msg_sensor_t *msg);
 nrm_timeserie_t *nrm_timeserie_create_frommsg(nrm_msg_timeserie_t *msg);
 
+/* number of events in a timeserie message, in either encoding. Fails on
+ * columns of different lengths.
+ */
+int nrm_msg_timeserie_length(nrm_msg_timeserie_t *msg, size_t *length);
+void nrm_msg_timeserie_get_event(nrm_msg_timeserie_t *msg,
+                                 size_t index,
+                                 nrm_event_t *out);
+
 int nrm_actuator_update_frommsg(nrm_actuator_t *actuator,
                                 nrm_msg_actuator_t *msg);
 int nrm_scope_update_frommsg(nrm_scope_t *scope, nrm_msg_scope_t *msg);
@@ -130,7 +152,10 @@ int nrm_msg_fprintf(FILE *f, nrm_msg_t *msg);
  * Socket Interaction
  ******************************************************************************/
 
+zframe_t *nrm_msg_pack(nrm_msg_t *msg);
+
 int nrm_msg_send(zsock_t *socket, nrm_msg_t *msg);
+int nrm_msg_send_packed(zsock_t *socket, zframe_t **frame);
 int nrm_msg_sendto(zsock_t *socket, nrm_msg_t *msg, nrm_uuid_t *to);
 
 nrm_msg_t *nrm_msg_recv(zsock_t *socket);
@@ -49,7 +49,12 @@ struct nrm_timeserie_s {
 	nrm_string_t sensor_uuid;
 	nrm_scope_t *scope;
 	nrm_vector_t *events;
-	nrm_time_t start;
+	/* in nanoseconds, like the events */
+	int64_t start;
+	/* id of the scope in the daemon we send to, the scope is only sent as
+	 * a reference when set
+	 */
+	size_t scope_id;
 };
 
 /*******************************************************************************
@@ -58,6 +63,8 @@ struct nrm_timeserie_s {
 
 struct nrm_scope {
 	nrm_string_t uuid;
+	/* dense id given by the state it was added to, 0 if none */
+	size_t id;
 	struct nrm_bitmap maps[NRM_SCOPE_TYPE_MAX];
 };
 
@@ -32,6 +32,7 @@ struct nrm_role_ops {
 	int (*send)(const struct nrm_role_data *data,
 	            nrm_msg_t *msg,
 	            nrm_uuid_t *to);
+	int (*send_packed)(const struct nrm_role_data *data, zframe_t *frame);
 	nrm_msg_t *(*recv)(const struct nrm_role_data *data, nrm_uuid_t **from);
 	int (*pub)(const struct nrm_role_data *data,
 	           nrm_string_t topic,
@@ -103,6 +104,7 @@ extern struct nrm_role_ops nrm_role_client_ops;
  ******************************************************************************/
 
 int nrm_role_send(const nrm_role_t *role, nrm_msg_t *msg, nrm_uuid_t *to);
+int nrm_role_send_packed(const nrm_role_t *role, zframe_t *frame);
 nrm_msg_t *nrm_role_recv(const nrm_role_t *role, nrm_uuid_t **from);
 int nrm_role_pub(const nrm_role_t *role, nrm_string_t topic, nrm_msg_t *msg);
 int nrm_role_register_sub_cb(const nrm_role_t *role,
@@ -33,6 +33,7 @@ extern "C" {
 #include "nrm/utils/error.h"
 #include "nrm/utils/parsers.h"
 #include "nrm/utils/ringbuffer.h"
+#include "nrm/utils/sketches.h"
 #include "nrm/utils/vectors.h"
 #include "nrm/utils/strings.h"
 #include "nrm/utils/scopes.h"
@@ -171,7 +172,6 @@ int nrm_actuator_corrected_value(nrm_actuator_t *, double *);
  * Extra scope API
  ******************************************************************************/
 
-int nrm_scope_hwloc_scopes(nrm_hash_t **scopes);
 nrm_scope_t *nrm_scope_create_hwloc_allowed(const char *name);
 
 /*******************************************************************************
@@ -211,6 +211,8 @@ void nrm_slice_fprintf(FILE *out, nrm_slice_t *);
 
 struct nrm_sensor_s {
 	nrm_string_t uuid;
+	/* dense id given by the state it was added to, 0 if none */
+	size_t id;
 };
 
 typedef struct nrm_sensor_s nrm_sensor_t;
@@ -239,6 +241,11 @@ struct nrm_state_s {
 	nrm_hash_t *scopes;
 	nrm_hash_t *sensors;
 	nrm_hash_t *slices;
+	/* sensors and scopes by id, slot 0 is never used */
+	nrm_vector_t *sensorids;
+	nrm_vector_t *scopeids;
+	/* scopes by the resources they contain */
+	nrm_hash_t *scopekeys;
 };
 
 typedef struct nrm_state_s nrm_state_t;
@@ -250,24 +257,56 @@ int nrm_state_list_scopes(nrm_state_t *, nrm_vector_t *);
 int nrm_state_list_sensors(nrm_state_t *, nrm_vector_t *);
 int nrm_state_list_slices(nrm_state_t *, nrm_vector_t *);
 
+/**
+ * Adds an object to the state, which then owns it.
+ * @return 0 on success, an error if the uuid is already taken or memory ran
+ * out, in which case the state is left untouched and the caller keeps the
+ * object.
+ */
 int nrm_state_add_actuator(nrm_state_t *, nrm_actuator_t *);
 int nrm_state_add_scope(nrm_state_t *, nrm_scope_t *);
 int nrm_state_add_sensor(nrm_state_t *, nrm_sensor_t *);
 int nrm_state_add_slice(nrm_state_t *, nrm_slice_t *);
 
+/**
+ * Sensors and scopes get a small integer id when added to the state, so that
+ * hot paths can index arrays instead of hashing uuids. Ids are never reused.
+ * @return NULL if there is no such object (anymore).
+ */
+nrm_sensor_t *nrm_state_get_sensor(nrm_state_t *, size_t id);
+nrm_scope_t *nrm_state_get_scope(nrm_state_t *, size_t id);
+
+/**
+ * Finds a scope of the state containing exactly the same resources as `scope`,
+ * whatever its uuid. If several do, the oldest one is returned.
+ * @return NULL if there is no such scope.
+ */
+nrm_scope_t *nrm_state_resolve_scope(nrm_state_t *, nrm_scope_t *scope);
+
 int nrm_state_remove_actuator(nrm_state_t *, const char *uuid);
 int nrm_state_remove_scope(nrm_state_t *, const char *uuid);
 int nrm_state_remove_sensor(nrm_state_t *, const char *uuid);
 int nrm_state_remove_slice(nrm_state_t *, const char *uuid);
 
+/**
+ * Adds a scope to the state for each object of the hwloc topology of the
+ * machine, named "nrm.hwloc.<type>.<index>".
+ * @return 0 on success, the first error otherwise.
+ */
+int nrm_scope_hwloc_scopes(nrm_state_t *state);
+
 void nrm_state_destroy(nrm_state_t **);
 
 /*******************************************************************************
  * Timeserie: a timeserie labeled by a scope and a sensor.
  ******************************************************************************/
 
+/**
+ * An event, 16 bytes: its time in nanoseconds (see `nrm_time_tons`) and its
+ * value.
+ */
 struct nrm_event_s {
-	nrm_time_t time;
+	int64_t time;
 	double value;
 };
 typedef struct nrm_event_s nrm_event_t;
@@ -288,6 +327,15 @@ void nrm_timeserie_destroy(nrm_timeserie_t **);
 struct nrm_eventbase_s;
 typedef struct nrm_eventbase_s nrm_eventbase_t;
 
+/**
+ * Creates an eventbase keeping events for the last `maxperiods` periods, a
+ * period being the time between two calls to `nrm_eventbase_tick`. A zero
+ * value disables expiration.
+ *
+ * All the functions below are thread-safe: sensors are sharded, each shard
+ * with its own lock, so that pushes to different sensors proceed in parallel
+ * and pulls only block pushes to the same shard while they copy events out.
+ */
 nrm_eventbase_t *nrm_eventbase_create(size_t maxperiods);
 
 size_t nrm_eventbase_get_maxperiods(nrm_eventbase_t *);
@@ -295,14 +343,221 @@ size_t nrm_eventbase_get_maxperiods(nrm_eventbase_t *);
 int nrm_eventbase_push_event(
         nrm_eventbase_t *, nrm_string_t, nrm_scope_t *, nrm_time_t, double);
 
+/**
+ * Same as `nrm_eventbase_push_event`, but uses the ids of sensors and scopes
+ * that are part of a state to skip any uuid lookup.
+ */
+int nrm_eventbase_push_sensor_event(
+        nrm_eventbase_t *, nrm_sensor_t *, nrm_scope_t *, nrm_time_t, double);
+
+/**
+ * Pushes many events of the same sensor and scope at once. Lookups happen
+ * once, and runs of sorted events are copied in bulk.
+ */
+int nrm_eventbase_push_events(nrm_eventbase_t *,
+                              nrm_sensor_t *,
+                              nrm_scope_t *,
+                              const nrm_event_t *events,
+                              size_t nevents);
+int nrm_eventbase_push_timeserie(nrm_eventbase_t *, nrm_timeserie_t *);
+
+/**
+ * Starts a new period, expiring events older than `maxperiods` periods.
+ */
 int nrm_eventbase_tick(nrm_eventbase_t *, nrm_time_t);
 
+/**
+ * Sets the width of new timeslices, in nanoseconds, for all sensors or for a
+ * single one. A zero sensor period reverts to the eventbase one.
+ */
+int nrm_eventbase_set_period(nrm_eventbase_t *, int64_t);
+int nrm_eventbase_set_sensor_period(nrm_eventbase_t *, nrm_string_t, int64_t);
+
+/**
+ * On each tick, resizes the timeslices of sensors without a fixed period so
+ * that they hold about `target` events at the observed rate. Zero disables
+ * it.
+ */
+int nrm_eventbase_set_adaptive(nrm_eventbase_t *, size_t target);
+
+/**
+ * Compresses timeslices once their period is over, trading some CPU time on
+ * pulls for a much smaller memory footprint. Disabled by default.
+ */
+int nrm_eventbase_set_compression(nrm_eventbase_t *, int enabled);
+
+/**
+ * Drops all the events of a sensor, or of a scope across all sensors.
+ */
+int nrm_eventbase_remove_sensor(nrm_eventbase_t *, nrm_string_t);
+int nrm_eventbase_remove_scope(nrm_eventbase_t *, nrm_string_t);
+
 int nrm_eventbase_pull_timeserie(nrm_eventbase_t *,
                                  nrm_string_t,
                                  nrm_scope_t *,
                                  nrm_time_t since,
                                  nrm_timeserie_t **ts);
 
+/* number of events a view decodes at once from a compressed slice */
+#define NRM_EVENTBASE_VIEW_CHUNK 64
+/* size of a view in 64-bit words: a chunk and a few words of state */
+#define NRM_EVENTBASE_VIEW_WORDS (2 * NRM_EVENTBASE_VIEW_CHUNK + 24)
+
+/**
+ * A read-only view over the events of a sensor and scope in [since, until),
+ * read in place from the eventbase instead of copied into a timeserie. Views
+ * live on the stack and need no allocation.
+ *
+ * A view pins its scope until `nrm_eventbase_view_end` instead of holding a
+ * lock: the events it covers stay in place, and anything pushed to that
+ * scope meanwhile, from any thread, is applied once the last view on it ends.
+ * Ticks leave pinned scopes alone, and removing one frees it at the end of
+ * its last view.
+ */
+struct nrm_eventbase_view_s {
+	/* private to the eventbase */
+	uint64_t storage[NRM_EVENTBASE_VIEW_WORDS];
+};
+typedef struct nrm_eventbase_view_s nrm_eventbase_view_t;
+
+int nrm_eventbase_view_begin(nrm_eventbase_t *,
+                             nrm_string_t,
+                             nrm_scope_t *,
+                             nrm_time_t since,
+                             nrm_time_t until,
+                             nrm_eventbase_view_t *view);
+
+/**
+ * Returns the next run of events in time order, as parallel arrays of times
+ * in nanoseconds and values. The arrays are valid until the next call on the
+ * view, and `count` is 0 once all events have been seen.
+ */
+int nrm_eventbase_view_next(nrm_eventbase_view_t *view,
+                            const int64_t **times,
+                            const double **values,
+                            size_t *count);
+
+/**
+ * Returns the next run of late events of a cursor view, once
+ * `nrm_eventbase_view_next` is done, in arrival order: the ones pushed since
+ * the cursor but at or before its previous watermark. Other views have none.
+ */
+int nrm_eventbase_view_next_late(nrm_eventbase_view_t *view,
+                                 const int64_t **times,
+                                 const double **values,
+                                 size_t *count);
+
+void nrm_eventbase_view_end(nrm_eventbase_view_t *view);
+
+/**
+ * Position of a consumer in the events of a sensor and scope, to see each of
+ * them exactly once. Each scope has a watermark, the time of its latest
+ * event: anything pushed at or before it afterwards is late. A cursor holds
+ * the watermark it has read up to and the number of late events it has seen.
+ * Zero-initialize it to start from the beginning.
+ */
+struct nrm_eventbase_cursor_s {
+	int64_t watermark;
+	uint64_t late;
+};
+typedef struct nrm_eventbase_cursor_s nrm_eventbase_cursor_t;
+
+/**
+ * Begins a view over the events between the cursor and the current
+ * watermark, and moves the cursor to it. The late events pushed since the
+ * cursor come from `nrm_eventbase_view_next_late`.
+ */
+int nrm_eventbase_view_cursor(nrm_eventbase_t *,
+                              nrm_string_t,
+                              nrm_scope_t *,
+                              nrm_eventbase_cursor_t *cursor,
+                              nrm_eventbase_view_t *view);
+
+/**
+ * Creates a timeserie of all the events pushed since the cursor and moves it
+ * forward: the ones up to the watermark in time order, followed by the late
+ * ones in arrival order.
+ */
+int nrm_eventbase_pull_cursor(nrm_eventbase_t *,
+                              nrm_string_t,
+                              nrm_scope_t *,
+                              nrm_eventbase_cursor_t *cursor,
+                              nrm_timeserie_t **ts);
+
+/** Statistics over the events of a sensor and scope in [since, until). The
+ * rate is the sum of values per second. Min, max and mean are zero if there
+ * are no events.
+ */
+struct nrm_eventbase_stats_s {
+	size_t count;
+	double sum;
+	double min;
+	double max;
+	double mean;
+	double rate;
+};
+typedef struct nrm_eventbase_stats_s nrm_eventbase_stats_t;
+
+int nrm_eventbase_pull_stats(nrm_eventbase_t *,
+                             nrm_string_t,
+                             nrm_scope_t *,
+                             nrm_time_t since,
+                             nrm_time_t until,
+                             nrm_eventbase_stats_t *stats);
+
+/** A downsampled view of a timeserie: one per `step` long bucket */
+struct nrm_eventbase_aggregate_s {
+	nrm_time_t time;
+	size_t count;
+	double sum;
+	double min;
+	double max;
+	double first;
+	double last;
+};
+typedef struct nrm_eventbase_aggregate_s nrm_eventbase_aggregate_t;
+
+/**
+ * Creates a vector of nrm_eventbase_aggregate_t, one for each non-empty
+ * bucket in [since, until). Slices that fall entirely inside a bucket are
+ * summed up from their rollups, the others are split on bucket edges from
+ * their events.
+ */
+int nrm_eventbase_pull_aggregate(nrm_eventbase_t *,
+                                 nrm_string_t,
+                                 nrm_scope_t *,
+                                 nrm_time_t since,
+                                 nrm_time_t until,
+                                 nrm_time_t step,
+                                 nrm_vector_t **aggregates);
+
+/**
+ * Maintains quantile sketches of the values, and of their rates (value per
+ * second since the previous event), for each period of each sensor and scope.
+ * `accuracy` is the relative error on the quantiles, zero disables them.
+ */
+int nrm_eventbase_set_quantiles(nrm_eventbase_t *, double accuracy);
+
+/**
+ * Estimates the q-quantile of the values (or rates) pushed since `since`.
+ * Sketches are kept per period, so the window starts at the beginning of the
+ * period containing `since`.
+ * @return -NRM_ENOTFOUND if quantiles are disabled or there is no data,
+ * -NRM_EDOM if the window is empty.
+ */
+int nrm_eventbase_pull_quantile(nrm_eventbase_t *,
+                                nrm_string_t,
+                                nrm_scope_t *,
+                                nrm_time_t since,
+                                double q,
+                                double *value);
+int nrm_eventbase_pull_rate_quantile(nrm_eventbase_t *,
+                                     nrm_string_t,
+                                     nrm_scope_t *,
+                                     nrm_time_t since,
+                                     double q,
+                                     double *value);
+
 void nrm_eventbase_destroy(nrm_eventbase_t **);
 
 /*******************************************************************************
@@ -314,6 +569,9 @@ void nrm_eventbase_destroy(nrm_eventbase_t **);
 
 typedef struct nrm_client_s nrm_client_t;
 
+/** An RPC sent by a client, waiting for its reply */
+typedef struct nrm_client_request_s nrm_client_request_t;
+
 typedef int(nrm_client_event_listener_fn)(nrm_string_t sensor_uuid,
                                           nrm_time_t time,
                                           nrm_scope_t *scope,
@@ -342,7 +600,8 @@ int nrm_client_actuate(nrm_client_t *client,
 int nrm_client_add_actuator(nrm_client_t *client, nrm_actuator_t *actuator);
 
 /**
- * Adds an NRM scope to an NRM client.
+ * Adds an NRM scope to an NRM client. Events later sent to this scope only
+ * refer to it by the id the daemon gave it.
  * @return 0 if successful, an error code otherwise
  */
 int nrm_client_add_scope(nrm_client_t *client, nrm_scope_t *scope);
@@ -359,6 +618,52 @@ int nrm_client_add_sensor(nrm_client_t *client, nrm_sensor_t *sensor);
  */
 int nrm_client_add_slice(nrm_client_t *client, nrm_slice_t *slice);
 
+/**
+ * Adds a whole vector of objects in a single request, instead of one round
+ * trip per object.
+ *
+ * @param client: NRM client object
+ * @param actuators: a vector of pointers to the objects to add, each of them
+ * updated from the daemon reply like the single add functions do.
+ * @return 0 if successful, an error code otherwise
+ */
+int nrm_client_add_actuators(nrm_client_t *client, nrm_vector_t *actuators);
+int nrm_client_add_scopes(nrm_client_t *client, nrm_vector_t *scopes);
+int nrm_client_add_sensors(nrm_client_t *client, nrm_vector_t *sensors);
+int nrm_client_add_slices(nrm_client_t *client, nrm_vector_t *slices);
+
+/**
+ * Asynchronous versions of the add functions: the request is sent right away
+ * and the call returns without waiting for the reply, so that many requests
+ * can be in flight at once. The object must stay valid until
+ * `nrm_client_wait` is called on the request.
+ *
+ * @param request: pointer to a variable that contains the request handle
+ * @return 0 if successful, an error code otherwise
+ */
+int nrm_client_add_actuator_async(nrm_client_t *client,
+                                  nrm_actuator_t *actuator,
+                                  nrm_client_request_t **request);
+int nrm_client_add_scope_async(nrm_client_t *client,
+                               nrm_scope_t *scope,
+                               nrm_client_request_t **request);
+int nrm_client_add_sensor_async(nrm_client_t *client,
+                                nrm_sensor_t *sensor,
+                                nrm_client_request_t **request);
+int nrm_client_add_slice_async(nrm_client_t *client,
+                               nrm_slice_t *slice,
+                               nrm_client_request_t **request);
+
+/**
+ * Waits for the reply to a request and updates the object it was about.
+ *
+ * @param request: a request from one of the `_async` functions. `NULL` after
+ * return.
+ * @return 0 if successful, -NRM_EINVAL if the daemon refused the request,
+ * -NRM_FAILURE if no usable reply came
+ */
+int nrm_client_wait(nrm_client_t *client, nrm_client_request_t **request);
+
 /**
  * Find matching NRM objects within a client
  * @param client: NRM client
@@ -372,6 +677,24 @@ int nrm_client_find(nrm_client_t *client,
                     const char *uuid,
                     nrm_vector_t **results);
 
+/**
+ * Same as `nrm_client_find`, for all the objects whose uuid starts with
+ * `prefix`.
+ */
+int nrm_client_find_prefix(nrm_client_t *client,
+                           int type,
+                           const char *prefix,
+                           nrm_vector_t **results);
+
+/**
+ * Same as `nrm_client_find`, for all the objects whose uuid matches the shell
+ * wildcard `pattern`, see fnmatch(3).
+ */
+int nrm_client_find_pattern(nrm_client_t *client,
+                            int type,
+                            const char *pattern,
+                            nrm_vector_t **results);
+
 int nrm_client_list_actuators(nrm_client_t *client, nrm_vector_t **actuators);
 
 /**
@@ -380,6 +703,16 @@ int nrm_client_list_actuators(nrm_client_t *client, nrm_vector_t **actuators);
  */
 int nrm_client_list_scopes(nrm_client_t *client, nrm_vector_t **scopes);
 
+/**
+ * Asks the daemon for the scope it knows with exactly the same resources as
+ * `scope`, without listing all of them.
+ * @param match: a new scope, with the uuid the daemon knows it by
+ * @return 0 if successful, -NRM_ENOTFOUND if the daemon has no such scope
+ */
+int nrm_client_resolve_scope(nrm_client_t *client,
+                             nrm_scope_t *scope,
+                             nrm_scope_t **match);
+
 /**
  * Lists an NRM client's registered sensors into a vector
  * @return 0 if successful, an error code otherwise
@@ -433,6 +766,36 @@ int nrm_client_send_event(nrm_client_t *client,
                           nrm_scope_t *scope,
                           double value);
 
+/**
+ * Makes `nrm_client_send_event` buffer events, one timeserie per sensor and
+ * scope, and send them all in a single message once any of the limits is
+ * reached. Buffers past the age limit are also flushed in the background,
+ * at most half the limit late, even if their thread stops sending events.
+ *
+ * @param client: NRM client object
+ * @param count: maximum number of buffered events, 0 for no limit
+ * @param bytes: maximum size of the buffered events, 0 for no limit
+ * @param age: maximum age of the oldest buffered event, 0 for no limit
+ * @return 0 if successful, an error code otherwise
+ *
+ * Each thread sending events has its own buffer, the limits apply to each of
+ * them. Setting all the limits to 0 disables buffering. Any event already
+ * buffered is sent first.
+ */
+int nrm_client_set_buffering(nrm_client_t *client,
+                             size_t count,
+                             size_t bytes,
+                             nrm_time_t age);
+
+/**
+ * Sends all the events buffered by the client, from all threads
+ *
+ * @param client: NRM client object
+ * @return 0 if successful, an error code otherwise
+ *
+ */
+int nrm_client_flush(nrm_client_t *client);
+
 /**
  * Asks the daemon to exit
  *
@@ -489,12 +852,22 @@ typedef struct nrm_server_s nrm_server_t;
 
 /** User-level callbacks on server events */
 struct nrm_server_user_callbacks_s {
-	/* receiving a sensor event */
+	/* receiving a sensor event, the sensor and scope come from the state
+	 * if they were added to it.
+	 */
 	int (*event)(nrm_server_t *,
-	             nrm_string_t,
+	             nrm_sensor_t *,
 	             nrm_scope_t *,
 	             nrm_time_t,
 	             double value);
+	/* receiving a batch of events from the same sensor and scope. If set,
+	 * it is called instead of event.
+	 */
+	int (*events)(nrm_server_t *,
+	              nrm_sensor_t *,
+	              nrm_scope_t *,
+	              const nrm_event_t *,
+	              size_t);
 	/* receiving a request to actuate */
 	int (*actuate)(nrm_server_t *, nrm_actuator_t *, double value);
 	/* receiving a POSIX signal */
@@ -503,6 +876,8 @@ struct nrm_server_user_callbacks_s {
 	int (*timer)(nrm_server_t *);
 	/* receive a request to tick */
 	int (*tick)(nrm_server_t *);
+	/* an object of the given type was removed from the state */
+	int (*remove)(nrm_server_t *, int, nrm_string_t);
 };
 
 typedef struct nrm_server_user_callbacks_s nrm_server_user_callbacks_t;
@@ -541,6 +916,17 @@ int nrm_server_publish(nrm_server_t *server,
                        nrm_scope_t *scope,
                        double value);
 
+/**
+ * Publishes a run of events of the same sensor and scope as a single
+ * timeserie, in one message.
+ */
+int nrm_server_publish_events(nrm_server_t *server,
+                              nrm_string_t topic,
+                              nrm_string_t sensor_uuid,
+                              nrm_scope_t *scope,
+                              const nrm_event_t *events,
+                              size_t nevents);
+
 int nrm_server_actuate(nrm_server_t *server, nrm_string_t uuid, double value);
 
 /**
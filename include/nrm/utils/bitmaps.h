@@ -77,9 +77,29 @@ int nrm_bitmap_to_array(const struct nrm_bitmap *bitmap,
 
 /**
  * Fill a bitmap with the list of ints that are in an array
+ * @return -NRM_EINVAL if an int is out of the bitmap range
  */
 int nrm_bitmap_from_array(struct nrm_bitmap *bitmap,
                           size_t nitems,
                           int32_t *items);
 
+/**
+ * Count the number of runs of consecutive bits set in bitmap.
+ **/
+int nrm_bitmap_nranges(const struct nrm_bitmap *bitmap);
+
+/**
+ * Fill an array with a [start, length] pair for each run of bits set in the
+ * bitmap. The array must hold 2 * nrm_bitmap_nranges() ints.
+ */
+int nrm_bitmap_to_ranges(const struct nrm_bitmap *bitmap, int32_t *items);
+
+/**
+ * Fill a bitmap with the [start, length] pairs that are in an array
+ * @return -NRM_EINVAL if the array is malformed or out of the bitmap range
+ */
+int nrm_bitmap_from_ranges(struct nrm_bitmap *bitmap,
+                           size_t nitems,
+                           int32_t *items);
+
 #endif
@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright 2019 UChicago Argonne, LLC.
+ * (c.f. AUTHORS, LICENSE)
+ *
+ * This file is part of the libnrm project.
+ * For more info, see https://github.com/anlsys/libnrm
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ ******************************************************************************/
+
+#ifndef NRM_SKETCHES_H
+#define NRM_SKETCHES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A mergeable quantile sketch (DDSketch): values are counted in
+ * logarithmically sized bins, so that any quantile is known within a relative
+ * error of `accuracy`, in constant memory.
+ **/
+struct nrm_sketch_s;
+
+typedef struct nrm_sketch_s nrm_sketch_t;
+
+int nrm_sketch_create(nrm_sketch_t **sketch, double accuracy);
+
+int nrm_sketch_add(nrm_sketch_t *sketch, double value);
+
+/**
+ * Adds all the values of `src` into `dst`. Both sketches must have been
+ * created with the same accuracy.
+ **/
+int nrm_sketch_merge(nrm_sketch_t *dst, const nrm_sketch_t *src);
+
+int nrm_sketch_count(const nrm_sketch_t *sketch, size_t *count);
+
+/**
+ * Estimates the q-quantile (0 <= q <= 1) of the values in the sketch.
+ * @return -NRM_EDOM if the sketch is empty.
+ **/
+int nrm_sketch_quantile(const nrm_sketch_t *sketch, double q, double *value);
+
+int nrm_sketch_clear(nrm_sketch_t *sketch);
+
+/**
+ * Release memory occupied by a sketch.
+ *
+ * @param[in, out] sketch: a sketch created by `nrm_sketch_create()`. `NULL`
+ * after return.
+ **/
+void nrm_sketch_destroy(nrm_sketch_t **sketch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NRM_SKETCHES_H
@@ -103,28 +103,17 @@ int nrm_geopm_domain_to_scope(nrm_scope_t *scope,
 
 int nrm_geopm_find_scope(nrm_scope_t **scope, int *added)
 {
-	nrm_vector_t *nrmd_scopes;
-	int newscope = 0;
-	size_t numscopes;
-	nrm_client_list_scopes(client, &nrmd_scopes);
-	nrm_vector_length(nrmd_scopes, &numscopes);
-	for (size_t i = 0; i < numscopes; i++) {
-		nrm_scope_t *s;
-		nrm_vector_pop_back(nrmd_scopes, &s);
-		if (!nrm_scope_cmp(s, *scope)) {
-			nrm_scope_destroy(*scope);
-			*scope = s;
-			newscope = 1;
-			continue;
-		}
-		nrm_scope_destroy(s);
-	}
-	if (!newscope) {
+	nrm_scope_t *match;
+	int err = nrm_client_resolve_scope(client, *scope, &match);
+	if (err) {
 		nrm_log_debug(
 		        "allowed scope not found in nrmd, adding a new one\n");
+		*added = 1;
+		return 0;
 	}
-	nrm_vector_destroy(&nrmd_scopes);
-	*added = !newscope;
+	nrm_scope_destroy(*scope);
+	*scope = match;
+	*added = 0;
 	return 0;
 }
 
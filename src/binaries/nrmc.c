@@ -241,18 +241,55 @@ int cmd_add_sensor(int argc, char **argv)
 	return 0;
 }
 
-int cmd_find_actuator(int argc, char **argv)
+/* find-* commands take an exact uuid, or a prefix with --prefix */
+static int nrmc_find(int type, int argc, char **argv, nrm_vector_t **results)
 {
+	static int ask_prefix = 0;
+	static struct option cmd_find_long_options[] = {
+	        {"prefix", no_argument, &ask_prefix, 1},
+	        {0, 0, 0, 0},
+	};
 
-	if (argc < 2)
-		return EXIT_FAILURE;
+	static const char *cmd_find_short_options = ":p";
+
+	optind = 1;
 
+	int c;
+	int option_index = 0;
+	while (1) {
+		c = getopt_long(argc, argv, cmd_find_short_options,
+		                cmd_find_long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 0:
+			break;
+		case 'p':
+			ask_prefix = 1;
+			break;
+		case '?':
+			return -NRM_EINVAL;
+		default:
+			return -NRM_EINVAL;
+		}
+	}
+	/* remove the parsed part */
+	argc -= optind;
+	argv = &(argv[optind]);
+
+	if (argc < 1)
+		return -NRM_EINVAL;
+
+	if (ask_prefix)
+		return nrm_client_find_prefix(client, type, argv[0], results);
+	return nrm_client_find(client, type, argv[0], results);
+}
+
+int cmd_find_actuator(int argc, char **argv)
+{
 	int err;
 	nrm_vector_t *results;
-	char *name = NULL;
-	name = argv[1];
-	err = nrm_client_find(client, NRM_MSG_TARGET_TYPE_ACTUATOR, name,
-	                      &results);
+	err = nrmc_find(NRM_MSG_TARGET_TYPE_ACTUATOR, argc, argv, &results);
 	if (err) {
 		nrm_log_error("error during client request\n");
 		return EXIT_FAILURE;
@@ -275,16 +312,9 @@ int cmd_find_actuator(int argc, char **argv)
 
 int cmd_find_scope(int argc, char **argv)
 {
-
-	if (argc < 2)
-		return EXIT_FAILURE;
-
 	int err;
 	nrm_vector_t *results;
-	char *name = NULL;
-	name = argv[1];
-	err = nrm_client_find(client, NRM_MSG_TARGET_TYPE_SCOPE, name,
-	                      &results);
+	err = nrmc_find(NRM_MSG_TARGET_TYPE_SCOPE, argc, argv, &results);
 	if (err) {
 		nrm_log_error("error during client request\n");
 		return EXIT_FAILURE;
@@ -307,16 +337,9 @@ int cmd_find_scope(int argc, char **argv)
 
 int cmd_find_sensor(int argc, char **argv)
 {
-
-	if (argc < 2)
-		return EXIT_FAILURE;
-
 	int err;
 	nrm_vector_t *results;
-	char *name = NULL;
-	name = argv[1];
-	err = nrm_client_find(client, NRM_MSG_TARGET_TYPE_SENSOR, name,
-	                      &results);
+	err = nrmc_find(NRM_MSG_TARGET_TYPE_SENSOR, argc, argv, &results);
 	if (err) {
 		nrm_log_error("error during client request\n");
 		return EXIT_FAILURE;
@@ -339,16 +362,9 @@ int cmd_find_sensor(int argc, char **argv)
 
 int cmd_find_slice(int argc, char **argv)
 {
-
-	if (argc < 2)
-		return EXIT_FAILURE;
-
 	int err;
 	nrm_vector_t *results;
-	char *name = NULL;
-	name = argv[1];
-	err = nrm_client_find(client, NRM_MSG_TARGET_TYPE_SLICE, name,
-	                      &results);
+	err = nrmc_find(NRM_MSG_TARGET_TYPE_SLICE, argc, argv, &results);
 	if (err) {
 		nrm_log_error("error during client request\n");
 		return EXIT_FAILURE;
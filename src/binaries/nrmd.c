@@ -17,11 +17,13 @@
 #include "internal/nrmi.h"
 
 #include "internal/control.h"
+#include "internal/messages.h"
 
 struct nrm_daemon_s {
 	nrm_state_t *state;
 	nrm_server_t *server;
 	nrm_eventbase_t *events;
+	double quantiles;
 	nrm_control_t *control;
 	nrm_sensor_t *mysensor;
 	nrm_scope_t *myscope;
@@ -33,14 +35,28 @@ int signo;
 struct nrm_daemon_s my_daemon;
 
 int nrmd_event_callback(nrm_server_t *server,
-                        nrm_string_t uuid,
+                        nrm_sensor_t *sensor,
                         nrm_scope_t *scope,
                         nrm_time_t time,
                         double value)
 {
-	nrm_eventbase_push_event(my_daemon.events, uuid, scope, time, value);
-	nrm_server_publish(server, my_daemon.eventtopic, time, uuid, scope,
-	                   value);
+	nrm_eventbase_push_sensor_event(my_daemon.events, sensor, scope, time,
+	                                value);
+	nrm_server_publish(server, my_daemon.eventtopic, time, sensor->uuid,
+	                   scope, value);
+	return 0;
+}
+
+int nrmd_events_callback(nrm_server_t *server,
+                         nrm_sensor_t *sensor,
+                         nrm_scope_t *scope,
+                         const nrm_event_t *events,
+                         size_t nevents)
+{
+	nrm_eventbase_push_events(my_daemon.events, sensor, scope, events,
+	                          nevents);
+	nrm_server_publish_events(server, my_daemon.eventtopic, sensor->uuid,
+	                          scope, events, nevents);
 	return 0;
 }
 
@@ -86,8 +102,9 @@ int nrmd_control_tick(nrm_server_t *server)
 			nrm_log_error("input scope not found");
 			continue;
 		}
-		nrm_eventbase_pull_timeserie(my_daemon.events, in->sensor_uuid,
-		                             scope, in->since, &in->timeserie);
+		/* the control reads from the eventbase directly */
+		in->events = my_daemon.events;
+		in->scope = scope;
 	}
 
 	nrm_vector_foreach(outputs, iterator)
@@ -111,6 +128,20 @@ int nrmd_control_tick(nrm_server_t *server)
 	return 0;
 }
 
+int nrmd_remove_callback(nrm_server_t *server, int type, nrm_string_t uuid)
+{
+	(void)server;
+	/* drop any data we still have about it */
+	switch (type) {
+	case NRM_MSG_TARGET_TYPE_SENSOR:
+		return nrm_eventbase_remove_sensor(my_daemon.events, uuid);
+	case NRM_MSG_TARGET_TYPE_SCOPE:
+		return nrm_eventbase_remove_scope(my_daemon.events, uuid);
+	default:
+		return 0;
+	}
+}
+
 int nrmd_timer_callback(nrm_server_t *server)
 {
 	nrm_log_info("global timer wakeup\n");
@@ -122,8 +153,9 @@ int nrmd_timer_callback(nrm_server_t *server)
 	nrm_server_publish(server, my_daemon.mytopic, now,
 	                   my_daemon.mysensor->uuid, my_daemon.myscope, 1.0);
 
+	/* without control, we still need to expire old events */
 	if (my_daemon.control == NULL)
-		return 0;
+		return nrm_eventbase_tick(my_daemon.events, now);
 
 	nrmd_control_tick(server);
 	return 0;
@@ -133,13 +165,64 @@ int nrmd_tick_callback(nrm_server_t *server)
 {
 	nrm_log_info("tick wakeup\n");
 
-	if (my_daemon.control == NULL)
-		return 0;
+	if (my_daemon.control == NULL) {
+		nrm_time_t now;
+		nrm_time_gettime(&now);
+		return nrm_eventbase_tick(my_daemon.events, now);
+	}
 
 	nrmd_control_tick(server);
 	return 0;
 }
 
+int nrmd_eventbase_configure(json_t *config)
+{
+	int err;
+	json_error_t jerror;
+	json_int_t period = 0, adaptive = 0;
+	double quantiles = my_daemon.quantiles;
+	int compress = 0;
+	json_t *sensors = NULL;
+
+	err = json_unpack_ex(config, &jerror, 0,
+	                     "{s?:I, s?:I, s?:F, s?:b, s?:o}", "period",
+	                     &period, "adaptive", &adaptive, "quantiles",
+	                     &quantiles, "compress", &compress, "sensors",
+	                     &sensors);
+	if (err) {
+		nrm_log_error("error parsing eventbase config: %s\n",
+		              jerror.text);
+		return -NRM_EINVAL;
+	}
+	if (period != 0)
+		nrm_eventbase_set_period(my_daemon.events, period);
+	nrm_eventbase_set_adaptive(my_daemon.events, adaptive);
+	nrm_eventbase_set_compression(my_daemon.events, compress);
+	if (nrm_eventbase_set_quantiles(my_daemon.events, quantiles) == 0)
+		my_daemon.quantiles = quantiles;
+
+	/* per-sensor slice width, as "uuid": period */
+	if (sensors != NULL && !json_is_object(sensors)) {
+		nrm_log_error("eventbase sensors must be an object\n");
+		return -NRM_EINVAL;
+	}
+	const char *key;
+	json_t *value;
+	json_object_foreach(sensors, key, value)
+	{
+		if (!json_is_integer(value) || json_integer_value(value) <= 0) {
+			nrm_log_error("bad period for sensor %s, ignoring\n",
+			              key);
+			continue;
+		}
+		nrm_string_t uuid = nrm_string_fromchar(key);
+		nrm_eventbase_set_sensor_period(my_daemon.events, uuid,
+		                                json_integer_value(value));
+		nrm_string_decref(uuid);
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int err;
@@ -174,7 +257,9 @@ int main(int argc, char *argv[])
 	/* init state */
 	my_daemon.state = nrm_state_create();
 	my_daemon.events = nrm_eventbase_create(5);
-	nrm_scope_hwloc_scopes(&my_daemon.state->scopes);
+	my_daemon.quantiles = 0.01;
+	nrm_eventbase_set_quantiles(my_daemon.events, my_daemon.quantiles);
+	nrm_scope_hwloc_scopes(my_daemon.state);
 	my_daemon.mysensor = nrm_sensor_create("daemon.tick");
 	nrm_string_t global_scope = nrm_string_fromchar("nrm.hwloc.Machine.0");
 	nrm_hash_find(my_daemon.state->scopes, global_scope,
@@ -195,12 +280,15 @@ int main(int argc, char *argv[])
 	assert(config != NULL);
 	json_t *jconfig = json_loadf(config, 0, &jerror);
 	assert(jconfig != NULL);
-	json_t *control_config;
-	err = json_unpack_ex(jconfig, &jerror, 0, "{s?:o}", "control",
-	                     &control_config);
+	json_t *control_config = NULL, *eventbase_config = NULL;
+	err = json_unpack_ex(jconfig, &jerror, 0, "{s?:o, s?:o}", "control",
+	                     &control_config, "eventbase", &eventbase_config);
 	if (!err && control_config) {
 		nrm_control_create(&my_daemon.control, control_config);
 	}
+	if (!err && eventbase_config) {
+		nrmd_eventbase_configure(eventbase_config);
+	}
 
 start:
 	nrm_log_info("daemon initialized\n");
@@ -214,10 +302,12 @@ start:
 	/* setting up the callbacks */
 	nrm_server_user_callbacks_t callbacks = {
 	        .event = nrmd_event_callback,
+	        .events = nrmd_events_callback,
 	        .actuate = nrmd_actuate_callback,
 	        .signal = NULL,
 	        .timer = nrmd_timer_callback,
 	        .tick = nrmd_tick_callback,
+	        .remove = nrmd_remove_callback,
 	};
 	nrm_server_setcallbacks(my_daemon.server, callbacks);
 
@@ -11,6 +11,7 @@
 #include "config.h"
 
 #include "nrm.h"
+#include <inttypes.h>
 #include <pthread.h>
 
 #include "internal/nrmi.h"
@@ -23,8 +24,336 @@ struct nrm_client_s {
 	nrm_client_event_listener_fn *user_fn;
 	nrm_client_actuate_listener_fn *actuate_fn;
 	pthread_mutex_t lock;
+	/* ids the daemon gave to the scopes we know of, indexed by uuid */
+	nrm_hash_t *scopeids;
+	/* bumped on every change to scopeids */
+	size_t scopeids_gen;
+	/* per thread event buffers, only ever added to until destroy */
+	pthread_key_t key;
+	struct nrm_client_thread_s *threads;
+	/* flush limits, 0 if unused. Events aren't buffered if all are */
+	size_t maxcount;
+	size_t maxbytes;
+	int64_t maxage;
+	/* flushes buffers past the age limit, started with the first one */
+	pthread_t flusher;
+	int flusher_running;
+	int flusher_stop;
+	pthread_cond_t flusher_wake;
+	/* requests waiting for a reply, in the order they were sent */
+	uint64_t nextid;
+	struct nrm_client_request_s *requests;
+	/* a thread is reading replies from the broker */
+	int receiving;
+	pthread_cond_t replied;
 };
 
+/* the daemon copies the id of each request in its reply. Requests go to the
+ * broker through its lock-free queue, and a single thread at a time reads
+ * replies from it, without the client lock: it hands each reply to the
+ * request it belongs to and wakes up the other waiters, one of which takes
+ * over if its own reply isn't there yet.
+ */
+struct nrm_client_request_s {
+	uint64_t id;
+	nrm_msg_t *reply;
+	/* the broker didn't give a reply */
+	int failed;
+	/* what to update from the reply of an add request, either an object
+	 * or a vector of them, depending on the kind of add
+	 */
+	int data_case;
+	void *object;
+	struct nrm_client_request_s *next;
+};
+
+/* series that stay empty for that many flushes are dropped */
+#define NRM_CLIENT_SERIE_MAXIDLE 16
+
+struct nrm_client_serie_s {
+	nrm_timeserie_t *timeserie;
+	unsigned int idle;
+	/* scopeids generation the scope id was looked up at */
+	size_t gen;
+};
+
+/* events are buffered per thread, so that threads sending events don't
+ * contend on the client lock: a thread only takes the lock of its own buffer,
+ * that nothing but a flush of the whole client competes for. Packed messages
+ * then go to the broker through a lock-free queue.
+ *
+ * The series and the message they are packed into are kept from one flush to
+ * the next, so that sending events stops allocating once all the series have
+ * been seen.
+ *
+ * Lock ordering: a thread lock can be held while taking the client lock, never
+ * the other way around.
+ */
+struct nrm_client_thread_s {
+	nrm_client_t *client;
+	pthread_mutex_t lock;
+	/* buffered events, one timeserie per sensor and scope */
+	nrm_vector_t *pending;
+	nrm_vector_t *ready;
+	nrm_msg_t *events;
+	size_t npending;
+	int64_t oldest;
+	/* copy of the client limits */
+	size_t maxcount;
+	size_t maxbytes;
+	int64_t maxage;
+	struct nrm_client_thread_s *next;
+};
+
+struct nrm_client_scopeid_s {
+	nrm_string_t uuid;
+	size_t id;
+};
+
+/* events sent to a scope the daemon gave an id to only carry that id, the
+ * ids are learned from the replies to add, find and list requests.
+ */
+static void
+nrm_client_scopeid_set(nrm_client_t *client, const char *uuid, size_t id)
+{
+	struct nrm_client_scopeid_s *e = NULL;
+	nrm_string_t key = nrm_string_fromchar(uuid);
+
+	pthread_mutex_lock(&(client->lock));
+	nrm_hash_find(client->scopeids, key, (void *)&e);
+	if (e != NULL) {
+		e->id = id;
+		__atomic_add_fetch(&client->scopeids_gen, 1, __ATOMIC_RELEASE);
+		goto end;
+	}
+	if (id == 0)
+		goto end;
+	e = malloc(sizeof(struct nrm_client_scopeid_s));
+	if (e == NULL)
+		goto end;
+	e->uuid = key;
+	e->id = id;
+	if (nrm_hash_add(&client->scopeids, key, e))
+		free(e);
+	else {
+		__atomic_add_fetch(&client->scopeids_gen, 1, __ATOMIC_RELEASE);
+		key = NULL;
+	}
+end:
+	pthread_mutex_unlock(&(client->lock));
+	if (key != NULL)
+		nrm_string_decref(key);
+}
+
+static size_t nrm_client_scopeid_get(nrm_client_t *client, nrm_string_t uuid)
+{
+	struct nrm_client_scopeid_s *e = NULL;
+	pthread_mutex_lock(&(client->lock));
+	nrm_hash_find(client->scopeids, uuid, (void *)&e);
+	size_t ret = e != NULL ? e->id : 0;
+	pthread_mutex_unlock(&(client->lock));
+	return ret;
+}
+
+static void nrm_client_scopeid_remove(nrm_client_t *client, nrm_string_t uuid)
+{
+	struct nrm_client_scopeid_s *e = NULL;
+	pthread_mutex_lock(&(client->lock));
+	if (client->scopeids != NULL)
+		nrm_hash_remove(&client->scopeids, uuid, (void *)&e);
+	if (e != NULL)
+		__atomic_add_fetch(&client->scopeids_gen, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&(client->lock));
+	if (e != NULL) {
+		nrm_string_decref(e->uuid);
+		free(e);
+	}
+}
+
+static void nrm_client_thread_destroy(struct nrm_client_thread_s *t)
+{
+	nrm_vector_foreach(t->pending, iter)
+	{
+		struct nrm_client_serie_s *s = nrm_vector_iterator_get(iter);
+		nrm_scope_destroy(s->timeserie->scope);
+		nrm_timeserie_destroy(&s->timeserie);
+	}
+	nrm_vector_destroy(&t->pending);
+	nrm_vector_destroy(&t->ready);
+	nrm_msg_destroy_created(&t->events);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+static int nrm_client_thread_flush(struct nrm_client_thread_s *t);
+
+/* a thread going away sends what it buffered, its buffer stays with the client
+ * until destroy
+ */
+static void nrm_client_thread_exit(void *arg)
+{
+	struct nrm_client_thread_s *t = arg;
+	pthread_mutex_lock(&t->lock);
+	nrm_client_thread_flush(t);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static struct nrm_client_thread_s *nrm_client_thread_get(nrm_client_t *client)
+{
+	struct nrm_client_thread_s *t = pthread_getspecific(client->key);
+	if (t != NULL)
+		return t;
+
+	t = calloc(1, sizeof(struct nrm_client_thread_s));
+	if (t == NULL)
+		return NULL;
+	if (nrm_vector_create(&t->pending, sizeof(struct nrm_client_serie_s)))
+		goto err;
+	if (nrm_vector_create(&t->ready, sizeof(nrm_timeserie_t *)))
+		goto err_pending;
+	t->events = nrm_msg_create();
+	if (t->events == NULL)
+		goto err_ready;
+	pthread_mutex_init(&t->lock, NULL);
+	t->client = client;
+
+	pthread_mutex_lock(&(client->lock));
+	t->maxcount = client->maxcount;
+	t->maxbytes = client->maxbytes;
+	t->maxage = client->maxage;
+	t->next = client->threads;
+	client->threads = t;
+	pthread_mutex_unlock(&(client->lock));
+	pthread_setspecific(client->key, t);
+	return t;
+err_ready:
+	nrm_vector_destroy(&t->ready);
+err_pending:
+	nrm_vector_destroy(&t->pending);
+err:
+	free(t);
+	return NULL;
+}
+
+/* the list is only ever prepended to, walking it from its head is safe
+ * without the client lock.
+ */
+static struct nrm_client_thread_s *nrm_client_threads(nrm_client_t *client)
+{
+	pthread_mutex_lock(&(client->lock));
+	struct nrm_client_thread_s *ret = client->threads;
+	pthread_mutex_unlock(&(client->lock));
+	return ret;
+}
+
+static void nrm_client_request_unlink(nrm_client_t *client,
+                                      nrm_client_request_t *req)
+{
+	nrm_client_request_t **r = &client->requests;
+	while (*r != req)
+		r = &(*r)->next;
+	*r = req->next;
+}
+
+static nrm_client_request_t *nrm_client_request_send(nrm_client_t *client,
+                                                     nrm_msg_t *msg)
+{
+	nrm_client_request_t *req = calloc(1, sizeof(nrm_client_request_t));
+	if (req == NULL) {
+		nrm_msg_destroy_created(&msg);
+		return NULL;
+	}
+	pthread_mutex_lock(&(client->lock));
+	req->id = ++client->nextid;
+	nrm_client_request_t **last = &client->requests;
+	while (*last != NULL)
+		last = &(*last)->next;
+	*last = req;
+	pthread_mutex_unlock(&(client->lock));
+
+	/* the pipe to the broker belongs to the receiving thread */
+	nrm_log_debug("sending request\n");
+	msg->id = req->id;
+	zframe_t *frame = nrm_msg_pack(msg);
+	nrm_msg_destroy_created(&msg);
+	int err = -NRM_ENOMEM;
+	if (frame != NULL)
+		err = nrm_role_send_packed(client->role, frame);
+	if (err) {
+		nrm_log_error("failed to send request: %d\n", err);
+		zframe_destroy(&frame);
+		pthread_mutex_lock(&(client->lock));
+		nrm_client_request_unlink(client, req);
+		pthread_mutex_unlock(&(client->lock));
+		free(req);
+		return NULL;
+	}
+	return req;
+}
+
+/* with the client lock held */
+static void nrm_client_request_dispatch(nrm_client_t *client, nrm_msg_t *msg)
+{
+	for (nrm_client_request_t *r = client->requests; r != NULL;
+	     r = r->next) {
+		if (r->id == msg->id) {
+			r->reply = msg;
+			return;
+		}
+	}
+	nrm_log_debug("dropping reply to unknown request %" PRIu64 "\n",
+	              msg->id);
+	nrm_msg_destroy_received(&msg);
+}
+
+/* returns the reply, or NULL if the broker couldn't give one. The request is
+ * freed either way.
+ */
+static nrm_msg_t *nrm_client_request_wait(nrm_client_t *client,
+                                          nrm_client_request_t *req)
+{
+	nrm_log_debug("receiving reply\n");
+	pthread_mutex_lock(&(client->lock));
+	while (req->reply == NULL && !req->failed) {
+		if (client->receiving) {
+			pthread_cond_wait(&client->replied, &client->lock);
+			continue;
+		}
+		client->receiving = 1;
+		pthread_mutex_unlock(&(client->lock));
+		nrm_msg_t *msg = nrm_role_recv(client->role, NULL);
+		pthread_mutex_lock(&(client->lock));
+		client->receiving = 0;
+		if (msg != NULL)
+			nrm_client_request_dispatch(client, msg);
+		else {
+			nrm_log_error("no reply to request %" PRIu64 "\n",
+			              req->id);
+			req->failed = 1;
+		}
+		pthread_cond_broadcast(&client->replied);
+	}
+	nrm_client_request_unlink(client, req);
+	pthread_mutex_unlock(&(client->lock));
+
+	nrm_msg_t *ret = req->reply;
+	free(req);
+	if (ret == NULL)
+		return NULL;
+	nrm_log_debug("parsing reply\n");
+	nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+	return ret;
+}
+
+/* sends a request and waits for its reply */
+static nrm_msg_t *nrm_client_rpc(nrm_client_t *client, nrm_msg_t *msg)
+{
+	nrm_client_request_t *req = nrm_client_request_send(client, msg);
+	if (req == NULL)
+		return NULL;
+	return nrm_client_request_wait(client, req);
+}
+
 int nrm_client_create(nrm_client_t **client,
                       const char *uri,
                       int pub_port,
@@ -42,7 +371,14 @@ int nrm_client_create(nrm_client_t **client,
 		return -NRM_EINVAL;
 	ret->user_fn = NULL;
 	ret->actuate_fn = NULL;
+	if (pthread_key_create(&ret->key, nrm_client_thread_exit)) {
+		nrm_role_destroy(&ret->role);
+		free(ret);
+		return -NRM_ENOMEM;
+	}
 	pthread_mutex_init(&(ret->lock), NULL);
+	pthread_cond_init(&(ret->replied), NULL);
+	pthread_cond_init(&(ret->flusher_wake), NULL);
 
 	*client = ret;
 	return 0;
@@ -68,158 +404,299 @@ int nrm_client_actuate(nrm_client_t *client,
 	nrm_msg_fill(msg, NRM_MSG_TYPE_ACTUATE);
 	nrm_msg_set_actuate(msg, nrm_actuator_uuid(actuator), value);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply:\t");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	assert(msg->type == NRM_MSG_TYPE_ACK);
 	nrm_msg_destroy_received(&msg);
 	return 0;
 }
 
-int nrm_client_add_actuator(nrm_client_t *client, nrm_actuator_t *actuator)
+static int nrm_client_add_async(nrm_client_t *client,
+                                nrm_msg_t *msg,
+                                void *object,
+                                nrm_client_request_t **request)
 {
-	if (client == NULL || actuator == NULL)
+	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	/* the message belongs to the broker once sent */
+	int data_case = msg->add->data_case;
+	nrm_client_request_t *req = nrm_client_request_send(client, msg);
+	if (req == NULL)
+		return -NRM_ENOMEM;
+	req->data_case = data_case;
+	req->object = object;
+	*request = req;
+	return 0;
+}
+
+static void nrm_client_add_scope_reply(nrm_client_t *client,
+                                       nrm_scope_t *scope,
+                                       nrm_msg_scope_t *msg)
+{
+	if (nrm_scope_update_frommsg(scope, msg))
+		nrm_log_error("malformed scope in reply\n");
+	nrm_client_scopeid_set(client, scope->uuid, msg->id);
+}
+
+int nrm_client_add_actuator_async(nrm_client_t *client,
+                                  nrm_actuator_t *actuator,
+                                  nrm_client_request_t **request)
+{
+	if (client == NULL || actuator == NULL || request == NULL)
 		return -NRM_EINVAL;
 
 	nrm_log_debug("crafting message\n");
-	/* craft the message we want to send */
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
 	nrm_msg_set_add_actuator(msg, actuator);
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply:\t");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-
-	assert(msg->type == NRM_MSG_TYPE_ADD);
-	assert(msg->add->type == NRM_MSG_TARGET_TYPE_ACTUATOR);
-	nrm_actuator_update_frommsg(actuator, msg->add->actuator);
-	nrm_msg_destroy_received(&msg);
-	return 0;
+	return nrm_client_add_async(client, msg, actuator, request);
 }
 
-int nrm_client_add_scope(nrm_client_t *client, nrm_scope_t *scope)
+int nrm_client_add_scope_async(nrm_client_t *client,
+                               nrm_scope_t *scope,
+                               nrm_client_request_t **request)
 {
-	if (client == NULL || scope == NULL)
+	if (client == NULL || scope == NULL || request == NULL)
 		return -NRM_EINVAL;
 
 	nrm_log_debug("crafting message\n");
-	/* craft the message we want to send */
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
 	nrm_msg_set_add_scope(msg, scope);
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
+	return nrm_client_add_async(client, msg, scope, request);
+}
 
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply:\t");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+int nrm_client_add_sensor_async(nrm_client_t *client,
+                                nrm_sensor_t *sensor,
+                                nrm_client_request_t **request)
+{
+	if (client == NULL || sensor == NULL || request == NULL)
+		return -NRM_EINVAL;
 
-	assert(msg->type == NRM_MSG_TYPE_ADD);
-	assert(msg->add->type == NRM_MSG_TARGET_TYPE_SCOPE);
-	nrm_scope_update_frommsg(scope, msg->add->scope);
-	nrm_msg_destroy_received(&msg);
-	return 0;
+	nrm_log_debug("crafting message\n");
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
+	nrm_msg_set_add_sensor(msg, sensor);
+	return nrm_client_add_async(client, msg, sensor, request);
 }
 
-int nrm_client_add_slice(nrm_client_t *client, nrm_slice_t *slice)
+int nrm_client_add_slice_async(nrm_client_t *client,
+                               nrm_slice_t *slice,
+                               nrm_client_request_t **request)
 {
-	if (client == NULL || slice == NULL)
+	if (client == NULL || slice == NULL || request == NULL)
 		return -NRM_EINVAL;
 
 	nrm_log_debug("crafting message\n");
-	/* craft the message we want to send */
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
 	nrm_msg_set_add_slice(msg, slice);
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
+	return nrm_client_add_async(client, msg, slice, request);
+}
 
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply:\t");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+int nrm_client_wait(nrm_client_t *client, nrm_client_request_t **request)
+{
+	if (client == NULL || request == NULL || *request == NULL)
+		return -NRM_EINVAL;
 
-	assert(msg->type == NRM_MSG_TYPE_ADD);
-	assert(msg->add->type == NRM_MSG_TARGET_TYPE_SLICE);
-	nrm_slice_update_frommsg(slice, msg->add->slice);
+	nrm_client_request_t *req = *request;
+	int data_case = req->data_case;
+	void *object = req->object;
+	*request = NULL;
+	nrm_msg_t *msg = nrm_client_request_wait(client, req);
+	if (msg == NULL)
+		return -NRM_FAILURE;
+
+	/* the daemon nacks when it refused the objects */
+	int err = 0;
+	if (msg->type == NRM_MSG_TYPE_NACK) {
+		err = -NRM_EINVAL;
+		goto end;
+	}
+	if (msg->type != NRM_MSG_TYPE_ADD ||
+	    (int)msg->add->data_case != data_case) {
+		err = -NRM_FAILURE;
+		goto end;
+	}
+	nrm_msg_add_t *add = msg->add;
+	size_t n = 0;
+	if (data_case != NRM__ADD__DATA_ACTUATOR &&
+	    data_case != NRM__ADD__DATA_SCOPE &&
+	    data_case != NRM__ADD__DATA_SENSOR &&
+	    data_case != NRM__ADD__DATA_SLICE)
+		nrm_vector_length(object, &n);
+	switch (data_case) {
+	case NRM__ADD__DATA_ACTUATOR:
+		nrm_actuator_update_frommsg(object, add->actuator);
+		break;
+	case NRM__ADD__DATA_SCOPE:
+		nrm_client_add_scope_reply(client, object, add->scope);
+		break;
+	case NRM__ADD__DATA_SENSOR:
+		nrm_sensor_update_frommsg(object, add->sensor);
+		break;
+	case NRM__ADD__DATA_SLICE:
+		nrm_slice_update_frommsg(object, add->slice);
+		break;
+	/* bulk replies list the objects in the order they were sent */
+	case NRM__ADD__DATA_ACTUATORS:
+		if (add->actuators->n_actuators != n)
+			goto mismatch;
+		for (size_t i = 0; i < n; i++) {
+			nrm_actuator_t **a;
+			nrm_vector_get_withtype(nrm_actuator_t *, object, i, a);
+			nrm_actuator_update_frommsg(
+			        *a, add->actuators->actuators[i]);
+		}
+		break;
+	case NRM__ADD__DATA_SCOPES:
+		if (add->scopes->n_scopes != n)
+			goto mismatch;
+		for (size_t i = 0; i < n; i++) {
+			nrm_scope_t **sc;
+			nrm_vector_get_withtype(nrm_scope_t *, object, i, sc);
+			nrm_client_add_scope_reply(client, *sc,
+			                           add->scopes->scopes[i]);
+		}
+		break;
+	case NRM__ADD__DATA_SENSORS:
+		if (add->sensors->n_sensors != n)
+			goto mismatch;
+		for (size_t i = 0; i < n; i++) {
+			nrm_sensor_t **se;
+			nrm_vector_get_withtype(nrm_sensor_t *, object, i, se);
+			nrm_sensor_update_frommsg(
+			        *se, add->sensors->sensors[i]);
+		}
+		break;
+	case NRM__ADD__DATA_SLICES:
+		if (add->slices->n_slices != n)
+			goto mismatch;
+		for (size_t i = 0; i < n; i++) {
+			nrm_slice_t **sl;
+			nrm_vector_get_withtype(nrm_slice_t *, object, i, sl);
+			nrm_slice_update_frommsg(*sl, add->slices->slices[i]);
+		}
+		break;
+	}
+end:
 	nrm_msg_destroy_received(&msg);
-	return 0;
+	return err;
+mismatch:
+	nrm_log_error("bulk add reply doesn't match the request\n");
+	err = -NRM_FAILURE;
+	goto end;
+}
+
+int nrm_client_add_actuator(nrm_client_t *client, nrm_actuator_t *actuator)
+{
+	nrm_client_request_t *req;
+	int err = nrm_client_add_actuator_async(client, actuator, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
+
+int nrm_client_add_scope(nrm_client_t *client, nrm_scope_t *scope)
+{
+	nrm_client_request_t *req;
+	int err = nrm_client_add_scope_async(client, scope, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
+
+int nrm_client_add_slice(nrm_client_t *client, nrm_slice_t *slice)
+{
+	nrm_client_request_t *req;
+	int err = nrm_client_add_slice_async(client, slice, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
 }
 
 int nrm_client_add_sensor(nrm_client_t *client, nrm_sensor_t *sensor)
 {
-	if (client == NULL || sensor == NULL)
+	nrm_client_request_t *req;
+	int err = nrm_client_add_sensor_async(client, sensor, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
+
+int nrm_client_add_actuators(nrm_client_t *client, nrm_vector_t *actuators)
+{
+	if (client == NULL || actuators == NULL)
 		return -NRM_EINVAL;
 
-	nrm_log_debug("crafting message\n");
-	/* craft the message we want to send */
+	nrm_client_request_t *req;
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
-	nrm_msg_set_add_sensor(msg, sensor);
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
+	nrm_msg_set_add_actuators(msg, actuators);
+	int err = nrm_client_add_async(client, msg, actuators, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
 
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply:\t");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+int nrm_client_add_scopes(nrm_client_t *client, nrm_vector_t *scopes)
+{
+	if (client == NULL || scopes == NULL)
+		return -NRM_EINVAL;
 
-	assert(msg->type == NRM_MSG_TYPE_ADD);
-	assert(msg->add->type == NRM_MSG_TARGET_TYPE_SENSOR);
-	nrm_sensor_update_frommsg(sensor, msg->add->sensor);
-	nrm_msg_destroy_received(&msg);
-	return 0;
+	nrm_client_request_t *req;
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
+	nrm_msg_set_add_scopes(msg, scopes);
+	int err = nrm_client_add_async(client, msg, scopes, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
 }
 
-int nrm_client_find(nrm_client_t *client,
-                    int type,
-                    const char *uuid,
-                    nrm_vector_t **results)
+int nrm_client_add_sensors(nrm_client_t *client, nrm_vector_t *sensors)
+{
+	if (client == NULL || sensors == NULL)
+		return -NRM_EINVAL;
+
+	nrm_client_request_t *req;
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
+	nrm_msg_set_add_sensors(msg, sensors);
+	int err = nrm_client_add_async(client, msg, sensors, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
+
+int nrm_client_add_slices(nrm_client_t *client, nrm_vector_t *slices)
+{
+	if (client == NULL || slices == NULL)
+		return -NRM_EINVAL;
+
+	nrm_client_request_t *req;
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_ADD);
+	nrm_msg_set_add_slices(msg, slices);
+	int err = nrm_client_add_async(client, msg, slices, &req);
+	if (err)
+		return err;
+	return nrm_client_wait(client, &req);
+}
+
+/* the daemon only sends back the objects matching the filter */
+static int nrm_client_find_filtered(nrm_client_t *client,
+                                    int type,
+                                    int filter,
+                                    const char *value,
+                                    nrm_vector_t **results)
 {
 	if (client == NULL || type < 0 || type >= NRM_MSG_TARGET_TYPE_MAX)
 		return -NRM_EINVAL;
 
 	/* we need one of those */
-	if (uuid == NULL)
+	if (value == NULL || results == NULL)
 		return -NRM_EINVAL;
 
 	int err;
@@ -244,21 +721,13 @@ int nrm_client_find(nrm_client_t *client,
 		nrm_log_error("missing case for type %d\n", type);
 		assert(0);
 	}
+	nrm_msg_set_list_filter(msg, filter, value);
 	assert(msg->type == NRM_MSG_TYPE_LIST);
 	assert((int)msg->list->type == type);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 	assert(msg->type == NRM_MSG_TYPE_LIST);
 	assert((int)msg->list->type == type);
 
@@ -269,10 +738,6 @@ int nrm_client_find(nrm_client_t *client,
 			return err;
 
 		for (size_t i = 0; i < msg->list->actuators->n_actuators; i++) {
-			if (uuid != NULL &&
-			    strcmp(uuid,
-			           msg->list->actuators->actuators[i]->uuid))
-				continue;
 			nrm_actuator_t *s = nrm_actuator_create_frommsg(
 			        msg->list->actuators->actuators[i]);
 			nrm_vector_push_back(ret, &s);
@@ -283,10 +748,11 @@ int nrm_client_find(nrm_client_t *client,
 			return err;
 
 		for (size_t i = 0; i < msg->list->scopes->n_scopes; i++) {
-			if (strcmp(uuid, msg->list->scopes->scopes[i]->uuid))
+			nrm_msg_scope_t *m = msg->list->scopes->scopes[i];
+			nrm_scope_t *s = nrm_scope_create_frommsg(m);
+			if (s == NULL)
 				continue;
-			nrm_scope_t *s = nrm_scope_create_frommsg(
-			        msg->list->scopes->scopes[i]);
+			nrm_client_scopeid_set(client, s->uuid, m->id);
 			nrm_vector_push_back(ret, &s);
 		}
 	} else if (type == NRM_MSG_TARGET_TYPE_SENSOR) {
@@ -295,8 +761,6 @@ int nrm_client_find(nrm_client_t *client,
 			return err;
 
 		for (size_t i = 0; i < msg->list->sensors->n_sensors; i++) {
-			if (strcmp(uuid, msg->list->sensors->sensors[i]->uuid))
-				continue;
 			nrm_sensor_t *s = nrm_sensor_create_frommsg(
 			        msg->list->sensors->sensors[i]);
 			nrm_vector_push_back(ret, &s);
@@ -307,8 +771,6 @@ int nrm_client_find(nrm_client_t *client,
 			return err;
 
 		for (size_t i = 0; i < msg->list->slices->n_slices; i++) {
-			if (strcmp(uuid, msg->list->slices->slices[i]->uuid))
-				continue;
 			nrm_slice_t *s = nrm_slice_create_frommsg(
 			        msg->list->slices->slices[i]);
 			nrm_vector_push_back(ret, &s);
@@ -319,6 +781,33 @@ int nrm_client_find(nrm_client_t *client,
 	return 0;
 }
 
+int nrm_client_find(nrm_client_t *client,
+                    int type,
+                    const char *uuid,
+                    nrm_vector_t **results)
+{
+	return nrm_client_find_filtered(client, type, NRM_MSG_LIST_FILTER_UUID,
+	                                uuid, results);
+}
+
+int nrm_client_find_prefix(nrm_client_t *client,
+                           int type,
+                           const char *prefix,
+                           nrm_vector_t **results)
+{
+	return nrm_client_find_filtered(
+	        client, type, NRM_MSG_LIST_FILTER_PREFIX, prefix, results);
+}
+
+int nrm_client_find_pattern(nrm_client_t *client,
+                            int type,
+                            const char *pattern,
+                            nrm_vector_t **results)
+{
+	return nrm_client_find_filtered(
+	        client, type, NRM_MSG_LIST_FILTER_PATTERN, pattern, results);
+}
+
 int nrm_client__sub_callback(nrm_msg_t *msg, void *arg)
 {
 	nrm_client_t *self = (nrm_client_t *)arg;
@@ -328,12 +817,27 @@ int nrm_client__sub_callback(nrm_msg_t *msg, void *arg)
 	/* unroll the entire timeseries */
 	for (size_t i = 0; i < msg->events->n_series; i++) {
 		nrm_msg_timeserie_t *ts = msg->events->series[i];
-		nrm_string_t uuid = nrm_string_fromchar(ts->sensor_uuid);
+
+		/* the daemon publishes whole scopes, ids are only meaningful
+		 * to the daemon itself
+		 */
+		if (ts->scope == NULL || ts->scope->uuid == NULL ||
+		    ts->scope->uuid[0] == '\0') {
+			nrm_log_error("event without a scope, ignoring\n");
+			continue;
+		}
+		size_t n;
+		if (nrm_msg_timeserie_length(ts, &n))
+			continue;
 		nrm_scope_t *scope = nrm_scope_create_frommsg(ts->scope);
-		for (size_t j = 0; j < ts->n_events; j++) {
-			nrm_msg_event_t *e = ts->events[j];
-			nrm_time_t time = nrm_time_fromns(e->time);
-			self->user_fn(uuid, time, scope, e->value);
+		if (scope == NULL)
+			continue;
+		nrm_string_t uuid = nrm_string_fromchar(ts->sensor_uuid);
+		for (size_t j = 0; j < n; j++) {
+			nrm_event_t e;
+			nrm_msg_timeserie_get_event(ts, j, &e);
+			self->user_fn(uuid, nrm_time_fromns(e.time), scope,
+			              e.value);
 		}
 	}
 
@@ -354,9 +858,15 @@ int nrm_client_start_event_listener(const nrm_client_t *client,
 {
 	if (client == NULL)
 		return -NRM_EINVAL;
-	nrm_role_register_sub_cb(client->role, nrm_client__sub_callback,
-	                         (void *)client);
-	nrm_role_sub(client->role, topic);
+	nrm_client_t *self = (nrm_client_t *)client;
+	nrm_role_register_sub_cb(self->role, nrm_client__sub_callback,
+	                         (void *)self);
+	/* shares the broker pipe with the thread reading replies */
+	pthread_mutex_lock(&(self->lock));
+	while (self->receiving)
+		pthread_cond_wait(&self->replied, &self->lock);
+	nrm_role_sub(self->role, topic);
+	pthread_mutex_unlock(&(self->lock));
 	return 0;
 }
 
@@ -400,18 +910,9 @@ int nrm_client_list_actuators(nrm_client_t *client, nrm_vector_t **actuators)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_LIST);
 	nrm_msg_set_list_actuators(msg, NULL);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	nrm_vector_t *ret;
 	err = nrm_vector_create(&ret, sizeof(nrm_actuator_t *));
@@ -442,18 +943,9 @@ int nrm_client_list_scopes(nrm_client_t *client, nrm_vector_t **scopes)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_LIST);
 	nrm_msg_set_list_scopes(msg, NULL);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	nrm_vector_t *ret;
 	err = nrm_vector_create(&ret, sizeof(nrm_scope_t *));
@@ -465,6 +957,10 @@ int nrm_client_list_scopes(nrm_client_t *client, nrm_vector_t **scopes)
 	for (size_t i = 0; i < msg->list->scopes->n_scopes; i++) {
 		nrm_scope_t *s =
 		        nrm_scope_create_frommsg(msg->list->scopes->scopes[i]);
+		if (s == NULL)
+			continue;
+		nrm_client_scopeid_set(client, s->uuid,
+		                       msg->list->scopes->scopes[i]->id);
 		nrm_vector_push_back(ret, &s);
 	}
 	*scopes = ret;
@@ -472,6 +968,37 @@ int nrm_client_list_scopes(nrm_client_t *client, nrm_vector_t **scopes)
 	return 0;
 }
 
+int nrm_client_resolve_scope(nrm_client_t *client,
+                             nrm_scope_t *scope,
+                             nrm_scope_t **match)
+{
+	if (client == NULL || scope == NULL || match == NULL)
+		return -NRM_EINVAL;
+
+	nrm_log_debug("crafting message\n");
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_RESOLVE);
+	nrm_msg_set_resolve(msg, scope);
+	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
+
+	int err = -NRM_ENOTFOUND;
+	assert(msg->type == NRM_MSG_TYPE_RESOLVE);
+	if (msg->data_case == NRM__MESSAGE__DATA_RESOLVE) {
+		*match = nrm_scope_create_frommsg(msg->resolve);
+		if (*match != NULL) {
+			nrm_client_scopeid_set(client, (*match)->uuid,
+			                       msg->resolve->id);
+			err = 0;
+		} else
+			err = -NRM_EINVAL;
+	}
+	nrm_msg_destroy_received(&msg);
+	return err;
+}
+
 int nrm_client_list_sensors(nrm_client_t *client, nrm_vector_t **sensors)
 {
 	if (client == NULL || sensors == NULL)
@@ -484,18 +1011,9 @@ int nrm_client_list_sensors(nrm_client_t *client, nrm_vector_t **sensors)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_LIST);
 	nrm_msg_set_list_sensors(msg, NULL);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	nrm_vector_t *ret;
 	err = nrm_vector_create(&ret, sizeof(nrm_sensor_t *));
@@ -526,18 +1044,9 @@ int nrm_client_list_slices(nrm_client_t *client, nrm_vector_t **slices)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_LIST);
 	nrm_msg_set_list_slices(msg, NULL);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	nrm_vector_t *ret;
 	err = nrm_vector_create(&ret, sizeof(nrm_slice_t *));
@@ -568,18 +1077,9 @@ int nrm_client_remove_actuator(nrm_client_t *client, nrm_actuator_t *actuator)
 	nrm_msg_set_remove(msg, NRM_MSG_TARGET_TYPE_ACTUATOR,
 	                   nrm_actuator_uuid(actuator));
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	assert(msg->type == NRM_MSG_TYPE_ACK);
 	nrm_msg_destroy_received(&msg);
@@ -596,19 +1096,11 @@ int nrm_client_remove_scope(nrm_client_t *client, nrm_scope_t *scope)
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_REMOVE);
 	nrm_msg_set_remove(msg, NRM_MSG_TARGET_TYPE_SCOPE, scope->uuid);
+	nrm_client_scopeid_remove(client, scope->uuid);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	assert(msg->type == NRM_MSG_TYPE_ACK);
 	nrm_msg_destroy_received(&msg);
@@ -626,18 +1118,9 @@ int nrm_client_remove_sensor(nrm_client_t *client, nrm_sensor_t *sensor)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_REMOVE);
 	nrm_msg_set_remove(msg, NRM_MSG_TARGET_TYPE_SENSOR, sensor->uuid);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	assert(msg->type == NRM_MSG_TYPE_ACK);
 	nrm_msg_destroy_received(&msg);
@@ -655,22 +1138,256 @@ int nrm_client_remove_slice(nrm_client_t *client, nrm_slice_t *slice)
 	nrm_msg_fill(msg, NRM_MSG_TYPE_REMOVE);
 	nrm_msg_set_remove(msg, NRM_MSG_TARGET_TYPE_SLICE, slice->uuid);
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
+
+	assert(msg->type == NRM_MSG_TYPE_ACK);
+	nrm_msg_destroy_received(&msg);
+	return 0;
+}
+
+/* sends all the events buffered by a thread in a single message, with its
+ * lock held
+ */
+static int nrm_client_thread_flush(struct nrm_client_thread_s *t)
+{
+	if (t->npending == 0)
+		return 0;
+
+	nrm_vector_clear(t->ready);
+	nrm_vector_foreach(t->pending, iter)
+	{
+		struct nrm_client_serie_s *s = nrm_vector_iterator_get(iter);
+		size_t n;
+		nrm_vector_length(s->timeserie->events, &n);
+		if (n != 0)
+			nrm_vector_push_back(t->ready, &s->timeserie);
+	}
+
+	/* the message is packed right away, it can be refilled next time */
+	t->events = nrm_msg_reset(t->events);
+	if (t->events == NULL)
+		return -NRM_ENOMEM;
+	nrm_msg_fill(t->events, NRM_MSG_TYPE_EVENTS);
+	nrm_msg_set_events(t->events, t->ready);
+	nrm_log_printmsg(NRM_LOG_DEBUG, t->events);
+	zframe_t *frame = nrm_msg_pack(t->events);
+	if (frame == NULL)
+		return -NRM_ENOMEM;
+	nrm_log_debug("sending %zu buffered events\n", t->npending);
+	int err = nrm_role_send_packed(t->client->role, frame);
+	if (err) {
+		/* the role cannot take events, keeping them would only grow
+		 * the buffer until the next failure
+		 */
+		nrm_log_error("failed to send events, dropping %zu: %d\n",
+		              t->npending, err);
+		zframe_destroy(&frame);
+	}
+
+	/* empty the series but keep their memory for the next events */
+	size_t n;
+	nrm_vector_length(t->pending, &n);
+	for (size_t i = n; i > 0; i--) {
+		struct nrm_client_serie_s *s;
+		nrm_vector_get_withtype(struct nrm_client_serie_s, t->pending,
+		                        i - 1, s);
+		size_t len;
+		nrm_vector_length(s->timeserie->events, &len);
+		if (len != 0) {
+			nrm_vector_clear(s->timeserie->events);
+			s->timeserie->start = 0;
+			s->idle = 0;
+			continue;
+		}
+		if (++s->idle < NRM_CLIENT_SERIE_MAXIDLE)
+			continue;
+		nrm_scope_destroy(s->timeserie->scope);
+		nrm_timeserie_destroy(&s->timeserie);
+		nrm_vector_take(t->pending, i - 1, NULL);
+	}
+	t->npending = 0;
+	return err;
+}
+
+static int nrm_client_buffer_event(struct nrm_client_thread_s *t,
+                                   nrm_time_t time,
+                                   nrm_sensor_t *sensor,
+                                   nrm_scope_t *scope,
+                                   double value)
+{
+	nrm_client_t *client = t->client;
+	struct nrm_client_serie_s *serie = NULL;
+	nrm_vector_foreach(t->pending, iter)
+	{
+		struct nrm_client_serie_s *s = nrm_vector_iterator_get(iter);
+		nrm_timeserie_t *ts = s->timeserie;
+		if (!nrm_string_cmp(ts->sensor_uuid, sensor->uuid) &&
+		    !nrm_string_cmp(ts->scope->uuid, scope->uuid) &&
+		    !nrm_scope_cmp(ts->scope, scope)) {
+			serie = s;
+			break;
+		}
+	}
+	size_t gen = __atomic_load_n(&client->scopeids_gen, __ATOMIC_ACQUIRE);
+	if (serie == NULL) {
+		/* the scope is kept as long as the serie, that might be
+		 * after the user is done with it
+		 */
+		nrm_scope_t *copy = nrm_scope_dup(scope);
+		if (copy == NULL)
+			return -NRM_ENOMEM;
+		nrm_timeserie_t *ts;
+		int err = nrm_timeserie_create(&ts, sensor->uuid, copy);
+		if (err) {
+			nrm_scope_destroy(copy);
+			return err;
+		}
+		ts->scope_id = nrm_client_scopeid_get(client, scope->uuid);
+		struct nrm_client_serie_s s = {ts, 0, gen};
+		nrm_vector_push_back(t->pending, &s);
+		size_t n;
+		nrm_vector_length(t->pending, &n);
+		nrm_vector_get_withtype(struct nrm_client_serie_s, t->pending,
+		                        n - 1, serie);
+	} else if (serie->gen != gen) {
+		/* the daemon might have given the scope an id since */
+		serie->timeserie->scope_id =
+		        nrm_client_scopeid_get(client, scope->uuid);
+		serie->gen = gen;
+	}
+	nrm_timeserie_add_event(serie->timeserie, time, value);
+	if (t->npending == 0 && t->maxage != 0) {
+		nrm_time_t now;
+		nrm_time_gettime(&now);
+		t->oldest = nrm_time_tons(&now);
+	}
+	t->npending++;
+	return 0;
+}
+
+static int nrm_client_buffer_aged(struct nrm_client_thread_s *t, int64_t now)
+{
+	return t->maxage != 0 && t->npending != 0 &&
+	       now - t->oldest >= t->maxage;
+}
+
+static int nrm_client_buffer_full(struct nrm_client_thread_s *t)
+{
+	/* not buffering, every event goes out on its own */
+	if (t->maxcount == 0 && t->maxbytes == 0 && t->maxage == 0)
+		return 1;
+	if (t->maxcount != 0 && t->npending >= t->maxcount)
+		return 1;
+	if (t->maxbytes != 0 &&
+	    t->npending * sizeof(nrm_event_t) >= t->maxbytes)
+		return 1;
+	if (t->maxage != 0) {
+		nrm_time_t now;
+		nrm_time_gettime(&now);
+		if (nrm_client_buffer_aged(t, nrm_time_tons(&now)))
+			return 1;
+	}
+	return 0;
+}
+
+/* threads that stop sending events would keep theirs forever, so a thread of
+ * our own goes over the buffers twice per age limit and flushes the ones past
+ * it. The broker can't do it: flushing blocks when its queue is full, until
+ * the broker drains it.
+ */
+static void *nrm_client_flusher(void *arg)
+{
+	nrm_client_t *client = arg;
 	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
+	while (!client->flusher_stop) {
+		if (client->maxage == 0) {
+			pthread_cond_wait(&client->flusher_wake, &client->lock);
+			continue;
+		}
+		nrm_time_t now, deadline;
+		nrm_time_gettime(&now);
+		deadline = nrm_time_fromns(nrm_time_tons(&now) +
+		                           client->maxage / 2);
+		pthread_cond_timedwait(&client->flusher_wake, &client->lock,
+		                       &deadline);
+		if (client->flusher_stop)
+			break;
+		/* thread locks come first */
+		struct nrm_client_thread_s *threads = client->threads;
+		pthread_mutex_unlock(&(client->lock));
+		nrm_time_gettime(&now);
+		for (struct nrm_client_thread_s *t = threads; t != NULL;
+		     t = t->next) {
+			pthread_mutex_lock(&t->lock);
+			if (nrm_client_buffer_aged(t, nrm_time_tons(&now)))
+				nrm_client_thread_flush(t);
+			pthread_mutex_unlock(&t->lock);
+		}
+		pthread_mutex_lock(&(client->lock));
+	}
 	pthread_mutex_unlock(&(client->lock));
+	return NULL;
+}
 
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
+int nrm_client_set_buffering(nrm_client_t *client,
+                             size_t count,
+                             size_t bytes,
+                             nrm_time_t age)
+{
+	if (client == NULL)
+		return -NRM_EINVAL;
+
+	int64_t maxage = nrm_time_tons(&age);
+	if (maxage < 0)
+		return -NRM_EINVAL;
+	int err = 0;
 	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
+	client->maxcount = count;
+	client->maxbytes = bytes;
+	client->maxage = maxage;
+	if (maxage != 0 && !client->flusher_running) {
+		if (pthread_create(&client->flusher, NULL, nrm_client_flusher,
+		                   client))
+			err = -NRM_ENOMEM;
+		else
+			client->flusher_running = 1;
+	}
+	pthread_cond_signal(&client->flusher_wake);
 	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	if (err)
+		return err;
 
-	assert(msg->type == NRM_MSG_TYPE_ACK);
-	nrm_msg_destroy_received(&msg);
-	return 0;
+	for (struct nrm_client_thread_s *t = nrm_client_threads(client);
+	     t != NULL; t = t->next) {
+		pthread_mutex_lock(&t->lock);
+		int ret = nrm_client_thread_flush(t);
+		t->maxcount = count;
+		t->maxbytes = bytes;
+		t->maxage = maxage;
+		pthread_mutex_unlock(&t->lock);
+		if (ret)
+			err = ret;
+	}
+	return err;
+}
+
+int nrm_client_flush(nrm_client_t *client)
+{
+	if (client == NULL)
+		return -NRM_EINVAL;
+
+	int err = 0;
+	for (struct nrm_client_thread_s *t = nrm_client_threads(client);
+	     t != NULL; t = t->next) {
+		pthread_mutex_lock(&t->lock);
+		int ret = nrm_client_thread_flush(t);
+		pthread_mutex_unlock(&t->lock);
+		if (ret)
+			err = ret;
+	}
+	return err;
 }
 
 int nrm_client_send_event(nrm_client_t *client,
@@ -682,29 +1399,15 @@ int nrm_client_send_event(nrm_client_t *client,
 	if (client == NULL || sensor == NULL || scope == NULL)
 		return -NRM_EINVAL;
 
-	nrm_log_debug("crafting message\n");
-	nrm_timeserie_t *timeserie;
-	nrm_timeserie_create(&timeserie, sensor->uuid, scope);
-	assert(timeserie != NULL);
-
-	nrm_timeserie_add_event(timeserie, time, value);
-
-	nrm_vector_t *timeseries;
-	nrm_vector_create(&timeseries, sizeof(nrm_timeserie_t *));
-	nrm_vector_push_back(timeseries, &timeserie);
-
-	nrm_msg_t *msg = nrm_msg_create();
-	nrm_msg_fill(msg, NRM_MSG_TYPE_EVENTS);
-	nrm_msg_set_events(msg, timeseries);
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	nrm_vector_destroy(&timeseries);
-	nrm_timeserie_destroy(&timeserie);
-	return 0;
+	struct nrm_client_thread_s *t = nrm_client_thread_get(client);
+	if (t == NULL)
+		return -NRM_ENOMEM;
+	pthread_mutex_lock(&t->lock);
+	int err = nrm_client_buffer_event(t, time, sensor, scope, value);
+	if (!err && nrm_client_buffer_full(t))
+		err = nrm_client_thread_flush(t);
+	pthread_mutex_unlock(&t->lock);
+	return err;
 }
 
 int nrm_client_send_exit(nrm_client_t *client)
@@ -716,10 +1419,15 @@ int nrm_client_send_exit(nrm_client_t *client)
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_EXIT);
 	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	return 0;
+	/* nobody waits for the ack, it gets dropped on arrival */
+	zframe_t *frame = nrm_msg_pack(msg);
+	nrm_msg_destroy_created(&msg);
+	if (frame == NULL)
+		return -NRM_ENOMEM;
+	int err = nrm_role_send_packed(client->role, frame);
+	if (err)
+		zframe_destroy(&frame);
+	return err;
 }
 
 int nrm_client_send_tick(nrm_client_t *client)
@@ -730,18 +1438,9 @@ int nrm_client_send_tick(nrm_client_t *client)
 	nrm_log_debug("crafting message\n");
 	nrm_msg_t *msg = nrm_msg_create();
 	nrm_msg_fill(msg, NRM_MSG_TYPE_TICK);
-	nrm_log_debug("sending request\n");
-	pthread_mutex_lock(&(client->lock));
-	nrm_role_send(client->role, msg, NULL);
-	pthread_mutex_unlock(&(client->lock));
-
-	/* wait for the answer */
-	nrm_log_debug("receiving reply\n");
-	pthread_mutex_lock(&(client->lock));
-	msg = nrm_role_recv(client->role, NULL);
-	pthread_mutex_unlock(&(client->lock));
-	nrm_log_debug("parsing reply\n");
-	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
+	msg = nrm_client_rpc(client, msg);
+	if (msg == NULL)
+		return -NRM_ENOMEM;
 
 	assert(msg->type == NRM_MSG_TYPE_ACK);
 	nrm_msg_destroy_received(&msg);
@@ -754,7 +1453,39 @@ void nrm_client_destroy(nrm_client_t **client)
 		return;
 
 	nrm_client_t *c = *client;
+	if (c->flusher_running) {
+		pthread_mutex_lock(&(c->lock));
+		c->flusher_stop = 1;
+		pthread_cond_signal(&c->flusher_wake);
+		pthread_mutex_unlock(&(c->lock));
+		pthread_join(c->flusher, NULL);
+	}
+	/* requests nobody waited for */
+	while (c->requests != NULL) {
+		nrm_client_request_t *r = c->requests;
+		c->requests = r->next;
+		nrm_msg_destroy_received(&r->reply);
+		free(r);
+	}
+	/* no thread exit can race with us past that point */
+	pthread_key_delete(c->key);
+	nrm_client_flush(c);
+	while (c->threads != NULL) {
+		struct nrm_client_thread_s *t = c->threads;
+		c->threads = t->next;
+		nrm_client_thread_destroy(t);
+	}
 	nrm_role_destroy(&c->role);
+	nrm_hash_foreach(c->scopeids, iter)
+	{
+		struct nrm_client_scopeid_s *e = nrm_hash_iterator_get(iter);
+		nrm_string_decref(e->uuid);
+		free(e);
+	}
+	nrm_hash_destroy(&c->scopeids);
+	pthread_cond_destroy(&c->replied);
+	pthread_cond_destroy(&c->flusher_wake);
+	pthread_mutex_destroy(&c->lock);
 	free(c);
 	*client = NULL;
 }
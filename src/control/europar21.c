@@ -25,6 +25,11 @@ typedef struct europar21_data {
 	nrm_time_t lastaction;
 	nrm_vector_t *inputs;
 	nrm_vector_t *outputs;
+	/* scratch space for the rates and late events, reused across
+	 * actions
+	 */
+	nrm_vector_t *rates;
+	nrm_vector_t *late;
 } nrm_control_europar21_data_t;
 
 static inline double
@@ -100,10 +105,16 @@ int nrm_control_europar21_create(nrm_control_t **control, json_t *config)
 		in.sensor_uuid = nrm_string_fromchar(sensor);
 		in.scope_uuid = nrm_string_fromchar(scope);
 		in.since = creationtime;
-		in.timeserie = NULL;
+		in.cursor.watermark = nrm_time_tons(&creationtime);
+		in.cursor.late = 0;
+		in.events = NULL;
+		in.scope = NULL;
 		nrm_vector_push_back(data->inputs, &in);
 	}
 
+	nrm_vector_create(&data->rates, sizeof(double));
+	nrm_vector_create(&data->late, sizeof(nrm_event_t));
+
 	object = json_object_get(config, "outputs");
 	assert(object != NULL);
 	nrm_vector_create(&data->outputs, sizeof(nrm_control_output_t));
@@ -160,38 +171,92 @@ int nrm_control_europar21_getargs(nrm_control_t *control,
 	return 0;
 }
 
-double nrm_control_europar21_events2progress(nrm_vector_t *events)
+static int europar21_event_cmp(const void *a, const void *b)
+{
+	const nrm_event_t *e1 = a, *e2 = b;
+	return (e1->time > e2->time) - (e1->time < e2->time);
+}
+
+/* add the rates between consecutive events, prev being the time of the one
+ * before the first, or -1.
+ */
+static int64_t europar21_add_rates(nrm_control_europar21_data_t *data,
+                                   const int64_t *times,
+                                   const double *values,
+                                   size_t n,
+                                   int64_t prev)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (prev >= 0 && times[i] > prev) {
+			double dt = (times[i] - prev) * 1e-9;
+			double nv = values[i] / dt;
+			nrm_vector_push_back(data->rates, &nv);
+		}
+		prev = times[i];
+	}
+	return prev;
+}
+
+/* median of the rates between consecutive events of the input since the last
+ * action, read in place from the eventbase. Late events are older than the
+ * window: they only give rates between themselves, once sorted by time.
+ * Returns -NRM_EDOM if there are not enough events.
+ */
+int nrm_control_europar21_events2progress(nrm_control_europar21_data_t *data,
+                                          nrm_control_input_t *in,
+                                          double *progress)
 {
-	nrm_vector_t *diffs;
-	size_t numevents;
-	nrm_event_t *e, *prev_e;
-	nrm_vector_create(&diffs, sizeof(double));
-	nrm_vector_length(events, &numevents);
-	nrm_vector_get_withtype(nrm_event_t, events, 0, prev_e);
-	for (size_t i = 1; i < numevents; i++) {
-		nrm_vector_get_withtype(nrm_event_t, events, i, e);
-		int64_t delta = nrm_time_diff(&prev_e->time, &e->time);
-		double val = e->value;
-		double nv = val / (delta * 1e-9);
-		nrm_vector_push_back(diffs, &nv);
-		prev_e = e;
+	nrm_eventbase_view_t view;
+	int err = nrm_eventbase_view_cursor(in->events, in->sensor_uuid,
+	                                    in->scope, &in->cursor, &view);
+	if (err)
+		return err;
+
+	const int64_t *times;
+	const double *values;
+	size_t n;
+	int64_t prev = -1;
+	nrm_vector_clear(data->rates);
+	nrm_vector_clear(data->late);
+	while (!nrm_eventbase_view_next(&view, &times, &values, &n) && n != 0)
+		prev = europar21_add_rates(data, times, values, n, prev);
+	while (!nrm_eventbase_view_next_late(&view, &times, &values, &n) &&
+	       n != 0) {
+		for (size_t i = 0; i < n; i++) {
+			nrm_event_t e = {times[i], values[i]};
+			nrm_vector_push_back(data->late, &e);
+		}
+	}
+	nrm_eventbase_view_end(&view);
+
+	size_t numlate;
+	nrm_vector_length(data->late, &numlate);
+	nrm_vector_sort(data->late, europar21_event_cmp);
+	prev = -1;
+	for (size_t i = 0; i < numlate; i++) {
+		nrm_event_t *e;
+		nrm_vector_get_withtype(nrm_event_t, data->late, i, e);
+		prev = europar21_add_rates(data, &e->time, &e->value, 1, prev);
 	}
 
-	nrm_log_debug("progress: will use %zu freqs for median\n",
-	              numevents - 1);
-	double *a, *b, median;
-	nrm_vector_sort(diffs, nrm_vector_sort_double_cmp);
-	if ((numevents - 1) % 2 == 1) {
-		nrm_vector_get_withtype(double, diffs, (numevents - 1) / 2, a);
-		median = *a;
+	size_t numrates;
+	nrm_vector_length(data->rates, &numrates);
+	if (numrates == 0)
+		return -NRM_EDOM;
+
+	nrm_log_debug("progress: will use %zu freqs for median\n", numrates);
+	double *a, *b;
+	nrm_vector_sort(data->rates, nrm_vector_sort_double_cmp);
+	if (numrates % 2 == 1) {
+		nrm_vector_get_withtype(double, data->rates, numrates / 2, a);
+		*progress = *a;
 	} else {
-		nrm_vector_get_withtype(double, diffs, (numevents - 1) / 2 - 1,
+		nrm_vector_get_withtype(double, data->rates, numrates / 2 - 1,
 		                        a);
-		nrm_vector_get_withtype(double, diffs, (numevents - 1) / 2, b);
-		median = (*a + *b) / 2.0;
+		nrm_vector_get_withtype(double, data->rates, numrates / 2, b);
+		*progress = (*a + *b) / 2.0;
 	}
-	nrm_vector_destroy(&diffs);
-	return median;
+	return 0;
 }
 
 int nrm_control_europar21_action(nrm_control_t *control,
@@ -207,13 +272,20 @@ int nrm_control_europar21_action(nrm_control_t *control,
 	if (in == NULL)
 		return -NRM_EINVAL;
 
-	size_t numevents;
-	nrm_vector_t *events = nrm_timeserie_get_events(in->timeserie);
-	nrm_vector_length(events, &numevents);
-	if (events == NULL || numevents <= 1)
+	if (in->events == NULL || in->scope == NULL)
 		return 0;
 
-	prog = nrm_control_europar21_events2progress(events);
+	/* the eventbase keeps a sketch of the rates, use it if we can and
+	 * fall back to computing the median ourselves.
+	 */
+	int err = nrm_eventbase_pull_rate_quantile(
+	        in->events, in->sensor_uuid, in->scope, in->since, 0.5, &prog);
+	if (err == -NRM_ENOTFOUND)
+		err = nrm_control_europar21_events2progress(data, in, &prog);
+	if (err == -NRM_EDOM)
+		return 0;
+	if (err)
+		return err;
 	nrm_vector_get_withtype(nrm_control_output_t, outputs, 0, out);
 	if (out == NULL)
 		return -NRM_EINVAL;
@@ -264,6 +336,8 @@ int nrm_control_europar21_destroy(nrm_control_t **control)
 	data = (nrm_control_europar21_data_t *)ret->data;
 	nrm_vector_destroy(&data->inputs);
 	nrm_vector_destroy(&data->outputs);
+	nrm_vector_destroy(&data->rates);
+	nrm_vector_destroy(&data->late);
 	free(ret);
 	*control = NULL;
 	return 0;
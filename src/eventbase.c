@@ -11,6 +11,7 @@
 #include "config.h"
 
 #include "nrm.h"
+#include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,51 +19,290 @@
 
 #include "internal/nrmi.h"
 
-#include "internal/uthash.h"
-#include "internal/utlist.h"
-
+/* default width of a timeslice, in nanoseconds */
 #define TIMESLICE_PERIOD 1000
 
-/* a slice of events, indexed by the start of the slice (a multiple of
- * TIMESLICE_PERIOD nanoseconds
+/* bounds on the width chosen in adaptive mode */
+#define TIMESLICE_PERIOD_MIN 1000
+#define TIMESLICE_PERIOD_MAX 1000000000
+
+/* minimum number of slices a scope can hold, must be a power of 2 */
+#define TIMESLICE_RING_MINSIZE 8
+
+/* initial number of events a slice can hold */
+#define TIMESLICE_MINSIZE 16
+
+/* number of shards sensors are spread over, must be a power of 2 */
+#define EVENTBASE_SHARDS 16
+
+/* a slice of events, covering [key, key + width). The key is usually a
+ * multiple of the width, unless the slice had to be shrunk to fit between
+ * its neighbors.
+ *
+ * Events are stored in columns, sorted by time: times in nanoseconds and
+ * values in separate arrays, so that aggregations run over contiguous
+ * doubles. We also maintain a rollup of the values as they come in, to
+ * answer aggregate queries without looking at the events.
+ *
+ * Once sealed, the columns are replaced by a compressed stream, see below.
  */
 struct nrm_eb_timeslice_s {
 	int64_t key;
-	nrm_vector_t *events;
-	UT_hash_handle hh;
+	int64_t width;
+	size_t count;
+	size_t capacity;
+	int64_t *times;
+	double *values;
+	uint8_t *packed;
+	size_t packedsize;
+	double sum;
+	double min;
+	double max;
+	double first;
+	double last;
 };
 typedef struct nrm_eb_timeslice_s nrm_eb_timeslice_t;
 
-/* all the slices for a given scope */
-/* TODO maybe we could store them in a ringbuffer and just use the hash for
- * TODO indexing faster? or just index faster into the ringbuffer.
+/* quantile sketches of the values and rates seen during one period, starting
+ * at the tick time start.
+ */
+struct nrm_eb_sketches_s {
+	int64_t start;
+	nrm_sketch_t *values;
+	nrm_sketch_t *rates;
+};
+typedef struct nrm_eb_sketches_s nrm_eb_sketches_t;
+
+/* an event that arrived at or before the watermark of its scope */
+struct nrm_eb_late_s {
+	int64_t time;
+	double value;
+};
+typedef struct nrm_eb_late_s nrm_eb_late_t;
+
+/* all the slices for a given scope, sorted by key in a ring: the oldest
+ * slice is at index first, and the ring doubles in size when full.
  */
 struct nrm_eb_scopebase_s {
 	nrm_string_t uuid;
-	nrm_eb_timeslice_t *slices;
+	/* id of the scope in its state, 0 if unknown */
+	size_t id;
+	nrm_eb_timeslice_t **slices;
+	size_t first;
+	size_t count;
+	size_t capacity;
+	/* width of new slices */
+	int64_t period;
+	/* number of events pushed since the last tick */
+	size_t pushed;
+	/* one set of sketches per period, in a ring of maxperiods+1, NULL
+	 * until the first event if quantiles are enabled.
+	 */
+	nrm_eb_sketches_t *sketches;
+	size_t cursketch;
+	/* time of the latest event, to compute rates. Anything pushed at or
+	 * before it afterwards is late.
+	 */
+	int64_t watermark;
+	/* late events in arrival order, the first one being number latefirst
+	 * since the scope was created.
+	 */
+	nrm_eb_late_t *late;
+	size_t nlate;
+	size_t latecapacity;
+	uint64_t latefirst;
+	/* number of open views. While there are any, the slices and late
+	 * events stay as they are: pushes wait in pending until the last view
+	 * ends, and ticks leave the scope alone.
+	 */
+	size_t views;
+	nrm_event_t *pending;
+	size_t npending;
+	size_t pendingcapacity;
+	/* removed while viewed, the last view frees it */
+	int orphan;
 };
 typedef struct nrm_eb_scopebase_s nrm_eb_scopebase_t;
 
 struct nrm_eb_sensorbase_s {
 	nrm_string_t uuid;
+	/* id of the sensor in its state, 0 if unknown */
+	size_t id;
+	/* fixed slice width for this sensor, 0 if none */
+	int64_t period;
 	nrm_hash_t *scopes;
+	/* the same scopes, indexed by id */
+	void **scopeids;
+	size_t nscopeids;
 };
 typedef struct nrm_eb_sensorbase_s nrm_eb_sensorbase_t;
 
+/* sensors are spread over shards by uuid, each with its own rwlock: pushes
+ * to sensors in different shards run concurrently, and pulls only hold their
+ * shard for reading while they copy data out, blocking the writers of that
+ * shard meanwhile. Views pin their scope instead of holding the lock. Ticks
+ * and configuration changes take every lock, in order.
+ */
+struct nrm_eb_shard_s {
+	pthread_rwlock_t lock;
+	nrm_hash_t *sensors;
+	/* the same sensors, indexed by id */
+	void **sensorids;
+	size_t nsensorids;
+};
+typedef struct nrm_eb_shard_s nrm_eb_shard_t;
+
 /* the typedef is already in nrm.h */
 struct nrm_eventbase_s {
 	size_t maxperiods;
-	nrm_hash_t *sensors;
+	/* the last maxperiods+1 tick times, the oldest one is our retention
+	 * horizon. NULL if we keep everything.
+	 */
+	nrm_ringbuffer_t *ticks;
+	int64_t lasttick;
+	/* default slice width, and per-sensor ones (int64_t *) */
+	int64_t period;
+	nrm_hash_t *periods;
+	/* target number of events per slice, 0 if not adaptive */
+	size_t adaptive;
+	/* whether to compress slices once their period is over */
+	int compress;
+	/* accuracy of the quantile sketches, 0 if disabled */
+	double quantiles;
+	/* everything above only changes with all the shards locked */
+	nrm_eb_shard_t shards[EVENTBASE_SHARDS];
 };
 
 /******************************************************************************
- * Key utils
+ * Slice ring: logical index i is at (first + i) modulo capacity
+ ******************************************************************************/
+
+static inline nrm_eb_timeslice_t **nrm_eb_ring_ref(nrm_eb_scopebase_t *sc,
+                                                   size_t i)
+{
+	return &sc->slices[(sc->first + i) & (sc->capacity - 1)];
+}
+
+#define nrm_eb_ring_at(sc, i) (*nrm_eb_ring_ref(sc, i))
+
+static int nrm_eb_ring_grow(nrm_eb_scopebase_t *sc)
+{
+	size_t newcap = TIMESLICE_RING_MINSIZE;
+	if (sc->capacity != 0)
+		newcap = 2 * sc->capacity;
+
+	nrm_eb_timeslice_t **slices = malloc(newcap * sizeof(*slices));
+	if (slices == NULL)
+		return -NRM_ENOMEM;
+	for (size_t i = 0; i < sc->count; i++)
+		slices[i] = nrm_eb_ring_at(sc, i);
+	free(sc->slices);
+	sc->slices = slices;
+	sc->first = 0;
+	sc->capacity = newcap;
+	return 0;
+}
+
+/* index of the first slice ending after time t */
+static size_t nrm_eb_ring_lower_bound(nrm_eb_scopebase_t *sc, int64_t t)
+{
+	size_t lo = 0, hi = sc->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		nrm_eb_timeslice_t *ts = nrm_eb_ring_at(sc, mid);
+		if (ts->key + ts->width <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* insert a slice at index i, moving the following ones back by one */
+static int nrm_eb_ring_insert(nrm_eb_scopebase_t *sc,
+                              size_t i,
+                              nrm_eb_timeslice_t *ts)
+{
+	if (sc->count == sc->capacity) {
+		int err = nrm_eb_ring_grow(sc);
+		if (err)
+			return err;
+	}
+	for (size_t j = sc->count; j > i; j--)
+		*nrm_eb_ring_ref(sc, j) = nrm_eb_ring_at(sc, j - 1);
+	*nrm_eb_ring_ref(sc, i) = ts;
+	sc->count++;
+	return 0;
+}
+
+static nrm_eb_timeslice_t *nrm_eb_ring_pop_front(nrm_eb_scopebase_t *sc)
+{
+	nrm_eb_timeslice_t *ret = nrm_eb_ring_at(sc, 0);
+	sc->first = (sc->first + 1) & (sc->capacity - 1);
+	sc->count--;
+	return ret;
+}
+
+/******************************************************************************
+ * Id tables: sensors and scopes that are part of a state have a small integer
+ * id, used to index these arrays on the push path.
+ ******************************************************************************/
+
+static int nrm_eb_ids_set(void ***ids, size_t *len, size_t id, void *ptr)
+{
+	if (id >= *len) {
+		size_t newlen = *len != 0 ? *len : 16;
+		while (newlen <= id)
+			newlen *= 2;
+		void **n = realloc(*ids, newlen * sizeof(void *));
+		if (n == NULL)
+			return -NRM_ENOMEM;
+		memset(n + *len, 0, (newlen - *len) * sizeof(void *));
+		*ids = n;
+		*len = newlen;
+	}
+	(*ids)[id] = ptr;
+	return 0;
+}
+
+static inline void *nrm_eb_ids_get(void **ids, size_t len, size_t id)
+{
+	return id < len ? ids[id] : NULL;
+}
+
+static void nrm_eb_ids_clear(void **ids, size_t len, size_t id, void *ptr)
+{
+	if (id != 0 && id < len && ids[id] == ptr)
+		ids[id] = NULL;
+}
+
+/*******************************************************************************
+ * Shards
  ******************************************************************************/
 
-int64_t nrm_eb_time2key(nrm_time_t t)
+/* FNV-1a of the uuid, so that a sensor lands in the same shard whether we
+ * know its id or not.
+ */
+static nrm_eb_shard_t *nrm_eb_shard(nrm_eventbase_t *eb, nrm_string_t uuid)
+{
+	uint32_t h = 2166136261u;
+	for (const char *c = uuid; *c != '\0'; c++) {
+		h ^= (uint8_t)*c;
+		h *= 16777619u;
+	}
+	return &eb->shards[h & (EVENTBASE_SHARDS - 1)];
+}
+
+static void nrm_eb_lock_all(nrm_eventbase_t *eb)
+{
+	for (size_t i = 0; i < EVENTBASE_SHARDS; i++)
+		pthread_rwlock_wrlock(&eb->shards[i].lock);
+}
+
+static void nrm_eb_unlock_all(nrm_eventbase_t *eb)
 {
-	int64_t key = nrm_time_tons(&t);
-	return key - (key % TIMESLICE_PERIOD);
+	for (size_t i = EVENTBASE_SHARDS; i > 0; i--)
+		pthread_rwlock_unlock(&eb->shards[i - 1].lock);
 }
 
 /*******************************************************************************
@@ -71,11 +311,25 @@ int64_t nrm_eb_time2key(nrm_time_t t)
 
 nrm_eventbase_t *nrm_eventbase_create(size_t maxperiods)
 {
-	nrm_eventbase_t *ret = calloc(1, sizeof(nrm_state_t));
+	nrm_eventbase_t *ret = calloc(1, sizeof(nrm_eventbase_t));
 	if (ret == NULL)
 		return NULL;
 	ret->maxperiods = maxperiods;
-	ret->sensors = NULL;
+	ret->ticks = NULL;
+	ret->lasttick = 0;
+	ret->period = TIMESLICE_PERIOD;
+	ret->periods = NULL;
+	ret->adaptive = 0;
+	ret->compress = 0;
+	ret->quantiles = 0.0;
+	if (maxperiods != 0 &&
+	    nrm_ringbuffer_create(&ret->ticks, maxperiods + 1,
+	                          sizeof(nrm_time_t))) {
+		free(ret);
+		return NULL;
+	}
+	for (size_t i = 0; i < EVENTBASE_SHARDS; i++)
+		pthread_rwlock_init(&ret->shards[i].lock, NULL);
 	return ret;
 }
 
@@ -84,53 +338,536 @@ size_t nrm_eventbase_get_maxperiods(nrm_eventbase_t *eb)
 	return eb->maxperiods;
 }
 
+static void nrm_eb_timeslice_destroy(nrm_eb_timeslice_t *ts)
+{
+	free(ts->times);
+	free(ts->values);
+	free(ts->packed);
+	free(ts);
+}
+
+static void nrm_eb_sketches_destroy(nrm_eb_sketches_t **sketches, size_t n)
+{
+	if (*sketches == NULL)
+		return;
+	for (size_t i = 0; i < n; i++) {
+		nrm_sketch_destroy(&(*sketches)[i].values);
+		nrm_sketch_destroy(&(*sketches)[i].rates);
+	}
+	free(*sketches);
+	*sketches = NULL;
+}
+
+static void nrm_eb_scopebase_destroy(nrm_eventbase_t *eb,
+                                     nrm_eb_scopebase_t *sc)
+{
+	for (size_t i = 0; i < sc->count; i++)
+		nrm_eb_timeslice_destroy(nrm_eb_ring_at(sc, i));
+	free(sc->slices);
+	free(sc->late);
+	free(sc->pending);
+	nrm_eb_sketches_destroy(&sc->sketches, eb->maxperiods + 1);
+	nrm_string_decref(sc->uuid);
+	free(sc);
+}
+
+static inline int nrm_eb_scopebase_pinned(nrm_eb_scopebase_t *sc)
+{
+	return __atomic_load_n(&sc->views, __ATOMIC_ACQUIRE) != 0;
+}
+
+/* for scopes removed from their sensor, with the shard write locked */
+static void nrm_eb_scopebase_release(nrm_eventbase_t *eb,
+                                     nrm_eb_scopebase_t *sc)
+{
+	if (nrm_eb_scopebase_pinned(sc))
+		sc->orphan = 1;
+	else
+		nrm_eb_scopebase_destroy(eb, sc);
+}
+
+static void nrm_eb_sensorbase_destroy(nrm_eventbase_t *eb,
+                                      nrm_eb_shard_t *shard,
+                                      nrm_eb_sensorbase_t *sb)
+{
+	nrm_hash_foreach(sb->scopes, isc)
+	{
+		nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+		nrm_eb_scopebase_release(eb, sc);
+	}
+	nrm_hash_destroy(&sb->scopes);
+	free(sb->scopeids);
+	nrm_eb_ids_clear(shard->sensorids, shard->nsensorids, sb->id, sb);
+	nrm_string_decref(sb->uuid);
+	free(sb);
+}
+
 void nrm_eventbase_destroy(nrm_eventbase_t **eventbase)
 {
 	if (eventbase == NULL || *eventbase == NULL)
 		return;
 	nrm_eventbase_t *eb = *eventbase;
 
-	nrm_hash_foreach(eb->sensors, isb)
-	{
-		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
-		nrm_hash_foreach(sb->scopes, isc)
+	for (size_t i = 0; i < EVENTBASE_SHARDS; i++) {
+		nrm_eb_shard_t *shard = &eb->shards[i];
+		nrm_hash_foreach(shard->sensors, isb)
 		{
-			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
-			nrm_eb_timeslice_t *ts, *tstmp;
-			HASH_ITER(hh, sc->slices, ts, tstmp)
-			{
-				nrm_vector_destroy(&ts->events);
-				HASH_DEL(sc->slices, ts);
-				free(ts);
-			}
-			HASH_CLEAR(hh, sc->slices);
-			nrm_string_decref(sc->uuid);
-			free(sc);
+			nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+			nrm_eb_sensorbase_destroy(eb, shard, sb);
 		}
-		nrm_hash_destroy(&sb->scopes);
-		nrm_string_decref(sb->uuid);
-		free(sb);
+		nrm_hash_destroy(&shard->sensors);
+		free(shard->sensorids);
+		pthread_rwlock_destroy(&shard->lock);
+	}
+	nrm_hash_foreach(eb->periods, iter)
+	{
+		nrm_string_decref(nrm_hash_iterator_get_uuid(iter));
+		free(nrm_hash_iterator_get(iter));
 	}
-	nrm_hash_destroy(&eb->sensors);
+	nrm_hash_destroy(&eb->periods);
+	if (eb->ticks != NULL)
+		nrm_ringbuffer_destroy(&eb->ticks);
 	free(eb);
 	*eventbase = NULL;
 }
 
+/*******************************************************************************
+ * Aggregation kernels: they work on contiguous values, with independent
+ * accumulators so that the compiler can keep them in vector registers without
+ * reordering floating point operations.
+ ******************************************************************************/
+
+static double nrm_eb_kernel_sum(const double *restrict v, size_t n)
+{
+	double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		s0 += v[i];
+		s1 += v[i + 1];
+		s2 += v[i + 2];
+		s3 += v[i + 3];
+	}
+	for (; i < n; i++)
+		s0 += v[i];
+	return (s0 + s1) + (s2 + s3);
+}
+
+static double nrm_eb_kernel_min(const double *restrict v, size_t n)
+{
+	double m0 = v[0], m1 = v[0], m2 = v[0], m3 = v[0];
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		m0 = v[i] < m0 ? v[i] : m0;
+		m1 = v[i + 1] < m1 ? v[i + 1] : m1;
+		m2 = v[i + 2] < m2 ? v[i + 2] : m2;
+		m3 = v[i + 3] < m3 ? v[i + 3] : m3;
+	}
+	for (; i < n; i++)
+		m0 = v[i] < m0 ? v[i] : m0;
+	m0 = m1 < m0 ? m1 : m0;
+	m2 = m3 < m2 ? m3 : m2;
+	return m2 < m0 ? m2 : m0;
+}
+
+static double nrm_eb_kernel_max(const double *restrict v, size_t n)
+{
+	double m0 = v[0], m1 = v[0], m2 = v[0], m3 = v[0];
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		m0 = v[i] > m0 ? v[i] : m0;
+		m1 = v[i + 1] > m1 ? v[i + 1] : m1;
+		m2 = v[i + 2] > m2 ? v[i + 2] : m2;
+		m3 = v[i + 3] > m3 ? v[i + 3] : m3;
+	}
+	for (; i < n; i++)
+		m0 = v[i] > m0 ? v[i] : m0;
+	m0 = m1 > m0 ? m1 : m0;
+	m2 = m3 > m2 ? m3 : m2;
+	return m2 > m0 ? m2 : m0;
+}
+
 /*******************************************************************************
  * Pushing events: we push individual events, or entire timeseries.
  ******************************************************************************/
 
-int nrm_eventbase_add_event(nrm_eb_timeslice_t *ts, nrm_time_t time, double val)
+static int nrm_eb_timeslice_grow(nrm_eb_timeslice_t *ts)
+{
+	size_t newcap = TIMESLICE_MINSIZE;
+	if (ts->capacity != 0)
+		newcap = 2 * ts->capacity;
+
+	int64_t *times = realloc(ts->times, newcap * sizeof(int64_t));
+	if (times == NULL)
+		return -NRM_ENOMEM;
+	ts->times = times;
+	double *values = realloc(ts->values, newcap * sizeof(double));
+	if (values == NULL)
+		return -NRM_ENOMEM;
+	ts->values = values;
+	ts->capacity = newcap;
+	return 0;
+}
+
+/* index of the first event at or after time t */
+static size_t nrm_eb_timeslice_lower_bound(nrm_eb_timeslice_t *ts, int64_t t)
+{
+	size_t lo = 0, hi = ts->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (ts->times[mid] < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int nrm_eventbase_add_event(nrm_eb_timeslice_t *ts, int64_t time, double val)
+{
+	if (ts->count == ts->capacity) {
+		int err = nrm_eb_timeslice_grow(ts);
+		if (err)
+			return err;
+	}
+
+	/* out of order events are rare, make room for them in place */
+	size_t i = ts->count;
+	if (i > 0 && ts->times[i - 1] > time) {
+		i = nrm_eb_timeslice_lower_bound(ts, time + 1);
+		memmove(&ts->times[i + 1], &ts->times[i],
+		        (ts->count - i) * sizeof(int64_t));
+		memmove(&ts->values[i + 1], &ts->values[i],
+		        (ts->count - i) * sizeof(double));
+	}
+	ts->times[i] = time;
+	ts->values[i] = val;
+	ts->count++;
+
+	/* rollup */
+	if (ts->count == 1 || val < ts->min)
+		ts->min = val;
+	if (ts->count == 1 || val > ts->max)
+		ts->max = val;
+	ts->sum += val;
+	ts->first = ts->values[0];
+	ts->last = ts->values[ts->count - 1];
+	return 0;
+}
+
+/* append sorted events, none of them before the last one of the slice */
+static int nrm_eb_timeslice_append(nrm_eb_timeslice_t *ts,
+                                   const nrm_event_t *events,
+                                   size_t n)
+{
+	while (ts->capacity < ts->count + n) {
+		int err = nrm_eb_timeslice_grow(ts);
+		if (err)
+			return err;
+	}
+
+	int64_t *times = &ts->times[ts->count];
+	double *values = &ts->values[ts->count];
+	for (size_t i = 0; i < n; i++) {
+		times[i] = events[i].time;
+		values[i] = events[i].value;
+	}
+
+	/* rollup */
+	double min = nrm_eb_kernel_min(values, n);
+	double max = nrm_eb_kernel_max(values, n);
+	if (ts->count == 0 || min < ts->min)
+		ts->min = min;
+	if (ts->count == 0 || max > ts->max)
+		ts->max = max;
+	ts->sum += nrm_eb_kernel_sum(values, n);
+	ts->count += n;
+	ts->first = ts->values[0];
+	ts->last = ts->values[ts->count - 1];
+	return 0;
+}
+
+/*******************************************************************************
+ * Sealed slices: once a period is over, slices are compressed in the style of
+ * Gorilla (Pelkonen et al., VLDB 2015). Times are stored as delta-of-deltas,
+ * values as the XOR with the previous one, both with variable length codes.
+ * Regular events with slowly changing values take a few bits each.
+ ******************************************************************************/
+
+struct nrm_eb_bitwriter_s {
+	uint8_t *buf;
+	size_t bits;
+	size_t capacity;
+};
+typedef struct nrm_eb_bitwriter_s nrm_eb_bitwriter_t;
+
+struct nrm_eb_bitreader_s {
+	const uint8_t *buf;
+	size_t bits;
+};
+typedef struct nrm_eb_bitreader_s nrm_eb_bitreader_t;
+
+/* write the n (<= 64) low bits of v, most significant first */
+static int nrm_eb_bits_write(nrm_eb_bitwriter_t *w, uint64_t v, int n)
+{
+	size_t need = (w->bits + n + 7) / 8;
+	if (need > w->capacity) {
+		size_t newcap = w->capacity != 0 ? 2 * w->capacity : 64;
+		while (newcap < need)
+			newcap *= 2;
+		uint8_t *buf = realloc(w->buf, newcap);
+		if (buf == NULL)
+			return -NRM_ENOMEM;
+		memset(buf + w->capacity, 0, newcap - w->capacity);
+		w->buf = buf;
+		w->capacity = newcap;
+	}
+	while (n > 0) {
+		int room = 8 - (w->bits & 7);
+		int take = n < room ? n : room;
+		uint8_t chunk = (v >> (n - take)) & ((1u << take) - 1);
+		w->buf[w->bits >> 3] |= chunk << (room - take);
+		w->bits += take;
+		n -= take;
+	}
+	return 0;
+}
+
+static uint64_t nrm_eb_bits_read(nrm_eb_bitreader_t *r, int n)
+{
+	uint64_t v = 0;
+	while (n > 0) {
+		int room = 8 - (r->bits & 7);
+		int take = n < room ? n : room;
+		uint8_t chunk = r->buf[r->bits >> 3] >> (room - take);
+		v = (v << take) | (chunk & ((1u << take) - 1));
+		r->bits += take;
+		n -= take;
+	}
+	return v;
+}
+
+/* delta-of-delta classes: prefix, prefix length, payload length */
+static const struct {
+	uint64_t prefix;
+	int plen;
+	int bits;
+} nrm_eb_dod_codes[] = {
+        {0x2, 2, 7}, {0x6, 3, 9}, {0xe, 4, 12}, {0x1e, 5, 32}, {0x1f, 5, 64},
+};
+
+#define NRM_EB_DOD_CODES                                                       \
+	(sizeof(nrm_eb_dod_codes) / sizeof(nrm_eb_dod_codes[0]))
+
+/* encoder and decoder share the same state */
+struct nrm_eb_codec_s {
+	size_t index;
+	int64_t time;
+	int64_t delta;
+	uint64_t value;
+	int leading;
+	int trailing;
+};
+typedef struct nrm_eb_codec_s nrm_eb_codec_t;
+
+static inline uint64_t nrm_eb_double_bits(double v)
+{
+	uint64_t ret;
+	memcpy(&ret, &v, sizeof(ret));
+	return ret;
+}
+
+static inline double nrm_eb_bits_double(uint64_t v)
+{
+	double ret;
+	memcpy(&ret, &v, sizeof(ret));
+	return ret;
+}
+
+static int nrm_eb_encode(nrm_eb_codec_t *c,
+                         nrm_eb_bitwriter_t *w,
+                         int64_t time,
+                         double value)
+{
+	int err;
+	uint64_t bits = nrm_eb_double_bits(value);
+
+	if (c->index++ == 0) {
+		c->time = time;
+		c->value = bits;
+		c->leading = -1;
+		err = nrm_eb_bits_write(w, (uint64_t)time, 64);
+		return err ? err : nrm_eb_bits_write(w, bits, 64);
+	}
+
+	int64_t delta = time - c->time;
+	int64_t dod = delta - c->delta;
+	c->time = time;
+	c->delta = delta;
+	if (dod == 0)
+		err = nrm_eb_bits_write(w, 0, 1);
+	else {
+		size_t i;
+		for (i = 0; i < NRM_EB_DOD_CODES - 1; i++) {
+			int64_t lim = INT64_C(1)
+			              << (nrm_eb_dod_codes[i].bits - 1);
+			if (dod >= -lim && dod < lim)
+				break;
+		}
+		int n = nrm_eb_dod_codes[i].bits;
+		uint64_t mask = n == 64 ? UINT64_MAX : (UINT64_C(1) << n) - 1;
+		err = nrm_eb_bits_write(w, nrm_eb_dod_codes[i].prefix,
+		                        nrm_eb_dod_codes[i].plen);
+		if (!err)
+			err = nrm_eb_bits_write(w, (uint64_t)dod & mask, n);
+	}
+	if (err)
+		return err;
+
+	uint64_t x = bits ^ c->value;
+	c->value = bits;
+	if (x == 0)
+		return nrm_eb_bits_write(w, 0, 1);
+
+	int leading = __builtin_clzll(x);
+	int trailing = __builtin_ctzll(x);
+	if (leading > 31)
+		leading = 31;
+	/* reuse the previous window if the meaningful bits fit in it */
+	if (c->leading >= 0 && leading >= c->leading &&
+	    trailing >= c->trailing) {
+		int n = 64 - c->leading - c->trailing;
+		err = nrm_eb_bits_write(w, 0x2, 2);
+		return err ? err : nrm_eb_bits_write(w, x >> c->trailing, n);
+	}
+	int n = 64 - leading - trailing;
+	c->leading = leading;
+	c->trailing = trailing;
+	err = nrm_eb_bits_write(w, 0x3, 2);
+	if (!err)
+		err = nrm_eb_bits_write(w, leading, 5);
+	if (!err)
+		err = nrm_eb_bits_write(w, n - 1, 6);
+	return err ? err : nrm_eb_bits_write(w, x >> trailing, n);
+}
+
+static void nrm_eb_decode(nrm_eb_codec_t *c,
+                          nrm_eb_bitreader_t *r,
+                          int64_t *time,
+                          double *value)
+{
+	if (c->index++ == 0) {
+		c->time = (int64_t)nrm_eb_bits_read(r, 64);
+		c->value = nrm_eb_bits_read(r, 64);
+		c->leading = -1;
+		goto end;
+	}
+
+	if (nrm_eb_bits_read(r, 1) != 0) {
+		/* find the class from the number of leading ones */
+		size_t i = 0;
+		while (i < NRM_EB_DOD_CODES - 1 && nrm_eb_bits_read(r, 1) != 0)
+			i++;
+		int n = nrm_eb_dod_codes[i].bits;
+		uint64_t v = nrm_eb_bits_read(r, n);
+		/* sign extend */
+		if (n < 64 && (v >> (n - 1)) != 0)
+			v |= UINT64_MAX << n;
+		c->delta += (int64_t)v;
+	}
+	c->time += c->delta;
+
+	if (nrm_eb_bits_read(r, 1) != 0) {
+		if (nrm_eb_bits_read(r, 1) != 0) {
+			c->leading = (int)nrm_eb_bits_read(r, 5);
+			int n = (int)nrm_eb_bits_read(r, 6) + 1;
+			c->trailing = 64 - c->leading - n;
+		}
+		int n = 64 - c->leading - c->trailing;
+		c->value ^= nrm_eb_bits_read(r, n) << c->trailing;
+	}
+end:
+	*time = c->time;
+	*value = nrm_eb_bits_double(c->value);
+}
+
+/* compress the events of a slice, replacing its columns */
+static int nrm_eb_timeslice_seal(nrm_eb_timeslice_t *ts)
+{
+	if (ts->packed != NULL || ts->count == 0)
+		return 0;
+
+	nrm_eb_bitwriter_t w = {NULL, 0, 0};
+	nrm_eb_codec_t c = {0};
+	for (size_t i = 0; i < ts->count; i++) {
+		int err = nrm_eb_encode(&c, &w, ts->times[i], ts->values[i]);
+		if (err) {
+			free(w.buf);
+			return err;
+		}
+	}
+	/* only keep what we used */
+	size_t size = (w.bits + 7) / 8;
+	uint8_t *packed = realloc(w.buf, size);
+	ts->packed = packed != NULL ? packed : w.buf;
+	ts->packedsize = size;
+	free(ts->times);
+	free(ts->values);
+	ts->times = NULL;
+	ts->values = NULL;
+	ts->capacity = 0;
+	return 0;
+}
+
+/* decompress a sealed slice back into columns */
+static int nrm_eb_timeslice_unseal(nrm_eb_timeslice_t *ts)
 {
-	nrm_event_t e;
-	e.time = time;
-	e.value = val;
-	nrm_vector_push_back(ts->events, &e);
+	if (ts->packed == NULL)
+		return 0;
+
+	size_t count = ts->count;
+	while (ts->capacity < count) {
+		int err = nrm_eb_timeslice_grow(ts);
+		if (err)
+			return err;
+	}
+	nrm_eb_bitreader_t r = {ts->packed, 0};
+	nrm_eb_codec_t c = {0};
+	for (size_t i = 0; i < count; i++)
+		nrm_eb_decode(&c, &r, &ts->times[i], &ts->values[i]);
+	free(ts->packed);
+	ts->packed = NULL;
+	ts->packedsize = 0;
 	return 0;
 }
 
+/* streaming decoder over the events of a sealed slice, in time order */
+struct nrm_eb_decoder_s {
+	size_t remaining;
+	nrm_eb_bitreader_t reader;
+	nrm_eb_codec_t codec;
+};
+typedef struct nrm_eb_decoder_s nrm_eb_decoder_t;
+
+static void nrm_eb_decoder_init(nrm_eb_decoder_t *dec, nrm_eb_timeslice_t *ts)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->remaining = ts->count;
+	dec->reader.buf = ts->packed;
+}
+
+static int nrm_eb_decoder_next(nrm_eb_decoder_t *dec, int64_t *t, double *v)
+{
+	if (dec->remaining == 0)
+		return 0;
+	nrm_eb_decode(&dec->codec, &dec->reader, t, v);
+	dec->remaining--;
+	return 1;
+}
+
 nrm_eb_timeslice_t *nrm_eventbase_add_timeslice(nrm_eb_scopebase_t *sc,
-                                                int64_t key)
+                                                size_t index,
+                                                int64_t key,
+                                                int64_t width)
 {
 	nrm_eb_timeslice_t *ret;
 	ret = calloc(1, sizeof(nrm_eb_timeslice_t));
@@ -138,12 +875,100 @@ nrm_eb_timeslice_t *nrm_eventbase_add_timeslice(nrm_eb_scopebase_t *sc,
 		return NULL;
 
 	ret->key = key;
-	nrm_vector_create(&ret->events, sizeof(nrm_event_t));
-	HASH_ADD(hh, sc->slices, key, sizeof(int64_t), ret);
+	ret->width = width;
+	if (nrm_eb_ring_insert(sc, index, ret)) {
+		nrm_eb_timeslice_destroy(ret);
+		return NULL;
+	}
 	return ret;
 }
 
-nrm_eb_scopebase_t *nrm_eventbase_add_scope(nrm_eb_sensorbase_t *sb,
+nrm_eb_timeslice_t *nrm_eventbase_find_timeslice(nrm_eb_scopebase_t *sc,
+                                                 int64_t t)
+{
+	size_t i = sc->count;
+	nrm_eb_timeslice_t *ts, *prev = NULL, *next = NULL;
+
+	/* events mostly arrive in order: check the last slice first, and only
+	 * search the ring for late events.
+	 */
+	if (i > 0) {
+		ts = nrm_eb_ring_at(sc, i - 1);
+		if (t >= ts->key + ts->width)
+			prev = ts;
+		else if (t >= ts->key)
+			return ts;
+		else {
+			i = nrm_eb_ring_lower_bound(sc, t);
+			ts = nrm_eb_ring_at(sc, i);
+			if (t >= ts->key)
+				return ts;
+			next = ts;
+			if (i > 0)
+				prev = nrm_eb_ring_at(sc, i - 1);
+		}
+	}
+
+	/* the period might have changed since the neighbors were created, make
+	 * sure the new slice does not overlap them.
+	 */
+	int64_t start = t - (t % sc->period);
+	int64_t end = start + sc->period;
+	if (prev != NULL && start < prev->key + prev->width)
+		start = prev->key + prev->width;
+	if (next != NULL && end > next->key)
+		end = next->key;
+	return nrm_eventbase_add_timeslice(sc, i, start, end - start);
+}
+
+static int nrm_eb_sketches_create(nrm_eventbase_t *eb, nrm_eb_scopebase_t *sc)
+{
+	size_t n = eb->maxperiods + 1;
+	sc->sketches = calloc(n, sizeof(nrm_eb_sketches_t));
+	if (sc->sketches == NULL)
+		return -NRM_ENOMEM;
+	for (size_t i = 0; i < n; i++) {
+		/* periods we haven't seen yet stop any search */
+		sc->sketches[i].start = INT64_MIN;
+		if (nrm_sketch_create(&sc->sketches[i].values, eb->quantiles) ||
+		    nrm_sketch_create(&sc->sketches[i].rates, eb->quantiles)) {
+			nrm_eb_sketches_destroy(&sc->sketches, n);
+			return -NRM_ENOMEM;
+		}
+	}
+	sc->cursketch = 0;
+	sc->sketches[0].start = eb->lasttick;
+	return 0;
+}
+
+static int nrm_eb_sketches_push(nrm_eventbase_t *eb,
+                                nrm_eb_scopebase_t *sc,
+                                int64_t t,
+                                double value)
+{
+	int err;
+	if (sc->sketches == NULL) {
+		err = nrm_eb_sketches_create(eb, sc);
+		if (err)
+			return err;
+	}
+
+	nrm_eb_sketches_t *cur = &sc->sketches[sc->cursketch];
+	err = nrm_sketch_add(cur->values, value);
+	if (err)
+		return err;
+	/* late events don't have a meaningful rate */
+	if (sc->watermark != 0 && t > sc->watermark) {
+		err = nrm_sketch_add(cur->rates,
+		                     value * 1e9 / (t - sc->watermark));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+nrm_eb_scopebase_t *nrm_eventbase_add_scope(nrm_eventbase_t *eb,
+                                            nrm_eb_sensorbase_t *sb,
                                             nrm_scope_t *scope)
 {
 	nrm_eb_scopebase_t *ret;
@@ -151,6 +976,7 @@ nrm_eb_scopebase_t *nrm_eventbase_add_scope(nrm_eb_sensorbase_t *sb,
 	if (ret == NULL)
 		return NULL;
 
+	ret->period = sb->period != 0 ? sb->period : eb->period;
 	ret->uuid = nrm_scope_uuid(scope);
 	nrm_string_incref(ret->uuid);
 	nrm_hash_add(&sb->scopes, ret->uuid, ret);
@@ -158,6 +984,7 @@ nrm_eb_scopebase_t *nrm_eventbase_add_scope(nrm_eb_sensorbase_t *sb,
 }
 
 nrm_eb_sensorbase_t *nrm_eventbase_add_sensor(nrm_eventbase_t *eb,
+                                              nrm_eb_shard_t *shard,
                                               nrm_string_t sensor_uuid)
 {
 	nrm_eb_sensorbase_t *ret;
@@ -165,63 +992,539 @@ nrm_eb_sensorbase_t *nrm_eventbase_add_sensor(nrm_eventbase_t *eb,
 	if (ret == NULL)
 		return NULL;
 
+	int64_t *period = NULL;
+	nrm_hash_find(eb->periods, sensor_uuid, (void *)&period);
+	ret->period = period != NULL ? *period : 0;
 	ret->uuid = sensor_uuid;
 	nrm_string_incref(ret->uuid);
-	nrm_hash_add(&eb->sensors, ret->uuid, ret);
+	nrm_hash_add(&shard->sensors, ret->uuid, ret);
 	return ret;
 }
 
-int nrm_eventbase_push_event(nrm_eventbase_t *eb,
-                             nrm_string_t sensor_uuid,
-                             nrm_scope_t *scope,
-                             nrm_time_t time,
-                             double value)
+/* find the sensorbase for a sensor in its shard, by id if we have it and by
+ * uuid otherwise, creating it if needed. The shard must be write locked.
+ */
+static nrm_eb_sensorbase_t *nrm_eventbase_get_sensor(nrm_eventbase_t *eb,
+                                                     nrm_eb_shard_t *shard,
+                                                     nrm_string_t sensor_uuid,
+                                                     size_t id)
 {
-	int err;
-	if (eb == NULL || scope == NULL)
-		return -NRM_EINVAL;
-
 	nrm_eb_sensorbase_t *sb;
-	if (eb->sensors == NULL)
-		sb = nrm_eventbase_add_sensor(eb, sensor_uuid);
-	else {
-		err = nrm_hash_find(eb->sensors, sensor_uuid, (void *)&sb);
-		assert(err == 0 || err == -NRM_ENOTFOUND);
-		if (err == -NRM_ENOTFOUND)
-			sb = nrm_eventbase_add_sensor(eb, sensor_uuid);
-	}
+	sb = nrm_eb_ids_get(shard->sensorids, shard->nsensorids, id);
+	if (sb != NULL)
+		return sb;
 
-	nrm_eb_scopebase_t *sc;
-	if (sb->scopes == NULL)
-		sc = nrm_eventbase_add_scope(sb, scope);
-	else {
-		err = nrm_hash_find(sb->scopes, scope->uuid, (void *)&sc);
-		assert(err == 0 || err == -NRM_ENOTFOUND);
-		if (err == -NRM_ENOTFOUND)
-			sc = nrm_eventbase_add_scope(sb, scope);
-	}
+	nrm_hash_find(shard->sensors, sensor_uuid, (void *)&sb);
+	if (sb == NULL)
+		sb = nrm_eventbase_add_sensor(eb, shard, sensor_uuid);
+	if (sb == NULL || id == 0)
+		return sb;
 
-	/* convert time to key */
-	int64_t key = nrm_time_tons(&time);
-	key = key - (key % TIMESLICE_PERIOD);
+	/* the uuid might have been registered again with a new id */
+	if (nrm_eb_ids_set(&shard->sensorids, &shard->nsensorids, id, sb))
+		return NULL;
+	nrm_eb_ids_clear(shard->sensorids, shard->nsensorids, sb->id, sb);
+	sb->id = id;
+	return sb;
+}
 
-	nrm_eb_timeslice_t *ts;
-	if (sc->slices == NULL)
-		ts = nrm_eventbase_add_timeslice(sc, key);
-	else {
-		HASH_FIND(hh, sc->slices, &key, sizeof(key), ts);
-		if (ts == NULL)
-			ts = nrm_eventbase_add_timeslice(sc, key);
+static nrm_eb_scopebase_t *nrm_eventbase_get_scope(nrm_eventbase_t *eb,
+                                                   nrm_eb_sensorbase_t *sb,
+                                                   nrm_scope_t *scope)
+{
+	nrm_eb_scopebase_t *sc;
+	sc = nrm_eb_ids_get(sb->scopeids, sb->nscopeids, scope->id);
+	if (sc != NULL)
+		return sc;
+
+	nrm_hash_find(sb->scopes, scope->uuid, (void *)&sc);
+	if (sc == NULL)
+		sc = nrm_eventbase_add_scope(eb, sb, scope);
+	if (sc == NULL || scope->id == 0)
+		return sc;
+
+	if (nrm_eb_ids_set(&sb->scopeids, &sb->nscopeids, scope->id, sc))
+		return NULL;
+	nrm_eb_ids_clear(sb->scopeids, sb->nscopeids, sc->id, sc);
+	sc->id = scope->id;
+	return sc;
+}
+
+/* remember a late event, so that cursors see it even if their window is
+ * already past it.
+ */
+static int nrm_eb_late_push(nrm_eb_scopebase_t *sc, int64_t t, double value)
+{
+	if (sc->nlate == sc->latecapacity) {
+		size_t newcap = sc->latecapacity != 0 ? 2 * sc->latecapacity
+		                                      : TIMESLICE_MINSIZE;
+		nrm_eb_late_t *late;
+		late = realloc(sc->late, newcap * sizeof(nrm_eb_late_t));
+		if (late == NULL)
+			return -NRM_ENOMEM;
+		sc->late = late;
+		sc->latecapacity = newcap;
 	}
+	sc->late[sc->nlate].time = t;
+	sc->late[sc->nlate].value = value;
+	sc->nlate++;
+	return 0;
+}
+
+/* keep events pushed to a pinned scope for when its last view ends */
+static int nrm_eb_pending_push(nrm_eb_scopebase_t *sc,
+                               const nrm_event_t *events,
+                               size_t n)
+{
+	if (sc->npending + n > sc->pendingcapacity) {
+		size_t newcap = sc->pendingcapacity != 0 ? sc->pendingcapacity
+		                                         : TIMESLICE_MINSIZE;
+		while (newcap < sc->npending + n)
+			newcap *= 2;
+		nrm_event_t *pending;
+		pending = realloc(sc->pending, newcap * sizeof(nrm_event_t));
+		if (pending == NULL)
+			return -NRM_ENOMEM;
+		sc->pending = pending;
+		sc->pendingcapacity = newcap;
+	}
+	memcpy(sc->pending + sc->npending, events, n * sizeof(nrm_event_t));
+	sc->npending += n;
+	return 0;
+}
+
+/* push a run of events to an unpinned scope. Consecutive events going to the
+ * end of the same slice are appended in bulk.
+ */
+static int nrm_eb_scopebase_push(nrm_eventbase_t *eb,
+                                 nrm_eb_scopebase_t *sc,
+                                 const nrm_event_t *events,
+                                 size_t n)
+{
+	int err;
+	size_t i = 0;
+	while (i < n) {
+		int64_t t = events[i].time;
+		nrm_eb_timeslice_t *ts = nrm_eventbase_find_timeslice(sc, t);
+		if (ts == NULL)
+			return -NRM_ENOMEM;
 
-	nrm_eventbase_add_event(ts, time, value);
+		/* a late event for a sealed slice: reopen it, and seal it
+		 * back since its period is over.
+		 */
+		err = nrm_eb_timeslice_unseal(ts);
+		if (err)
+			return err;
+
+		size_t j = i + 1;
+		if (ts->count == 0 || ts->times[ts->count - 1] <= t) {
+			int64_t prev = t, end = ts->key + ts->width;
+			for (; j < n; j++) {
+				int64_t tj = events[j].time;
+				if (tj < prev || tj >= end)
+					break;
+				prev = tj;
+			}
+			err = nrm_eb_timeslice_append(ts, &events[i], j - i);
+		} else
+			err = nrm_eventbase_add_event(ts, t, events[i].value);
+		if (err)
+			return err;
+
+		if (eb->compress && ts->key + ts->width <= eb->lasttick) {
+			err = nrm_eb_timeslice_seal(ts);
+			if (err)
+				return err;
+		}
+		sc->pushed += j - i;
+
+		for (; i < j; i++) {
+			t = events[i].time;
+			if (eb->quantiles != 0.0) {
+				err = nrm_eb_sketches_push(eb, sc, t,
+				                           events[i].value);
+				if (err)
+					return err;
+			}
+			if (t > sc->watermark)
+				sc->watermark = t;
+			else {
+				err = nrm_eb_late_push(sc, t, events[i].value);
+				if (err)
+					return err;
+			}
+		}
+	}
 	return 0;
 }
 
+/* push the events kept while the scope was pinned, in arrival order. The ones
+ * that don't make it are dropped, like those of a failed push.
+ */
+static int nrm_eb_pending_flush(nrm_eventbase_t *eb, nrm_eb_scopebase_t *sc)
+{
+	size_t n = sc->npending;
+	sc->npending = 0;
+	if (n == 0)
+		return 0;
+	return nrm_eb_scopebase_push(eb, sc, sc->pending, n);
+}
+
+/* push a run of events, resolving the scope once */
+static int nrm_eventbase_push(nrm_eventbase_t *eb,
+                              nrm_eb_sensorbase_t *sb,
+                              nrm_scope_t *scope,
+                              const nrm_event_t *events,
+                              size_t n)
+{
+	if (sb == NULL)
+		return -NRM_ENOMEM;
+
+	nrm_eb_scopebase_t *sc = nrm_eventbase_get_scope(eb, sb, scope);
+	if (sc == NULL)
+		return -NRM_ENOMEM;
+
+	if (nrm_eb_scopebase_pinned(sc))
+		return nrm_eb_pending_push(sc, events, n);
+	int err = nrm_eb_pending_flush(eb, sc);
+	if (err)
+		return err;
+	return nrm_eb_scopebase_push(eb, sc, events, n);
+}
+
+int nrm_eventbase_push_event(nrm_eventbase_t *eb,
+                             nrm_string_t sensor_uuid,
+                             nrm_scope_t *scope,
+                             nrm_time_t time,
+                             double value)
+{
+	if (eb == NULL || sensor_uuid == NULL || scope == NULL)
+		return -NRM_EINVAL;
+
+	nrm_event_t e = {nrm_time_tons(&time), value};
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	pthread_rwlock_wrlock(&shard->lock);
+	nrm_eb_sensorbase_t *sb;
+	sb = nrm_eventbase_get_sensor(eb, shard, sensor_uuid, 0);
+	int err = nrm_eventbase_push(eb, sb, scope, &e, 1);
+	pthread_rwlock_unlock(&shard->lock);
+	return err;
+}
+
+int nrm_eventbase_push_sensor_event(nrm_eventbase_t *eb,
+                                    nrm_sensor_t *sensor,
+                                    nrm_scope_t *scope,
+                                    nrm_time_t time,
+                                    double value)
+{
+	nrm_event_t e = {nrm_time_tons(&time), value};
+	return nrm_eventbase_push_events(eb, sensor, scope, &e, 1);
+}
+
+int nrm_eventbase_push_events(nrm_eventbase_t *eb,
+                              nrm_sensor_t *sensor,
+                              nrm_scope_t *scope,
+                              const nrm_event_t *events,
+                              size_t nevents)
+{
+	if (eb == NULL || sensor == NULL || scope == NULL ||
+	    (events == NULL && nevents != 0))
+		return -NRM_EINVAL;
+	if (nevents == 0)
+		return 0;
+
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor->uuid);
+	pthread_rwlock_wrlock(&shard->lock);
+	nrm_eb_sensorbase_t *sb;
+	sb = nrm_eventbase_get_sensor(eb, shard, sensor->uuid, sensor->id);
+	int err = nrm_eventbase_push(eb, sb, scope, events, nevents);
+	pthread_rwlock_unlock(&shard->lock);
+	return err;
+}
+
+int nrm_eventbase_push_timeserie(nrm_eventbase_t *eb, nrm_timeserie_t *ts)
+{
+	if (eb == NULL || ts == NULL)
+		return -NRM_EINVAL;
+
+	size_t nevents;
+	nrm_event_t *events = NULL;
+	nrm_vector_length(ts->events, &nevents);
+	if (nevents == 0)
+		return 0;
+	/* vectors are contiguous */
+	nrm_vector_get(ts->events, 0, (void **)&events);
+
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, ts->sensor_uuid);
+	pthread_rwlock_wrlock(&shard->lock);
+	nrm_eb_sensorbase_t *sb;
+	sb = nrm_eventbase_get_sensor(eb, shard, ts->sensor_uuid, 0);
+	int err = nrm_eventbase_push(eb, sb, ts->scope, events, nevents);
+	pthread_rwlock_unlock(&shard->lock);
+	return err;
+}
+
 /*******************************************************************************
- * Pulling events: we pull entire timeseries
+ * Pulling events: we pull entire timeseries, or aggregates over them
  ******************************************************************************/
 
+/* the shard of the sensor must be locked, at least for reading */
+static nrm_eb_scopebase_t *nrm_eventbase_find_scope(nrm_eb_shard_t *shard,
+                                                   nrm_string_t sensor_uuid,
+                                                   nrm_string_t scope_uuid)
+{
+	nrm_eb_sensorbase_t *sb = NULL;
+	nrm_eb_scopebase_t *sc = NULL;
+	nrm_hash_find(shard->sensors, sensor_uuid, (void *)&sb);
+	if (sb != NULL)
+		nrm_hash_find(sb->scopes, scope_uuid, (void *)&sc);
+	return sc;
+}
+
+/* the state of a view, in the storage reserved by nrm_eventbase_view_t */
+struct nrm_eb_view_s {
+	nrm_eventbase_t *eb;
+	nrm_eb_shard_t *shard;
+	nrm_eb_scopebase_t *scope;
+	size_t slice;
+	int64_t since;
+	int64_t until;
+	int decoding;
+	nrm_eb_decoder_t decoder;
+	/* next late event to look at, and the latest time of the ones to
+	 * return: those after it are in the slices already.
+	 */
+	size_t late;
+	int64_t lateuntil;
+	int64_t times[NRM_EVENTBASE_VIEW_CHUNK];
+	double values[NRM_EVENTBASE_VIEW_CHUNK];
+};
+typedef struct nrm_eb_view_s nrm_eb_view_t;
+
+typedef char nrm_eb_view_fits
+        [sizeof(nrm_eb_view_t) <= sizeof(nrm_eventbase_view_t) ? 1 : -1];
+
+#define nrm_eb_view(view) ((nrm_eb_view_t *)(view)->storage)
+
+int nrm_eventbase_view_begin(nrm_eventbase_t *eb,
+                             nrm_string_t sensor_uuid,
+                             nrm_scope_t *scope,
+                             nrm_time_t since,
+                             nrm_time_t until,
+                             nrm_eventbase_view_t *view)
+{
+	if (eb == NULL || sensor_uuid == NULL || scope == NULL || view == NULL)
+		return -NRM_EINVAL;
+
+	nrm_eb_view_t *v = nrm_eb_view(view);
+	v->shard = NULL;
+	v->since = nrm_time_tons(&since);
+	v->until = nrm_time_tons(&until);
+	if (v->until < v->since)
+		return -NRM_EINVAL;
+
+	/* pinning the scope keeps its data as is without holding the lock, so
+	 * that the owner of the view can still push or tick.
+	 */
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	pthread_rwlock_rdlock(&shard->lock);
+	nrm_eb_scopebase_t *sc;
+	sc = nrm_eventbase_find_scope(shard, sensor_uuid, scope->uuid);
+	if (sc != NULL)
+		__atomic_add_fetch(&sc->views, 1, __ATOMIC_ACQ_REL);
+	pthread_rwlock_unlock(&shard->lock);
+	v->eb = eb;
+	v->shard = shard;
+	v->scope = sc;
+	v->decoding = 0;
+	v->slice = sc != NULL ? nrm_eb_ring_lower_bound(sc, v->since) : 0;
+	/* only cursor views have late events */
+	v->late = sc != NULL ? sc->nlate : 0;
+	v->lateuntil = INT64_MIN;
+	return 0;
+}
+
+int nrm_eventbase_view_next(nrm_eventbase_view_t *view,
+                            const int64_t **times,
+                            const double **values,
+                            size_t *count)
+{
+	if (view == NULL || times == NULL || values == NULL || count == NULL)
+		return -NRM_EINVAL;
+	nrm_eb_view_t *v = nrm_eb_view(view);
+	if (v->shard == NULL)
+		return -NRM_EINVAL;
+
+	/* open slices are returned in place, sealed ones are decoded a chunk
+	 * at a time in the view itself.
+	 */
+	nrm_eb_scopebase_t *sc = v->scope;
+	nrm_eb_decoder_t *dec = &v->decoder;
+	*count = 0;
+	while (sc != NULL && *count == 0) {
+		if (v->decoding) {
+			size_t n = 0;
+			int64_t t;
+			double value;
+			while (n < NRM_EVENTBASE_VIEW_CHUNK &&
+			       nrm_eb_decoder_next(dec, &t, &value)) {
+				if (t >= v->until) {
+					dec->remaining = 0;
+					break;
+				}
+				if (t < v->since)
+					continue;
+				v->times[n] = t;
+				v->values[n] = value;
+				n++;
+			}
+			if (dec->remaining == 0) {
+				v->decoding = 0;
+				v->slice++;
+			}
+			*times = v->times;
+			*values = v->values;
+			*count = n;
+			continue;
+		}
+		if (v->slice >= sc->count)
+			break;
+		nrm_eb_timeslice_t *tl = nrm_eb_ring_at(sc, v->slice);
+		if (tl->key >= v->until)
+			break;
+		if (tl->packed != NULL) {
+			nrm_eb_decoder_init(dec, tl);
+			v->decoding = 1;
+			continue;
+		}
+		size_t lo = nrm_eb_timeslice_lower_bound(tl, v->since);
+		size_t hi = nrm_eb_timeslice_lower_bound(tl, v->until);
+		*times = &tl->times[lo];
+		*values = &tl->values[lo];
+		*count = hi - lo;
+		v->slice++;
+	}
+	return 0;
+}
+
+int nrm_eventbase_view_next_late(nrm_eventbase_view_t *view,
+                                 const int64_t **times,
+                                 const double **values,
+                                 size_t *count)
+{
+	if (view == NULL || times == NULL || values == NULL || count == NULL)
+		return -NRM_EINVAL;
+	nrm_eb_view_t *v = nrm_eb_view(view);
+	if (v->shard == NULL)
+		return -NRM_EINVAL;
+
+	nrm_eb_scopebase_t *sc = v->scope;
+	size_t n = 0;
+	while (sc != NULL && n < NRM_EVENTBASE_VIEW_CHUNK &&
+	       v->late < sc->nlate) {
+		nrm_eb_late_t *e = &sc->late[v->late++];
+		if (e->time > v->lateuntil)
+			continue;
+		v->times[n] = e->time;
+		v->values[n] = e->value;
+		n++;
+	}
+	*times = v->times;
+	*values = v->values;
+	*count = n;
+	return 0;
+}
+
+void nrm_eventbase_view_end(nrm_eventbase_view_t *view)
+{
+	if (view == NULL || nrm_eb_view(view)->shard == NULL)
+		return;
+	nrm_eb_view_t *v = nrm_eb_view(view);
+	nrm_eb_scopebase_t *sc = v->scope;
+	if (sc != NULL) {
+		pthread_rwlock_wrlock(&v->shard->lock);
+		if (__atomic_sub_fetch(&sc->views, 1, __ATOMIC_ACQ_REL) == 0) {
+			if (sc->orphan)
+				nrm_eb_scopebase_destroy(v->eb, sc);
+			else
+				nrm_eb_pending_flush(v->eb, sc);
+		}
+		pthread_rwlock_unlock(&v->shard->lock);
+	}
+	v->shard = NULL;
+	v->scope = NULL;
+}
+
+int nrm_eventbase_view_cursor(nrm_eventbase_t *eb,
+                              nrm_string_t sensor_uuid,
+                              nrm_scope_t *scope,
+                              nrm_eventbase_cursor_t *cursor,
+                              nrm_eventbase_view_t *view)
+{
+	if (cursor == NULL)
+		return -NRM_EINVAL;
+
+	/* the window is (cursor, watermark], times being in nanoseconds */
+	nrm_time_t since = nrm_time_fromns(cursor->watermark + 1);
+	int err = nrm_eventbase_view_begin(eb, sensor_uuid, scope, since, since,
+	                                   view);
+	if (err)
+		return err;
+
+	/* late events newer than the previous window are in this one
+	 * already, the others were never seen.
+	 */
+	nrm_eb_view_t *v = nrm_eb_view(view);
+	nrm_eb_scopebase_t *sc = v->scope;
+	if (sc == NULL)
+		return 0;
+	v->late = cursor->late > sc->latefirst ? cursor->late - sc->latefirst
+	                                       : 0;
+	v->lateuntil = cursor->watermark;
+	if (sc->watermark > cursor->watermark) {
+		v->until = sc->watermark + 1;
+		cursor->watermark = sc->watermark;
+	}
+	cursor->late = sc->latefirst + sc->nlate;
+	return 0;
+}
+
+int nrm_eventbase_pull_cursor(nrm_eventbase_t *eb,
+                              nrm_string_t sensor_uuid,
+                              nrm_scope_t *scope,
+                              nrm_eventbase_cursor_t *cursor,
+                              nrm_timeserie_t **ts)
+{
+	if (eb == NULL || cursor == NULL || ts == NULL)
+		return -NRM_EINVAL;
+
+	nrm_eventbase_view_t view;
+	int err = nrm_eventbase_view_cursor(eb, sensor_uuid, scope, cursor,
+	                                    &view);
+	if (err)
+		return err;
+
+	nrm_timeserie_t *ret;
+	nrm_timeserie_create(&ret, sensor_uuid, scope);
+	const int64_t *times;
+	const double *values;
+	size_t n;
+	while (!nrm_eventbase_view_next(&view, &times, &values, &n) && n != 0) {
+		for (size_t i = 0; i < n; i++)
+			nrm_timeserie_add_event(ret, nrm_time_fromns(times[i]),
+			                        values[i]);
+	}
+	while (!nrm_eventbase_view_next_late(&view, &times, &values, &n) &&
+	       n != 0) {
+		for (size_t i = 0; i < n; i++)
+			nrm_timeserie_add_event(ret, nrm_time_fromns(times[i]),
+			                        values[i]);
+	}
+	nrm_eventbase_view_end(&view);
+	*ts = ret;
+	return 0;
+}
+
 int nrm_eventbase_pull_timeserie(nrm_eventbase_t *eb,
                                  nrm_string_t sensor_uuid,
                                  nrm_scope_t *scope,
@@ -232,53 +1535,693 @@ int nrm_eventbase_pull_timeserie(nrm_eventbase_t *eb,
 		return -NRM_EINVAL;
 
 	/* event if we can't find any data, we'll return an initialized but
-	 * empty timeserie.
+	 * empty timeserie with the events in [since, now).
 	 */
 	nrm_timeserie_t *ret;
 	nrm_timeserie_create(&ret, sensor_uuid, scope);
 
-	nrm_eb_sensorbase_t *sb = NULL;
-	nrm_hash_find(eb->sensors, sensor_uuid, (void *)&sb);
-	if (sb == NULL)
+	nrm_time_t now;
+	nrm_time_gettime(&now);
+	nrm_eventbase_view_t view;
+	if (nrm_eventbase_view_begin(eb, sensor_uuid, scope, since, now,
+	                             &view) == 0) {
+		const int64_t *times;
+		const double *values;
+		size_t n;
+		while (!nrm_eventbase_view_next(&view, &times, &values, &n) &&
+		       n != 0) {
+			for (size_t i = 0; i < n; i++)
+				nrm_timeserie_add_event(
+				        ret, nrm_time_fromns(times[i]),
+				        values[i]);
+		}
+		nrm_eventbase_view_end(&view);
+	}
+	*ts = ret;
+	return 0;
+}
+
+/* sealed slices entirely in range use their rollup, the others are decoded */
+static void nrm_eb_stats_add_sealed(nrm_eventbase_stats_t *stats,
+                                    nrm_eb_timeslice_t *tl,
+                                    int64_t tsince,
+                                    int64_t tuntil)
+{
+	if (tl->key >= tsince && tl->key + tl->width <= tuntil) {
+		if (stats->count == 0 || tl->min < stats->min)
+			stats->min = tl->min;
+		if (stats->count == 0 || tl->max > stats->max)
+			stats->max = tl->max;
+		stats->sum += tl->sum;
+		stats->count += tl->count;
+		return;
+	}
+
+	nrm_eb_decoder_t dec;
+	int64_t t;
+	double v;
+	nrm_eb_decoder_init(&dec, tl);
+	while (nrm_eb_decoder_next(&dec, &t, &v) && t < tuntil) {
+		if (t < tsince)
+			continue;
+		if (stats->count == 0 || v < stats->min)
+			stats->min = v;
+		if (stats->count == 0 || v > stats->max)
+			stats->max = v;
+		stats->sum += v;
+		stats->count++;
+	}
+}
+
+int nrm_eventbase_pull_stats(nrm_eventbase_t *eb,
+                             nrm_string_t sensor_uuid,
+                             nrm_scope_t *scope,
+                             nrm_time_t since,
+                             nrm_time_t until,
+                             nrm_eventbase_stats_t *stats)
+{
+	if (eb == NULL || scope == NULL || stats == NULL)
+		return -NRM_EINVAL;
+
+	int64_t tsince = nrm_time_tons(&since);
+	int64_t tuntil = nrm_time_tons(&until);
+	if (tuntil < tsince)
+		return -NRM_EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	pthread_rwlock_rdlock(&shard->lock);
+	nrm_eb_scopebase_t *sc;
+	sc = nrm_eventbase_find_scope(shard, sensor_uuid, scope->uuid);
+	if (sc == NULL)
 		goto end;
 
-	nrm_eb_scopebase_t *sc = NULL;
-	nrm_hash_find(sb->scopes, scope->uuid, (void *)&sc);
+	for (size_t i = nrm_eb_ring_lower_bound(sc, tsince); i < sc->count;
+	     i++) {
+		nrm_eb_timeslice_t *tl = nrm_eb_ring_at(sc, i);
+		if (tl->key >= tuntil)
+			break;
+		if (tl->packed != NULL) {
+			nrm_eb_stats_add_sealed(stats, tl, tsince, tuntil);
+			continue;
+		}
+		size_t lo = nrm_eb_timeslice_lower_bound(tl, tsince);
+		size_t hi = nrm_eb_timeslice_lower_bound(tl, tuntil);
+		if (lo == hi)
+			continue;
+
+		/* only the slices at both ends need the kernels */
+		double sum = tl->sum, min = tl->min, max = tl->max;
+		if (lo != 0 || hi != tl->count) {
+			const double *v = &tl->values[lo];
+			sum = nrm_eb_kernel_sum(v, hi - lo);
+			min = nrm_eb_kernel_min(v, hi - lo);
+			max = nrm_eb_kernel_max(v, hi - lo);
+		}
+		if (stats->count == 0 || min < stats->min)
+			stats->min = min;
+		if (stats->count == 0 || max > stats->max)
+			stats->max = max;
+		stats->sum += sum;
+		stats->count += hi - lo;
+	}
+end:
+	pthread_rwlock_unlock(&shard->lock);
+	if (stats->count != 0)
+		stats->mean = stats->sum / stats->count;
+	if (tuntil > tsince)
+		stats->rate = stats->sum * 1e9 / (tuntil - tsince);
+	return 0;
+}
+
+/* buckets being filled in time order, the last one is cur */
+struct nrm_eb_aggregator_s {
+	nrm_vector_t *buckets;
+	int64_t since;
+	int64_t step;
+	int64_t bucket;
+	nrm_eventbase_aggregate_t *cur;
+};
+typedef struct nrm_eb_aggregator_s nrm_eb_aggregator_t;
+
+/* add a run of events starting at t, all of them in the same bucket */
+static void nrm_eb_aggregator_add(nrm_eb_aggregator_t *a,
+                                  int64_t t,
+                                  size_t count,
+                                  double sum,
+                                  double min,
+                                  double max,
+                                  double first,
+                                  double last)
+{
+	int64_t b = (t - a->since) / a->step;
+	if (a->cur == NULL || b != a->bucket) {
+		nrm_eventbase_aggregate_t agg;
+		agg.time = nrm_time_fromns(a->since + b * a->step);
+		agg.count = 0;
+		agg.sum = 0.0;
+		agg.first = first;
+		agg.min = min;
+		agg.max = max;
+		size_t len;
+		nrm_vector_push_back(a->buckets, &agg);
+		nrm_vector_length(a->buckets, &len);
+		nrm_vector_get_withtype(nrm_eventbase_aggregate_t, a->buckets,
+		                        len - 1, a->cur);
+		a->bucket = b;
+	}
+	nrm_eventbase_aggregate_t *cur = a->cur;
+	cur->count += count;
+	cur->sum += sum;
+	if (min < cur->min)
+		cur->min = min;
+	if (max > cur->max)
+		cur->max = max;
+	cur->last = last;
+}
+
+/* the events of an open slice in [since, until), one run per bucket */
+static void nrm_eb_aggregator_add_open(nrm_eb_aggregator_t *a,
+                                       nrm_eb_timeslice_t *tl,
+                                       int64_t until)
+{
+	size_t i = nrm_eb_timeslice_lower_bound(tl, a->since);
+	size_t hi = nrm_eb_timeslice_lower_bound(tl, until);
+	while (i < hi) {
+		int64_t b = (tl->times[i] - a->since) / a->step;
+		int64_t end = a->since + (b + 1) * a->step;
+		size_t j = nrm_eb_timeslice_lower_bound(tl, end);
+		if (j > hi)
+			j = hi;
+		const double *v = &tl->values[i];
+		nrm_eb_aggregator_add(a, tl->times[i], j - i,
+		                      nrm_eb_kernel_sum(v, j - i),
+		                      nrm_eb_kernel_min(v, j - i),
+		                      nrm_eb_kernel_max(v, j - i), v[0],
+		                      v[j - i - 1]);
+		i = j;
+	}
+}
+
+static void nrm_eb_aggregator_add_sealed(nrm_eb_aggregator_t *a,
+                                         nrm_eb_timeslice_t *tl,
+                                         int64_t until)
+{
+	nrm_eb_decoder_t dec;
+	int64_t t;
+	double v;
+	nrm_eb_decoder_init(&dec, tl);
+	while (nrm_eb_decoder_next(&dec, &t, &v) && t < until) {
+		if (t >= a->since)
+			nrm_eb_aggregator_add(a, t, 1, v, v, v, v, v);
+	}
+}
+
+int nrm_eventbase_pull_aggregate(nrm_eventbase_t *eb,
+                                 nrm_string_t sensor_uuid,
+                                 nrm_scope_t *scope,
+                                 nrm_time_t since,
+                                 nrm_time_t until,
+                                 nrm_time_t step,
+                                 nrm_vector_t **aggregates)
+{
+	if (eb == NULL || scope == NULL || aggregates == NULL)
+		return -NRM_EINVAL;
+
+	int64_t tsince = nrm_time_tons(&since);
+	int64_t tuntil = nrm_time_tons(&until);
+	int64_t tstep = nrm_time_tons(&step);
+	if (tuntil < tsince || tstep <= 0)
+		return -NRM_EINVAL;
+
+	nrm_vector_t *ret;
+	int err = nrm_vector_create(&ret, sizeof(nrm_eventbase_aggregate_t));
+	if (err)
+		return err;
+
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	pthread_rwlock_rdlock(&shard->lock);
+	nrm_eb_scopebase_t *sc;
+	sc = nrm_eventbase_find_scope(shard, sensor_uuid, scope->uuid);
 	if (sc == NULL)
 		goto end;
 
-	/* the hash table is there to speed up receiving events, as we expect
-	 * pulling events happens less often.
-	 * We also expect some kind of "expiration policy" for events to exist,
-	 * removing extra timeslices on a regular basis.
-	 *
-	 * So, yes, iterating over keys in not the efficient thing, but in
-	 * practice this hash table should be small.
+	/* slices entirely inside a bucket only need their rollup, the ones
+	 * crossing a bucket edge, since or until are split event by event.
 	 */
-	nrm_time_t now;
-	nrm_time_gettime(&now);
-	int64_t ksince = nrm_eb_time2key(since);
-	int64_t know = nrm_eb_time2key(now);
+	nrm_eb_aggregator_t a = {ret, tsince, tstep, 0, NULL};
+	for (size_t i = nrm_eb_ring_lower_bound(sc, tsince); i < sc->count;
+	     i++) {
+		nrm_eb_timeslice_t *tl = nrm_eb_ring_at(sc, i);
+		if (tl->key >= tuntil)
+			break;
+		if (tl->count == 0)
+			continue;
 
-	nrm_eb_timeslice_t *tl, *tltmp;
-	HASH_ITER(hh, sc->slices, tl, tltmp)
-	{
-		if (tl->key >= ksince && tl->key < know)
-			nrm_timeserie_add_events(ret, tl->events);
+		int64_t tend = tl->key + tl->width;
+		if (tl->key >= tsince && tend <= tuntil &&
+		    (tl->key - tsince) / tstep == (tend - 1 - tsince) / tstep)
+			nrm_eb_aggregator_add(&a, tl->key, tl->count, tl->sum,
+			                      tl->min, tl->max, tl->first,
+			                      tl->last);
+		else if (tl->packed != NULL)
+			nrm_eb_aggregator_add_sealed(&a, tl, tuntil);
+		else
+			nrm_eb_aggregator_add_open(&a, tl, tuntil);
 	}
 end:
-	*ts = ret;
+	pthread_rwlock_unlock(&shard->lock);
+	*aggregates = ret;
 	return 0;
 }
 
+static int nrm_eventbase_pull_sketch(nrm_eventbase_t *eb,
+                                     nrm_string_t sensor_uuid,
+                                     nrm_scope_t *scope,
+                                     nrm_time_t since,
+                                     int rates,
+                                     double q,
+                                     double *value)
+{
+	if (eb == NULL || scope == NULL || value == NULL)
+		return -NRM_EINVAL;
+
+	int err;
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	pthread_rwlock_rdlock(&shard->lock);
+	nrm_eb_scopebase_t *sc;
+	sc = nrm_eventbase_find_scope(shard, sensor_uuid, scope->uuid);
+	if (sc == NULL || sc->sketches == NULL) {
+		err = -NRM_ENOTFOUND;
+		goto end;
+	}
+
+	/* walk back from the current period until one starts before since */
+	int64_t tsince = nrm_time_tons(&since);
+	size_t n = eb->maxperiods + 1, k = 0;
+	while (k < n) {
+		size_t j = (sc->cursketch + n - k) % n;
+		k++;
+		if (sc->sketches[j].start <= tsince)
+			break;
+	}
+
+	nrm_eb_sketches_t *cur = &sc->sketches[sc->cursketch];
+	if (k == 1) {
+		err = nrm_sketch_quantile(rates ? cur->rates : cur->values, q,
+		                          value);
+		goto end;
+	}
+
+	nrm_sketch_t *merged;
+	err = nrm_sketch_create(&merged, eb->quantiles);
+	if (err)
+		goto end;
+	for (size_t i = 0; i < k && !err; i++) {
+		size_t j = (sc->cursketch + n - i) % n;
+		nrm_eb_sketches_t *sk = &sc->sketches[j];
+		err = nrm_sketch_merge(merged, rates ? sk->rates : sk->values);
+	}
+	if (!err)
+		err = nrm_sketch_quantile(merged, q, value);
+	nrm_sketch_destroy(&merged);
+end:
+	pthread_rwlock_unlock(&shard->lock);
+	return err;
+}
+
+int nrm_eventbase_pull_quantile(nrm_eventbase_t *eb,
+                                nrm_string_t sensor_uuid,
+                                nrm_scope_t *scope,
+                                nrm_time_t since,
+                                double q,
+                                double *value)
+{
+	return nrm_eventbase_pull_sketch(eb, sensor_uuid, scope, since, 0, q,
+	                                 value);
+}
+
+int nrm_eventbase_pull_rate_quantile(nrm_eventbase_t *eb,
+                                     nrm_string_t sensor_uuid,
+                                     nrm_scope_t *scope,
+                                     nrm_time_t since,
+                                     double q,
+                                     double *value)
+{
+	return nrm_eventbase_pull_sketch(eb, sensor_uuid, scope, since, 1, q,
+	                                 value);
+}
+
 /******************************************************************************
  * State management
  ******************************************************************************/
 
+/* the functions below walk over all the sensors, with every shard locked */
+#define nrm_eb_foreach_sensor(eb, shard, iter)                                 \
+	for (nrm_eb_shard_t *shard = (eb)->shards;                             \
+	     shard < (eb)->shards + EVENTBASE_SHARDS; shard++)                 \
+	nrm_hash_foreach(shard->sensors, iter)
+
+/* remove every slice that ended before the horizon, and any scope or sensor
+ * left without data.
+ */
+static void nrm_eventbase_expire_shard(nrm_eventbase_t *eb,
+                                       nrm_eb_shard_t *shard,
+                                       int64_t horizon)
+{
+	nrm_hash_iterator_t isb = nrm_hash_iterator_begin(shard->sensors);
+	while (isb != NULL) {
+		nrm_hash_iterator_t nsb = nrm_hash_iterator_next(isb);
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+
+		nrm_hash_iterator_t isc = nrm_hash_iterator_begin(sb->scopes);
+		while (isc != NULL) {
+			nrm_hash_iterator_t nsc = nrm_hash_iterator_next(isc);
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			if (nrm_eb_scopebase_pinned(sc)) {
+				isc = nsc;
+				continue;
+			}
+
+			/* expired slices are all at the front of the ring */
+			while (sc->count > 0) {
+				nrm_eb_timeslice_t *ts = nrm_eb_ring_at(sc, 0);
+				if (ts->key + ts->width > horizon)
+					break;
+				nrm_eb_ring_pop_front(sc);
+				nrm_eb_timeslice_destroy(ts);
+			}
+			/* late events are numbered, only drop from the front */
+			size_t k = 0;
+			while (k < sc->nlate && sc->late[k].time < horizon)
+				k++;
+			if (k != 0) {
+				sc->nlate -= k;
+				sc->latefirst += k;
+				memmove(sc->late, sc->late + k,
+				        sc->nlate * sizeof(nrm_eb_late_t));
+			}
+			if (sc->count == 0) {
+				void *p;
+				nrm_hash_remove(&sb->scopes, sc->uuid, &p);
+				nrm_eb_ids_clear(sb->scopeids, sb->nscopeids,
+				                 sc->id, sc);
+				nrm_eb_scopebase_destroy(eb, sc);
+			}
+			isc = nsc;
+		}
+		if (sb->scopes == NULL) {
+			void *p;
+			nrm_hash_remove(&shard->sensors, sb->uuid, &p);
+			nrm_eb_sensorbase_destroy(eb, shard, sb);
+		}
+		isb = nsb;
+	}
+}
+
+static void nrm_eventbase_expire(nrm_eventbase_t *eb, int64_t horizon)
+{
+	for (size_t i = 0; i < EVENTBASE_SHARDS; i++)
+		nrm_eventbase_expire_shard(eb, &eb->shards[i], horizon);
+}
+
+/* pick a new slice width for each scope, so that a slice holds about
+ * eb->adaptive events at the rate observed during the last period.
+ */
+static void nrm_eventbase_adapt(nrm_eventbase_t *eb, int64_t elapsed)
+{
+	nrm_eb_foreach_sensor(eb, shard, isb)
+	{
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+		nrm_hash_foreach(sb->scopes, isc)
+		{
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			if (sb->period == 0 && sc->pushed != 0 && elapsed > 0) {
+				double p = (double)elapsed * eb->adaptive /
+				           sc->pushed;
+				if (p < TIMESLICE_PERIOD_MIN)
+					p = TIMESLICE_PERIOD_MIN;
+				if (p > TIMESLICE_PERIOD_MAX)
+					p = TIMESLICE_PERIOD_MAX;
+				sc->period = (int64_t)p;
+			}
+			sc->pushed = 0;
+		}
+	}
+}
+
+/* seal the slices whose period is over. Older ones are sealed already, so
+ * we stop at the first sealed slice.
+ */
+static void nrm_eventbase_seal(nrm_eventbase_t *eb, int64_t now)
+{
+	nrm_eb_foreach_sensor(eb, shard, isb)
+	{
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+		nrm_hash_foreach(sb->scopes, isc)
+		{
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			if (nrm_eb_scopebase_pinned(sc))
+				continue;
+			for (size_t i = sc->count; i > 0; i--) {
+				nrm_eb_timeslice_t *ts =
+				        nrm_eb_ring_at(sc, i - 1);
+				if (ts->key + ts->width > now)
+					continue;
+				if (ts->packed != NULL)
+					break;
+				/* stays uncompressed on failure */
+				nrm_eb_timeslice_seal(ts);
+			}
+		}
+	}
+}
+
+/* start a new period in the sketches of each scope, reusing the oldest one */
+static void nrm_eventbase_rotate(nrm_eventbase_t *eb, int64_t now)
+{
+	size_t n = eb->maxperiods + 1;
+	nrm_eb_foreach_sensor(eb, shard, isb)
+	{
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+		nrm_hash_foreach(sb->scopes, isc)
+		{
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			if (sc->sketches == NULL)
+				continue;
+			sc->cursketch = (sc->cursketch + 1) % n;
+			nrm_eb_sketches_t *cur = &sc->sketches[sc->cursketch];
+			nrm_sketch_clear(cur->values);
+			nrm_sketch_clear(cur->rates);
+			cur->start = now;
+		}
+	}
+}
+
 int nrm_eventbase_tick(nrm_eventbase_t *eb, nrm_time_t time)
 {
-	/* should eventually remove old events from the database */
-	(void)eb;
-	(void)time;
+	if (eb == NULL)
+		return -NRM_EINVAL;
+
+	int64_t now = nrm_time_tons(&time);
+	nrm_eb_lock_all(eb);
+	if (eb->adaptive != 0 && eb->lasttick != 0)
+		nrm_eventbase_adapt(eb, now - eb->lasttick);
+	if (eb->quantiles != 0.0)
+		nrm_eventbase_rotate(eb, now);
+	if (eb->compress)
+		nrm_eventbase_seal(eb, now);
+	eb->lasttick = now;
+
+	/* no retention limit */
+	if (eb->ticks == NULL)
+		goto end;
+
+	nrm_ringbuffer_push_back(eb->ticks, &time);
+	if (!nrm_ringbuffer_isfull(eb->ticks))
+		goto end;
+
+	/* we keep maxperiods full periods (the time between two ticks) and
+	 * the one in progress.
+	 */
+	nrm_time_t *oldest;
+	nrm_ringbuffer_get(eb->ticks, 0, (void **)&oldest);
+	nrm_eventbase_expire(eb, nrm_time_tons(oldest));
+end:
+	nrm_eb_unlock_all(eb);
+	return 0;
+}
+
+int nrm_eventbase_set_period(nrm_eventbase_t *eb, int64_t period)
+{
+	if (eb == NULL || period <= 0)
+		return -NRM_EINVAL;
+
+	nrm_eb_lock_all(eb);
+	eb->period = period;
+	nrm_eb_foreach_sensor(eb, shard, isb)
+	{
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+		if (sb->period != 0)
+			continue;
+		nrm_hash_foreach(sb->scopes, isc)
+		{
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			sc->period = period;
+		}
+	}
+	nrm_eb_unlock_all(eb);
+	return 0;
+}
+
+int nrm_eventbase_set_sensor_period(nrm_eventbase_t *eb,
+                                    nrm_string_t sensor_uuid,
+                                    int64_t period)
+{
+	if (eb == NULL || sensor_uuid == NULL || period < 0)
+		return -NRM_EINVAL;
+
+	/* keep it around for when the sensor shows up or comes back after
+	 * expiring.
+	 */
+	int err = 0;
+	nrm_eb_lock_all(eb);
+	int64_t *p = NULL;
+	nrm_hash_find(eb->periods, sensor_uuid, (void *)&p);
+	if (p == NULL) {
+		p = malloc(sizeof(int64_t));
+		if (p == NULL) {
+			err = -NRM_ENOMEM;
+			goto end;
+		}
+		nrm_string_incref(sensor_uuid);
+		nrm_hash_add(&eb->periods, sensor_uuid, p);
+	}
+	*p = period;
+
+	nrm_eb_sensorbase_t *sb = NULL;
+	nrm_hash_find(nrm_eb_shard(eb, sensor_uuid)->sensors, sensor_uuid,
+	              (void *)&sb);
+	if (sb == NULL)
+		goto end;
+	sb->period = period;
+	nrm_hash_foreach(sb->scopes, isc)
+	{
+		nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+		sc->period = period != 0 ? period : eb->period;
+	}
+end:
+	nrm_eb_unlock_all(eb);
+	return err;
+}
+
+int nrm_eventbase_set_adaptive(nrm_eventbase_t *eb, size_t target)
+{
+	if (eb == NULL)
+		return -NRM_EINVAL;
+	nrm_eb_lock_all(eb);
+	eb->adaptive = target;
+	nrm_eb_unlock_all(eb);
+	return 0;
+}
+
+int nrm_eventbase_set_compression(nrm_eventbase_t *eb, int enabled)
+{
+	if (eb == NULL)
+		return -NRM_EINVAL;
+
+	/* decompress everything when turned off, the next tick takes care of
+	 * sealing when turned on. Pinned scopes stay as they are, their sealed
+	 * slices get reopened as events come in.
+	 */
+	int err = 0;
+	nrm_eb_lock_all(eb);
+	if (eb->compress && !enabled) {
+		nrm_eb_foreach_sensor(eb, shard, isb)
+		{
+			nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+			nrm_hash_foreach(sb->scopes, isc)
+			{
+				nrm_eb_scopebase_t *sc =
+				        nrm_hash_iterator_get(isc);
+				if (nrm_eb_scopebase_pinned(sc))
+					continue;
+				for (size_t i = 0; i < sc->count; i++) {
+					err = nrm_eb_timeslice_unseal(
+					        nrm_eb_ring_at(sc, i));
+					if (err)
+						goto end;
+				}
+			}
+		}
+	}
+	eb->compress = enabled != 0;
+end:
+	nrm_eb_unlock_all(eb);
+	return err;
+}
+
+int nrm_eventbase_set_quantiles(nrm_eventbase_t *eb, double accuracy)
+{
+	if (eb == NULL || !(accuracy >= 0.0 && accuracy < 1.0))
+		return -NRM_EINVAL;
+
+	/* sketches of different accuracies can't be merged, start over */
+	nrm_eb_lock_all(eb);
+	nrm_eb_foreach_sensor(eb, shard, isb)
+	{
+		nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+		nrm_hash_foreach(sb->scopes, isc)
+		{
+			nrm_eb_scopebase_t *sc = nrm_hash_iterator_get(isc);
+			nrm_eb_sketches_destroy(&sc->sketches,
+			                        eb->maxperiods + 1);
+		}
+	}
+	eb->quantiles = accuracy;
+	nrm_eb_unlock_all(eb);
+	return 0;
+}
+
+int nrm_eventbase_remove_sensor(nrm_eventbase_t *eb, nrm_string_t sensor_uuid)
+{
+	if (eb == NULL || sensor_uuid == NULL)
+		return -NRM_EINVAL;
+
+	nrm_eb_shard_t *shard = nrm_eb_shard(eb, sensor_uuid);
+	nrm_eb_sensorbase_t *sb = NULL;
+	pthread_rwlock_wrlock(&shard->lock);
+	if (shard->sensors != NULL)
+		nrm_hash_remove(&shard->sensors, sensor_uuid, (void *)&sb);
+	if (sb != NULL)
+		nrm_eb_sensorbase_destroy(eb, shard, sb);
+	pthread_rwlock_unlock(&shard->lock);
+	return 0;
+}
+
+int nrm_eventbase_remove_scope(nrm_eventbase_t *eb, nrm_string_t scope_uuid)
+{
+	if (eb == NULL || scope_uuid == NULL)
+		return -NRM_EINVAL;
+
+	/* a scope can have data under any sensor, one shard at a time */
+	for (size_t i = 0; i < EVENTBASE_SHARDS; i++) {
+		nrm_eb_shard_t *shard = &eb->shards[i];
+		pthread_rwlock_wrlock(&shard->lock);
+		nrm_hash_foreach(shard->sensors, isb)
+		{
+			nrm_eb_sensorbase_t *sb = nrm_hash_iterator_get(isb);
+			nrm_eb_scopebase_t *sc = NULL;
+			if (sb->scopes == NULL)
+				continue;
+			nrm_hash_remove(&sb->scopes, scope_uuid, (void *)&sc);
+			if (sc == NULL)
+				continue;
+			nrm_eb_ids_clear(sb->scopeids, sb->nscopeids, sc->id,
+			                 sc);
+			nrm_eb_scopebase_release(eb, sc);
+		}
+		pthread_rwlock_unlock(&shard->lock);
+	}
 	return 0;
 }
@@ -15,8 +15,22 @@
 #include <stdlib.h>
 #include <string.h>
 
-int nrm_scope_hwloc_scopes(nrm_hash_t **scopes)
+/* hand a scope over to the state, which indexes it for resolution */
+static void nrm_scope_hwloc_add(nrm_state_t *state,
+                                nrm_scope_t *scope,
+                                int *err)
 {
+	int ret = nrm_state_add_scope(state, scope);
+	if (ret) {
+		nrm_scope_destroy(scope);
+		if (*err == 0)
+			*err = ret;
+	}
+}
+
+int nrm_scope_hwloc_scopes(nrm_state_t *state)
+{
+	int err = 0;
 	int depth_of_machine;
 	int num_of_osdev;
 	char buffer[128];
@@ -64,8 +78,7 @@ int nrm_scope_hwloc_scopes(nrm_hash_t **scopes)
 			        nrm_scope_add(this_scope, NRM_SCOPE_TYPE_CPU,
 			                      bit);
 			hwloc_bitmap_foreach_end();
-			nrm_hash_add(scopes, nrm_scope_uuid(this_scope),
-			             this_scope);
+			nrm_scope_hwloc_add(state, this_scope, &err);
 			if (object->type == HWLOC_OBJ_PU && numa_count > 1) {
 				// Add additional scopes each with a single NUMA
 				// node only.
@@ -87,9 +100,8 @@ int nrm_scope_hwloc_scopes(nrm_hash_t **scopes)
 					                NRM_SCOPE_TYPE_CPU,
 					                cpubit);
 					hwloc_bitmap_foreach_end();
-					nrm_hash_add(scopes,
-					             nrm_scope_uuid(this_scope),
-					             this_scope);
+					nrm_scope_hwloc_add(state, this_scope,
+					                    &err);
 				}
 				hwloc_bitmap_foreach_end();
 			}
@@ -134,10 +146,10 @@ int nrm_scope_hwloc_scopes(nrm_hash_t **scopes)
 		this_scope = nrm_scope_create(scope_name);
 		nrm_scope_add(this_scope, NRM_SCOPE_TYPE_GPU, counter);
 		counter++;
-		nrm_hash_add(scopes, nrm_scope_uuid(this_scope), this_scope);
+		nrm_scope_hwloc_add(state, this_scope, &err);
 	}
 	hwloc_topology_destroy(topology);
-	return 0;
+	return err;
 }
 
 nrm_scope_t *nrm_scope_create_hwloc_allowed(const char *name)
@@ -19,15 +19,159 @@
 #include "internal/actuators.h"
 // clang-format on
 
+/*******************************************************************************
+ * Protobuf Management: Message Arenas
+ *******************************************************************************/
+
+/* every message, created or received, lives in its own arena: a chain of
+ * blocks that we bump-allocate from and free all at once when the message is
+ * destroyed. The message itself is always the first allocation of the first
+ * block, so the arena can be found back from the message alone.
+ *
+ * Messages cross threads (built by the application, destroyed by the broker,
+ * or the other way around), so the arena belongs to the message, not to a
+ * thread.
+ */
+#define NRM_MSG_ARENA_BLOCKSIZE 1024
+
+struct nrm_msg_arena_s {
+	struct nrm_msg_arena_s *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+typedef struct nrm_msg_arena_s nrm_msg_arena_t;
+
+static nrm_msg_arena_t *nrm_msg_arena_create(size_t size)
+{
+	if (size < NRM_MSG_ARENA_BLOCKSIZE)
+		size = NRM_MSG_ARENA_BLOCKSIZE;
+	nrm_msg_arena_t *ret = calloc(1, sizeof(nrm_msg_arena_t) + size);
+	if (ret == NULL)
+		return NULL;
+	ret->size = size;
+	return ret;
+}
+
+static void nrm_msg_arena_destroy(nrm_msg_arena_t *arena)
+{
+	while (arena != NULL) {
+		nrm_msg_arena_t *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+static nrm_msg_arena_t *nrm_msg_arena_of(nrm_msg_t *msg)
+{
+	return (nrm_msg_arena_t *)((char *)msg -
+	                           offsetof(nrm_msg_arena_t, data));
+}
+
+/* returns zeroed memory: blocks are calloc'ed and never reused */
+static void *nrm_msg_arena_alloc(nrm_msg_arena_t *arena, size_t size)
+{
+	size_t align = sizeof(max_align_t);
+	size = (size + align - 1) & ~(align - 1);
+	/* the first block holds the message, new blocks go right after it */
+	nrm_msg_arena_t *block = arena->next;
+	if (arena->used + size <= arena->size)
+		block = arena;
+	else if (block == NULL || block->used + size > block->size) {
+		size_t bsize = block != NULL ? 2 * block->size : arena->size;
+		block = nrm_msg_arena_create(size > bsize ? size : bsize);
+		if (block == NULL)
+			return NULL;
+		block->next = arena->next;
+		arena->next = block;
+	}
+	void *ret = (char *)block->data + block->used;
+	block->used += size;
+	return ret;
+}
+
+static char *nrm_msg_arena_strdup(nrm_msg_arena_t *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *ret = nrm_msg_arena_alloc(arena, len);
+	if (ret != NULL)
+		memcpy(ret, s, len);
+	return ret;
+}
+
+static void *nrm_msg_arena_pballoc(void *data, size_t size)
+{
+	return nrm_msg_arena_alloc(data, size);
+}
+
+static void nrm_msg_arena_pbfree(void *data, void *ptr)
+{
+	/* everything goes away with the arena */
+	(void)data;
+	(void)ptr;
+}
+
+/* received messages are sized from their packed length: the unpacked
+ * structures are rarely more than a few times bigger.
+ */
+static nrm_msg_t *nrm_msg_unpack(size_t len, const uint8_t *data)
+{
+	nrm_msg_arena_t *arena = nrm_msg_arena_create(4 * len);
+	if (arena == NULL)
+		return NULL;
+	ProtobufCAllocator allocator = {
+	        .alloc = nrm_msg_arena_pballoc,
+	        .free = nrm_msg_arena_pbfree,
+	        .allocator_data = arena,
+	};
+	nrm_msg_t *ret = nrm__message__unpack(&allocator, len, data);
+	if (ret == NULL) {
+		nrm_msg_arena_destroy(arena);
+		return NULL;
+	}
+	/* protobuf-c allocates the top message before anything else */
+	assert(nrm_msg_arena_of(ret) == arena);
+	return ret;
+}
+
 /*******************************************************************************
  * Protobuf Management: Creating Messages
  *******************************************************************************/
 
 nrm_msg_t *nrm_msg_create(void)
 {
-	nrm_msg_t *ret = calloc(1, sizeof(nrm_msg_t));
-	if (ret == NULL)
+	nrm_msg_arena_t *arena = nrm_msg_arena_create(0);
+	if (arena == NULL)
 		return NULL;
+	nrm_msg_t *ret = nrm_msg_arena_alloc(arena, sizeof(nrm_msg_t));
+	nrm_msg_init(ret);
+	return ret;
+}
+
+/* empties a message for reuse, keeping its memory. If the arena had to grow
+ * last time, it is replaced by a single block big enough for all of it, so
+ * that refilling the message the same way doesn't allocate anymore.
+ */
+nrm_msg_t *nrm_msg_reset(nrm_msg_t *msg)
+{
+	if (msg == NULL)
+		return nrm_msg_create();
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	if (arena->next != NULL) {
+		size_t size = 0;
+		for (nrm_msg_arena_t *b = arena; b != NULL; b = b->next)
+			size += b->size;
+		nrm_msg_arena_destroy(arena);
+		arena = nrm_msg_arena_create(size);
+		if (arena == NULL)
+			return NULL;
+	} else {
+		/* allocations are expected to be zeroed */
+		memset(arena->data, 0, arena->used);
+		arena->used = 0;
+	}
+	nrm_msg_t *ret = nrm_msg_arena_alloc(arena, sizeof(nrm_msg_t));
 	nrm_msg_init(ret);
 	return ret;
 }
@@ -36,7 +180,7 @@ void nrm_msg_destroy_received(nrm_msg_t **msg)
 {
 	if (msg == NULL || *msg == NULL)
 		return;
-	nrm__message__free_unpacked(*msg, NULL);
+	nrm_msg_arena_destroy(nrm_msg_arena_of(*msg));
 	*msg = NULL;
 }
 
@@ -48,67 +192,44 @@ int nrm_msg_fill(nrm_msg_t *msg, int type)
 	return 0;
 }
 
-nrm_msg_actuate_t *nrm_msg_actuate_new(nrm_string_t uuid, double value)
+nrm_msg_actuate_t *
+nrm_msg_actuate_new(nrm_msg_arena_t *arena, nrm_string_t uuid, double value)
 {
-	nrm_msg_actuate_t *ret = calloc(1, sizeof(nrm_msg_actuate_t));
+	nrm_msg_actuate_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_actuate_t));
 	if (ret == NULL)
 		return ret;
 	nrm_msg_actuate_init(ret);
-	ret->uuid = strdup(uuid);
+	ret->uuid = nrm_msg_arena_strdup(arena, uuid);
 	ret->value = value;
 	return ret;
 }
 
-void nrm_msg_actuate_destroy(nrm_msg_actuate_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg);
-}
-
-nrm_msg_sensor_t *nrm_msg_sensor_new(const char *uuid)
+nrm_msg_sensor_t *nrm_msg_sensor_new(nrm_msg_arena_t *arena, const char *uuid)
 {
-	nrm_msg_sensor_t *ret = calloc(1, sizeof(nrm_msg_sensor_t));
+	nrm_msg_sensor_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_sensor_t));
 	if (ret == NULL)
 		return ret;
 	nrm_msg_sensor_init(ret);
-	ret->uuid = strdup(uuid);
+	ret->uuid = nrm_msg_arena_strdup(arena, uuid);
 	return ret;
 }
 
-void nrm_msg_sensor_destroy(nrm_msg_sensor_t *msg)
+nrm_msg_slice_t *nrm_msg_slice_new(nrm_msg_arena_t *arena, const char *uuid)
 {
-	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg);
-}
-
-nrm_msg_slice_t *nrm_msg_slice_new(const char *uuid)
-{
-	nrm_msg_slice_t *ret = calloc(1, sizeof(nrm_msg_slice_t));
+	nrm_msg_slice_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_slice_t));
 	if (ret == NULL)
 		return ret;
 	nrm_msg_slice_init(ret);
-	ret->uuid = strdup(uuid);
+	ret->uuid = nrm_msg_arena_strdup(arena, uuid);
 	return ret;
 }
 
-void nrm_msg_slice_destroy(nrm_msg_slice_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg);
-}
-
-nrm_msg_add_t *nrm_msg_add_new(int type)
+nrm_msg_add_t *nrm_msg_add_new(nrm_msg_arena_t *arena, int type)
 {
-	nrm_msg_add_t *ret = calloc(1, sizeof(nrm_msg_add_t));
+	nrm_msg_add_t *ret = nrm_msg_arena_alloc(arena, sizeof(nrm_msg_add_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_add_init(ret);
@@ -117,15 +238,16 @@ nrm_msg_add_t *nrm_msg_add_new(int type)
 }
 
 nrm_msg_actuator_discrete_t *
-nrm_msg_actuator_discrete_new(nrm_actuator_t *actuator)
+nrm_msg_actuator_discrete_new(nrm_msg_arena_t *arena, nrm_actuator_t *actuator)
 {
 	nrm_msg_actuator_discrete_t *ret =
-	        calloc(1, sizeof(nrm_msg_actuator_discrete_t));
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_actuator_discrete_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_actuator_discrete_init(ret);
 	nrm_vector_length(actuator->data->u.choices, &ret->n_choices);
-	ret->choices = calloc(ret->n_choices, sizeof(double));
+	ret->choices = nrm_msg_arena_alloc(arena,
+	                                   ret->n_choices * sizeof(double));
 	assert(ret->choices);
 	for (size_t i = 0; i < ret->n_choices; i++) {
 		double *d;
@@ -137,10 +259,11 @@ nrm_msg_actuator_discrete_new(nrm_actuator_t *actuator)
 }
 
 nrm_msg_actuator_continuous_t *
-nrm_msg_actuator_continuous_new(nrm_actuator_t *actuator)
+nrm_msg_actuator_continuous_new(nrm_msg_arena_t *arena,
+                                nrm_actuator_t *actuator)
 {
-	nrm_msg_actuator_continuous_t *ret =
-	        calloc(1, sizeof(nrm_msg_actuator_continuous_t));
+	nrm_msg_actuator_continuous_t *ret = nrm_msg_arena_alloc(
+	        arena, sizeof(nrm_msg_actuator_continuous_t));
 	if (ret == NULL)
 		return NULL;
 
@@ -150,16 +273,18 @@ nrm_msg_actuator_continuous_new(nrm_actuator_t *actuator)
 	return ret;
 }
 
-nrm_msg_actuator_t *nrm_msg_actuator_new(nrm_actuator_t *actuator)
+nrm_msg_actuator_t *nrm_msg_actuator_new(nrm_msg_arena_t *arena,
+                                         nrm_actuator_t *actuator)
 {
-	nrm_msg_actuator_t *ret = calloc(1, sizeof(nrm_msg_actuator_t));
+	nrm_msg_actuator_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_actuator_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_actuator_init(ret);
-	ret->uuid = strdup(actuator->data->uuid);
+	ret->uuid = nrm_msg_arena_strdup(arena, actuator->data->uuid);
 	if (actuator->data->clientid)
-		ret->clientid =
-		        strdup(nrm_uuid_to_char(actuator->data->clientid));
+		ret->clientid = nrm_msg_arena_strdup(
+		        arena, nrm_uuid_to_char(actuator->data->clientid));
 	else
 		ret->clientid = NULL;
 	ret->value = actuator->data->value;
@@ -167,11 +292,12 @@ nrm_msg_actuator_t *nrm_msg_actuator_new(nrm_actuator_t *actuator)
 	switch (ret->type) {
 	case NRM_ACTUATOR_TYPE_DISCRETE:
 		ret->data_case = NRM__ACTUATOR__DATA_DISCRETE;
-		ret->discrete = nrm_msg_actuator_discrete_new(actuator);
+		ret->discrete = nrm_msg_actuator_discrete_new(arena, actuator);
 		break;
 	case NRM_ACTUATOR_TYPE_CONTINUOUS:
 		ret->data_case = NRM__ACTUATOR__DATA_CONTINUOUS;
-		ret->continuous = nrm_msg_actuator_continuous_new(actuator);
+		ret->continuous =
+		        nrm_msg_actuator_continuous_new(arena, actuator);
 		break;
 	default:
 		break;
@@ -179,112 +305,114 @@ nrm_msg_actuator_t *nrm_msg_actuator_new(nrm_actuator_t *actuator)
 	return ret;
 }
 
-void nrm_msg_actuator_destroy(nrm_msg_actuator_t *msg)
+/* bitmaps are sent as [start, length] pairs, scopes are mostly contiguous */
+static int32_t *nrm_msg_bitmap_new(nrm_msg_arena_t *arena,
+                                   const struct nrm_bitmap *map,
+                                   size_t *nitems)
 {
-	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg->clientid);
-	switch (msg->type) {
-	case NRM_ACTUATOR_TYPE_DISCRETE:
-		free(msg->discrete->choices);
-		free(msg->discrete);
-		break;
-	case NRM_ACTUATOR_TYPE_CONTINUOUS:
-		free(msg->continuous);
-		break;
-	default:
-		break;
-	}
-	free(msg);
+	size_t size = 2 * nrm_bitmap_nranges(map);
+	int32_t *ret = nrm_msg_arena_alloc(arena, size * sizeof(int32_t));
+	assert(ret);
+	nrm_bitmap_to_ranges(map, ret);
+	*nitems = size;
+	return ret;
 }
 
-nrm_msg_scope_t *nrm_msg_scope_new(nrm_scope_t *scope)
+nrm_msg_scope_t *nrm_msg_scope_new(nrm_msg_arena_t *arena, nrm_scope_t *scope)
 {
-	nrm_msg_scope_t *ret = calloc(1, sizeof(nrm_msg_scope_t));
+	nrm_msg_scope_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_scope_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_scope_init(ret);
-	ret->uuid = strdup(scope->uuid);
-	nrm_bitmap_to_array(&scope->maps[NRM_SCOPE_TYPE_CPU], &ret->n_cpus,
-	                    &ret->cpus);
-	nrm_bitmap_to_array(&scope->maps[NRM_SCOPE_TYPE_NUMA], &ret->n_numas,
-	                    &ret->numas);
-	nrm_bitmap_to_array(&scope->maps[NRM_SCOPE_TYPE_GPU], &ret->n_gpus,
-	                    &ret->gpus);
+	ret->uuid = nrm_msg_arena_strdup(arena, scope->uuid);
+	ret->id = scope->id;
+	ret->cpu_ranges = nrm_msg_bitmap_new(
+	        arena, &scope->maps[NRM_SCOPE_TYPE_CPU], &ret->n_cpu_ranges);
+	ret->numa_ranges = nrm_msg_bitmap_new(
+	        arena, &scope->maps[NRM_SCOPE_TYPE_NUMA], &ret->n_numa_ranges);
+	ret->gpu_ranges = nrm_msg_bitmap_new(
+	        arena, &scope->maps[NRM_SCOPE_TYPE_GPU], &ret->n_gpu_ranges);
 	return ret;
 }
 
-void nrm_msg_scope_destroy(nrm_msg_scope_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg->cpus);
-	free(msg->numas);
-	free(msg->gpus);
-	free(msg);
-}
-
-nrm_msg_event_t *nrm_msg_event_new(nrm_event_t *event)
+nrm_msg_timeserie_t *nrm_msg_timeserie_new(nrm_msg_arena_t *arena,
+                                           nrm_timeserie_t *timeserie)
 {
-	nrm_msg_event_t *ret = calloc(1, sizeof(nrm_msg_event_t));
+	nrm_msg_timeserie_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_timeserie_t));
 	if (ret == NULL)
 		return NULL;
-	nrm_msg_event_init(ret);
-	ret->time = nrm_time_tons(&event->time);
-	ret->value = event->value;
+	nrm_msg_timeserie_init(ret);
+	ret->sensor_uuid = nrm_msg_arena_strdup(arena, timeserie->sensor_uuid);
+	if (timeserie->scope_id != 0) {
+		/* the daemon already knows it, no need for the ranges. The uuid
+		 * lets it check that the id still means the same scope.
+		 */
+		ret->scope =
+		        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_scope_t));
+		assert(ret->scope);
+		nrm_msg_scope_init(ret->scope);
+		ret->scope->id = timeserie->scope_id;
+		ret->scope->uuid =
+		        nrm_msg_arena_strdup(arena, timeserie->scope->uuid);
+	} else
+		ret->scope = nrm_msg_scope_new(arena, timeserie->scope);
+	ret->start = timeserie->start;
+
+	size_t n;
+	nrm_vector_length(timeserie->events, &n);
+	nrm_log_debug("vector contains %zu\n", n);
+	if (n == 0)
+		return ret;
+	ret->times = nrm_msg_arena_alloc(arena, n * sizeof(int64_t));
+	ret->values = nrm_msg_arena_alloc(arena, n * sizeof(double));
+	assert(ret->times && ret->values);
+	ret->n_times = ret->n_values = n;
+	/* vectors are contiguous */
+	nrm_event_t *e;
+	nrm_vector_get_withtype(nrm_event_t, timeserie->events, 0, e);
+	for (size_t i = 0; i < n; i++) {
+		ret->times[i] = e[i].time - ret->start;
+		ret->values[i] = e[i].value;
+	}
 	return ret;
 }
 
-void nrm_msg_event_destroy(nrm_msg_event_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	free(msg);
-}
-
-nrm_msg_timeserie_t *nrm_msg_timeserie_new(nrm_timeserie_t *timeserie)
+int nrm_msg_timeserie_length(nrm_msg_timeserie_t *msg, size_t *length)
 {
-	nrm_msg_timeserie_t *ret = calloc(1, sizeof(nrm_msg_timeserie_t));
-	if (ret == NULL)
-		return NULL;
-	nrm_msg_timeserie_init(ret);
-	ret->sensor_uuid = strdup(timeserie->sensor_uuid);
-	ret->scope = nrm_msg_scope_new(timeserie->scope);
-	ret->start = nrm_time_tons(&timeserie->start);
-	nrm_vector_length(timeserie->events, &ret->n_events);
-	nrm_log_debug("vector contains %zu\n", ret->n_events);
-	ret->events = calloc(ret->n_events, sizeof(nrm_msg_event_t));
-	assert(ret->events);
-	for (size_t i = 0; i < ret->n_events; i++) {
-		nrm_event_t *e;
-		nrm_vector_get_withtype(nrm_event_t, timeserie->events, i, e);
-		ret->events[i] = nrm_msg_event_new(e);
+	*length = 0;
+	if (msg->n_events != 0) {
+		*length = msg->n_events;
+		return 0;
 	}
-	return ret;
+	if (msg->n_times != msg->n_values) {
+		nrm_log_error("timeserie of %s with %zu times and %zu values\n",
+		              msg->sensor_uuid, msg->n_times, msg->n_values);
+		return -NRM_EINVAL;
+	}
+	*length = msg->n_times;
+	return 0;
 }
 
-void nrm_msg_timeserie_destroy(nrm_msg_timeserie_t *msg)
+void nrm_msg_timeserie_get_event(nrm_msg_timeserie_t *msg,
+                                 size_t index,
+                                 nrm_event_t *out)
 {
-	if (msg == NULL)
-		return;
-
-	free(msg->sensor_uuid);
-	nrm_msg_scope_destroy(msg->scope);
-	for (size_t i = 0; i < msg->n_events; i++)
-		nrm_msg_event_destroy(msg->events[i]);
-	free(msg->events);
-	free(msg);
+	if (msg->n_events != 0) {
+		out->time = msg->events[index]->time;
+		out->value = msg->events[index]->value;
+	} else {
+		out->time = msg->start + msg->times[index];
+		out->value = msg->values[index];
+	}
 }
 
-nrm_msg_timeserielist_t *nrm_msg_timeserielist_new(nrm_vector_t *timeseries)
+nrm_msg_timeserielist_t *nrm_msg_timeserielist_new(nrm_msg_arena_t *arena,
+                                                   nrm_vector_t *timeseries)
 {
 	nrm_msg_timeserielist_t *ret =
-	        calloc(1, sizeof(nrm_msg_timeserielist_t));
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_timeserielist_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_timeserielist_init(ret);
@@ -294,30 +422,23 @@ nrm_msg_timeserielist_t *nrm_msg_timeserielist_new(nrm_vector_t *timeseries)
 	}
 	nrm_vector_length(timeseries, &ret->n_series);
 	nrm_log_debug("vector contains %zu\n", ret->n_series);
-	ret->series = calloc(ret->n_series, sizeof(nrm_msg_timeserie_t *));
+	ret->series = nrm_msg_arena_alloc(
+	        arena, ret->n_series * sizeof(nrm_msg_timeserie_t *));
 	assert(ret->series);
 	for (size_t i = 0; i < ret->n_series; i++) {
 		nrm_timeserie_t **s;
 		nrm_vector_get_withtype(nrm_timeserie_t *, timeseries, i, s);
-		ret->series[i] = nrm_msg_timeserie_new(*s);
+		ret->series[i] = nrm_msg_timeserie_new(arena, *s);
 	}
 	return ret;
 }
 
-void nrm_msg_timeserielist_destroy(nrm_msg_timeserielist_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	free(msg->series);
-	free(msg);
-}
-
 int nrm_msg_set_events(nrm_msg_t *msg, nrm_vector_t *timeseries)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->events = nrm_msg_timeserielist_new(timeseries);
+	msg->events =
+	        nrm_msg_timeserielist_new(nrm_msg_arena_of(msg), timeseries);
 	assert(msg->events);
 	msg->data_case = NRM__MESSAGE__DATA_EVENTS;
 	return 0;
@@ -328,7 +449,7 @@ int nrm_msg_set_actuate(nrm_msg_t *msg, nrm_string_t uuid, double value)
 	if (msg == NULL)
 		return -NRM_EINVAL;
 	msg->data_case = NRM__MESSAGE__DATA_ACTUATE;
-	msg->actuate = nrm_msg_actuate_new(uuid, value);
+	msg->actuate = nrm_msg_actuate_new(nrm_msg_arena_of(msg), uuid, value);
 	return 0;
 }
 
@@ -336,11 +457,12 @@ int nrm_msg_set_add_actuator(nrm_msg_t *msg, nrm_actuator_t *actuator)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->add = nrm_msg_add_new(NRM_MSG_TARGET_TYPE_ACTUATOR);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_ACTUATOR);
 	assert(msg->add);
 	msg->data_case = NRM__MESSAGE__DATA_ADD;
 	msg->add->data_case = NRM__ADD__DATA_ACTUATOR;
-	msg->add->actuator = nrm_msg_actuator_new(actuator);
+	msg->add->actuator = nrm_msg_actuator_new(arena, actuator);
 	return 0;
 }
 
@@ -348,11 +470,12 @@ int nrm_msg_set_add_scope(nrm_msg_t *msg, nrm_scope_t *scope)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->add = nrm_msg_add_new(NRM_MSG_TARGET_TYPE_SCOPE);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SCOPE);
 	assert(msg->add);
 	msg->data_case = NRM__MESSAGE__DATA_ADD;
 	msg->add->data_case = NRM__ADD__DATA_SCOPE;
-	msg->add->scope = nrm_msg_scope_new(scope);
+	msg->add->scope = nrm_msg_scope_new(arena, scope);
 	return 0;
 }
 
@@ -360,11 +483,12 @@ int nrm_msg_set_add_sensor(nrm_msg_t *msg, nrm_sensor_t *sensor)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->add = nrm_msg_add_new(NRM_MSG_TARGET_TYPE_SENSOR);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SENSOR);
 	assert(msg->add);
 	msg->data_case = NRM__MESSAGE__DATA_ADD;
 	msg->add->data_case = NRM__ADD__DATA_SENSOR;
-	msg->add->sensor = nrm_msg_sensor_new(sensor->uuid);
+	msg->add->sensor = nrm_msg_sensor_new(arena, sensor->uuid);
 	return 0;
 }
 
@@ -372,41 +496,119 @@ int nrm_msg_set_add_slice(nrm_msg_t *msg, nrm_slice_t *slice)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->add = nrm_msg_add_new(NRM_MSG_TARGET_TYPE_SLICE);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SLICE);
 	assert(msg->add);
 	msg->data_case = NRM__MESSAGE__DATA_ADD;
 	msg->add->data_case = NRM__ADD__DATA_SLICE;
-	msg->add->slice = nrm_msg_slice_new(slice->uuid);
+	msg->add->slice = nrm_msg_slice_new(arena, slice->uuid);
 	return 0;
 }
 
-void nrm_msg_add_destroy(nrm_msg_add_t *msg)
+/* bulk adds take vectors of pointers, like the ones the client returns */
+int nrm_msg_set_add_actuators(nrm_msg_t *msg, nrm_vector_t *actuators)
 {
-	if (msg == NULL)
-		return;
+	if (msg == NULL || actuators == NULL)
+		return -NRM_EINVAL;
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_ACTUATOR);
+	assert(msg->add);
+	msg->data_case = NRM__MESSAGE__DATA_ADD;
+	msg->add->data_case = NRM__ADD__DATA_ACTUATORS;
+	nrm_msg_actuatorlist_t *l =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_actuatorlist_t));
+	assert(l);
+	nrm_msg_actuatorlist_init(l);
+	nrm_vector_length(actuators, &l->n_actuators);
+	l->actuators = nrm_msg_arena_alloc(
+	        arena, l->n_actuators * sizeof(nrm_msg_actuator_t *));
+	for (size_t i = 0; i < l->n_actuators; i++) {
+		nrm_actuator_t **a;
+		nrm_vector_get_withtype(nrm_actuator_t *, actuators, i, a);
+		l->actuators[i] = nrm_msg_actuator_new(arena, *a);
+	}
+	msg->add->actuators = l;
+	return 0;
+}
 
-	switch (msg->type) {
-	case NRM_MSG_TARGET_TYPE_SLICE:
-		nrm_msg_slice_destroy(msg->slice);
-		break;
-	case NRM_MSG_TARGET_TYPE_SENSOR:
-		nrm_msg_sensor_destroy(msg->sensor);
-		break;
-	case NRM_MSG_TARGET_TYPE_SCOPE:
-		nrm_msg_scope_destroy(msg->scope);
-		break;
-	case NRM_MSG_TARGET_TYPE_ACTUATOR:
-		nrm_msg_actuator_destroy(msg->actuator);
-		break;
-	default:
-		break;
+int nrm_msg_set_add_scopes(nrm_msg_t *msg, nrm_vector_t *scopes)
+{
+	if (msg == NULL || scopes == NULL)
+		return -NRM_EINVAL;
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SCOPE);
+	assert(msg->add);
+	msg->data_case = NRM__MESSAGE__DATA_ADD;
+	msg->add->data_case = NRM__ADD__DATA_SCOPES;
+	nrm_msg_scopelist_t *l =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_scopelist_t));
+	assert(l);
+	nrm_msg_scopelist_init(l);
+	nrm_vector_length(scopes, &l->n_scopes);
+	l->scopes = nrm_msg_arena_alloc(
+	        arena, l->n_scopes * sizeof(nrm_msg_scope_t *));
+	for (size_t i = 0; i < l->n_scopes; i++) {
+		nrm_scope_t **sc;
+		nrm_vector_get_withtype(nrm_scope_t *, scopes, i, sc);
+		l->scopes[i] = nrm_msg_scope_new(arena, *sc);
 	}
-	free(msg);
+	msg->add->scopes = l;
+	return 0;
+}
+
+int nrm_msg_set_add_sensors(nrm_msg_t *msg, nrm_vector_t *sensors)
+{
+	if (msg == NULL || sensors == NULL)
+		return -NRM_EINVAL;
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SENSOR);
+	assert(msg->add);
+	msg->data_case = NRM__MESSAGE__DATA_ADD;
+	msg->add->data_case = NRM__ADD__DATA_SENSORS;
+	nrm_msg_sensorlist_t *l =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_sensorlist_t));
+	assert(l);
+	nrm_msg_sensorlist_init(l);
+	nrm_vector_length(sensors, &l->n_sensors);
+	l->sensors = nrm_msg_arena_alloc(
+	        arena, l->n_sensors * sizeof(nrm_msg_sensor_t *));
+	for (size_t i = 0; i < l->n_sensors; i++) {
+		nrm_sensor_t **se;
+		nrm_vector_get_withtype(nrm_sensor_t *, sensors, i, se);
+		l->sensors[i] = nrm_msg_sensor_new(arena, (*se)->uuid);
+	}
+	msg->add->sensors = l;
+	return 0;
 }
 
-static nrm_msg_list_t *nrm_msg_list_new(int type)
+int nrm_msg_set_add_slices(nrm_msg_t *msg, nrm_vector_t *slices)
 {
-	nrm_msg_list_t *ret = calloc(1, sizeof(nrm_msg_list_t));
+	if (msg == NULL || slices == NULL)
+		return -NRM_EINVAL;
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->add = nrm_msg_add_new(arena, NRM_MSG_TARGET_TYPE_SLICE);
+	assert(msg->add);
+	msg->data_case = NRM__MESSAGE__DATA_ADD;
+	msg->add->data_case = NRM__ADD__DATA_SLICES;
+	nrm_msg_slicelist_t *l =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_slicelist_t));
+	assert(l);
+	nrm_msg_slicelist_init(l);
+	nrm_vector_length(slices, &l->n_slices);
+	l->slices = nrm_msg_arena_alloc(
+	        arena, l->n_slices * sizeof(nrm_msg_slice_t *));
+	for (size_t i = 0; i < l->n_slices; i++) {
+		nrm_slice_t **sl;
+		nrm_vector_get_withtype(nrm_slice_t *, slices, i, sl);
+		l->slices[i] = nrm_msg_slice_new(arena, (*sl)->uuid);
+	}
+	msg->add->slices = l;
+	return 0;
+}
+
+static nrm_msg_list_t *nrm_msg_list_new(nrm_msg_arena_t *arena, int type)
+{
+	nrm_msg_list_t *ret = nrm_msg_arena_alloc(arena, sizeof(nrm_msg_list_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_list_init(ret);
@@ -414,9 +616,11 @@ static nrm_msg_list_t *nrm_msg_list_new(int type)
 	return ret;
 }
 
-nrm_msg_actuatorlist_t *nrm_msg_actuatorlist_new(nrm_vector_t *actuators)
+nrm_msg_actuatorlist_t *nrm_msg_actuatorlist_new(nrm_msg_arena_t *arena,
+                                                 nrm_vector_t *actuators)
 {
-	nrm_msg_actuatorlist_t *ret = calloc(1, sizeof(nrm_msg_actuatorlist_t));
+	nrm_msg_actuatorlist_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_actuatorlist_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_actuatorlist_init(ret);
@@ -426,30 +630,22 @@ nrm_msg_actuatorlist_t *nrm_msg_actuatorlist_new(nrm_vector_t *actuators)
 	}
 	nrm_vector_length(actuators, &ret->n_actuators);
 	nrm_log_debug("vector contains %zu\n", ret->n_actuators);
-	ret->actuators = calloc(ret->n_actuators, sizeof(nrm_msg_actuator_t *));
+	ret->actuators = nrm_msg_arena_alloc(
+	        arena, ret->n_actuators * sizeof(nrm_msg_actuator_t *));
 	assert(ret->actuators);
 	for (size_t i = 0; i < ret->n_actuators; i++) {
 		nrm_actuator_t *s;
 		nrm_vector_get_withtype(nrm_actuator_t, actuators, i, s);
-		ret->actuators[i] = nrm_msg_actuator_new(s);
+		ret->actuators[i] = nrm_msg_actuator_new(arena, s);
 	}
 	return ret;
 }
 
-void nrm_msg_actuatorlist_destroy(nrm_msg_actuatorlist_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	for (size_t i = 0; i < msg->n_actuators; i++)
-		nrm_msg_actuator_destroy(msg->actuators[i]);
-	free(msg->actuators);
-	free(msg);
-}
-
-nrm_msg_scopelist_t *nrm_msg_scopelist_new(nrm_vector_t *scopes)
+nrm_msg_scopelist_t *nrm_msg_scopelist_new(nrm_msg_arena_t *arena,
+                                           nrm_vector_t *scopes)
 {
-	nrm_msg_scopelist_t *ret = calloc(1, sizeof(nrm_msg_scopelist_t));
+	nrm_msg_scopelist_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_scopelist_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_scopelist_init(ret);
@@ -459,30 +655,22 @@ nrm_msg_scopelist_t *nrm_msg_scopelist_new(nrm_vector_t *scopes)
 	}
 	nrm_vector_length(scopes, &ret->n_scopes);
 	nrm_log_debug("vector contains %zu\n", ret->n_scopes);
-	ret->scopes = calloc(ret->n_scopes, sizeof(nrm_msg_scope_t *));
+	ret->scopes = nrm_msg_arena_alloc(
+	        arena, ret->n_scopes * sizeof(nrm_msg_scope_t *));
 	assert(ret->scopes);
 	for (size_t i = 0; i < ret->n_scopes; i++) {
 		nrm_scope_t *s;
 		nrm_vector_get_withtype(nrm_scope_t, scopes, i, s);
-		ret->scopes[i] = nrm_msg_scope_new(s);
+		ret->scopes[i] = nrm_msg_scope_new(arena, s);
 	}
 	return ret;
 }
 
-void nrm_msg_scopelist_destroy(nrm_msg_scopelist_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	for (size_t i = 0; i < msg->n_scopes; i++)
-		nrm_msg_scope_destroy(msg->scopes[i]);
-	free(msg->scopes);
-	free(msg);
-}
-
-nrm_msg_sensorlist_t *nrm_msg_sensorlist_new(nrm_vector_t *sensors)
+nrm_msg_sensorlist_t *nrm_msg_sensorlist_new(nrm_msg_arena_t *arena,
+                                             nrm_vector_t *sensors)
 {
-	nrm_msg_sensorlist_t *ret = calloc(1, sizeof(nrm_msg_sensorlist_t));
+	nrm_msg_sensorlist_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_sensorlist_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_sensorlist_init(ret);
@@ -492,31 +680,23 @@ nrm_msg_sensorlist_t *nrm_msg_sensorlist_new(nrm_vector_t *sensors)
 	}
 	nrm_vector_length(sensors, &ret->n_sensors);
 	nrm_log_debug("vector contains %zu\n", ret->n_sensors);
-	ret->sensors = calloc(ret->n_sensors, sizeof(nrm_msg_sensor_t *));
+	ret->sensors = nrm_msg_arena_alloc(
+	        arena, ret->n_sensors * sizeof(nrm_msg_sensor_t *));
 	assert(ret->sensors);
 	for (size_t i = 0; i < ret->n_sensors; i++) {
 		nrm_sensor_t *s;
 		nrm_vector_get_withtype(nrm_sensor_t, sensors, i, s);
 		nrm_log_debug("packed sensor %zu %s\n", i, s->uuid);
-		ret->sensors[i] = nrm_msg_sensor_new(s->uuid);
+		ret->sensors[i] = nrm_msg_sensor_new(arena, s->uuid);
 	}
 	return ret;
 }
 
-void nrm_msg_sensorlist_destroy(nrm_msg_sensorlist_t *msg)
+nrm_msg_slicelist_t *nrm_msg_slicelist_new(nrm_msg_arena_t *arena,
+                                           nrm_vector_t *slices)
 {
-	if (msg == NULL)
-		return;
-
-	for (size_t i = 0; i < msg->n_sensors; i++)
-		nrm_msg_sensor_destroy(msg->sensors[i]);
-	free(msg->sensors);
-	free(msg);
-}
-
-nrm_msg_slicelist_t *nrm_msg_slicelist_new(nrm_vector_t *slices)
-{
-	nrm_msg_slicelist_t *ret = calloc(1, sizeof(nrm_msg_slicelist_t));
+	nrm_msg_slicelist_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_slicelist_t));
 	if (ret == NULL)
 		return NULL;
 	nrm_msg_slicelist_init(ret);
@@ -526,37 +706,28 @@ nrm_msg_slicelist_t *nrm_msg_slicelist_new(nrm_vector_t *slices)
 	}
 	nrm_vector_length(slices, &ret->n_slices);
 	nrm_log_debug("vector contains %zu\n", ret->n_slices);
-	ret->slices = calloc(ret->n_slices, sizeof(nrm_msg_slice_t *));
+	ret->slices = nrm_msg_arena_alloc(
+	        arena, ret->n_slices * sizeof(nrm_msg_slice_t *));
 	assert(ret->slices);
 	for (size_t i = 0; i < ret->n_slices; i++) {
 		nrm_slice_t *s;
 		nrm_vector_get_withtype(nrm_slice_t, slices, i, s);
 		nrm_log_debug("packed slice %zu %s\n", i, s->uuid);
-		ret->slices[i] = nrm_msg_slice_new(s->uuid);
+		ret->slices[i] = nrm_msg_slice_new(arena, s->uuid);
 	}
 	return ret;
 }
 
-void nrm_msg_slicelist_destroy(nrm_msg_slicelist_t *msg)
-{
-	if (msg == NULL)
-		return;
-
-	for (size_t i = 0; i < msg->n_slices; i++)
-		nrm_msg_slice_destroy(msg->slices[i]);
-	free(msg->slices);
-	free(msg);
-}
-
 int nrm_msg_set_list_actuators(nrm_msg_t *msg, nrm_vector_t *actuators)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->list = nrm_msg_list_new(NRM_MSG_TARGET_TYPE_ACTUATOR);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->list = nrm_msg_list_new(arena, NRM_MSG_TARGET_TYPE_ACTUATOR);
 	assert(msg->list);
 	msg->data_case = NRM__MESSAGE__DATA_LIST;
 	msg->list->data_case = NRM__LIST__DATA_ACTUATORS;
-	msg->list->actuators = nrm_msg_actuatorlist_new(actuators);
+	msg->list->actuators = nrm_msg_actuatorlist_new(arena, actuators);
 	return 0;
 }
 
@@ -564,11 +735,12 @@ int nrm_msg_set_list_scopes(nrm_msg_t *msg, nrm_vector_t *scopes)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->list = nrm_msg_list_new(NRM_MSG_TARGET_TYPE_SCOPE);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->list = nrm_msg_list_new(arena, NRM_MSG_TARGET_TYPE_SCOPE);
 	assert(msg->list);
 	msg->data_case = NRM__MESSAGE__DATA_LIST;
 	msg->list->data_case = NRM__LIST__DATA_SCOPES;
-	msg->list->scopes = nrm_msg_scopelist_new(scopes);
+	msg->list->scopes = nrm_msg_scopelist_new(arena, scopes);
 	return 0;
 }
 
@@ -576,11 +748,12 @@ int nrm_msg_set_list_sensors(nrm_msg_t *msg, nrm_vector_t *sensors)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->list = nrm_msg_list_new(NRM_MSG_TARGET_TYPE_SENSOR);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->list = nrm_msg_list_new(arena, NRM_MSG_TARGET_TYPE_SENSOR);
 	assert(msg->list);
 	msg->data_case = NRM__MESSAGE__DATA_LIST;
 	msg->list->data_case = NRM__LIST__DATA_SENSORS;
-	msg->list->sensors = nrm_msg_sensorlist_new(sensors);
+	msg->list->sensors = nrm_msg_sensorlist_new(arena, sensors);
 	return 0;
 }
 
@@ -588,65 +761,76 @@ int nrm_msg_set_list_slices(nrm_msg_t *msg, nrm_vector_t *slices)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->list = nrm_msg_list_new(NRM_MSG_TARGET_TYPE_SLICE);
+	nrm_msg_arena_t *arena = nrm_msg_arena_of(msg);
+	msg->list = nrm_msg_list_new(arena, NRM_MSG_TARGET_TYPE_SLICE);
 	assert(msg->list);
 	msg->data_case = NRM__MESSAGE__DATA_LIST;
 	msg->list->data_case = NRM__LIST__DATA_SLICES;
-	msg->list->slices = nrm_msg_slicelist_new(slices);
+	msg->list->slices = nrm_msg_slicelist_new(arena, slices);
 	return 0;
 }
 
-void nrm_msg_list_destroy(nrm_msg_list_t *msg)
+/* must come after one of the nrm_msg_set_list_* */
+int nrm_msg_set_list_filter(nrm_msg_t *msg, int filter, const char *value)
 {
-	if (msg == NULL)
-		return;
+	if (msg == NULL || msg->list == NULL)
+		return -NRM_EINVAL;
+	if (filter == NRM_MSG_LIST_FILTER_NONE)
+		return 0;
+	if (value == NULL)
+		return -NRM_EINVAL;
 
-	switch (msg->type) {
-	case NRM_MSG_TARGET_TYPE_SLICE:
-		nrm_msg_slicelist_destroy(msg->slices);
+	char *s = nrm_msg_arena_strdup(nrm_msg_arena_of(msg), value);
+	assert(s);
+	switch (filter) {
+	case NRM_MSG_LIST_FILTER_UUID:
+		msg->list->uuid = s;
 		break;
-	case NRM_MSG_TARGET_TYPE_SENSOR:
-		nrm_msg_sensorlist_destroy(msg->sensors);
+	case NRM_MSG_LIST_FILTER_PREFIX:
+		msg->list->prefix = s;
 		break;
-	case NRM_MSG_TARGET_TYPE_SCOPE:
-		nrm_msg_scopelist_destroy(msg->scopes);
-		break;
-	case NRM_MSG_TARGET_TYPE_ACTUATOR:
-		nrm_msg_actuatorlist_destroy(msg->actuators);
+	case NRM_MSG_LIST_FILTER_PATTERN:
+		msg->list->pattern = s;
 		break;
 	default:
-		break;
+		return -NRM_EINVAL;
 	}
-	free(msg);
+	msg->list->filter_case = filter;
+	return 0;
 }
 
-nrm_msg_remove_t *nrm_msg_remove_new(int type, nrm_string_t uuid)
+nrm_msg_remove_t *
+nrm_msg_remove_new(nrm_msg_arena_t *arena, int type, nrm_string_t uuid)
 {
-	nrm_msg_remove_t *ret = calloc(1, sizeof(nrm_msg_remove_t));
+	nrm_msg_remove_t *ret =
+	        nrm_msg_arena_alloc(arena, sizeof(nrm_msg_remove_t));
 	if (ret == NULL)
 		return ret;
 	nrm_msg_remove_init(ret);
 	ret->type = type;
-	ret->uuid = strdup(uuid);
+	ret->uuid = nrm_msg_arena_strdup(arena, uuid);
 	return ret;
 }
 
-void nrm_msg_remove_destroy(nrm_msg_remove_t *msg)
+int nrm_msg_set_remove(nrm_msg_t *msg, int type, nrm_string_t uuid)
 {
 	if (msg == NULL)
-		return;
-
-	free(msg->uuid);
-	free(msg);
+		return -NRM_EINVAL;
+	msg->remove = nrm_msg_remove_new(nrm_msg_arena_of(msg), type, uuid);
+	assert(msg->remove);
+	msg->data_case = NRM__MESSAGE__DATA_REMOVE;
+	return 0;
 }
 
-int nrm_msg_set_remove(nrm_msg_t *msg, int type, nrm_string_t uuid)
+int nrm_msg_set_resolve(nrm_msg_t *msg, nrm_scope_t *scope)
 {
 	if (msg == NULL)
 		return -NRM_EINVAL;
-	msg->remove = nrm_msg_remove_new(type, uuid);
-	assert(msg->remove);
-	msg->data_case = NRM__MESSAGE__DATA_REMOVE;
+	if (scope == NULL)
+		return 0;
+	msg->data_case = NRM__MESSAGE__DATA_RESOLVE;
+	msg->resolve = nrm_msg_scope_new(nrm_msg_arena_of(msg), scope);
+	assert(msg->resolve);
 	return 0;
 }
 
@@ -654,31 +838,7 @@ void nrm_msg_destroy_created(nrm_msg_t **msg)
 {
 	if (msg == NULL || *msg == NULL)
 		return;
-
-	nrm_msg_t *sub = *msg;
-	switch (sub->type) {
-	case NRM_MSG_TYPE_ACTUATE:
-		nrm_msg_actuate_destroy(sub->actuate);
-		break;
-	case NRM_MSG_TYPE_ADD:
-		nrm_msg_add_destroy(sub->add);
-		break;
-	case NRM_MSG_TYPE_LIST:
-		nrm_msg_list_destroy(sub->list);
-		break;
-	case NRM_MSG_TYPE_EVENTS:
-		nrm_msg_timeserielist_destroy(sub->events);
-		break;
-	case NRM_MSG_TYPE_REMOVE:
-		nrm_msg_remove_destroy(sub->remove);
-		break;
-	case NRM_MSG_TYPE_ACK:
-	case NRM_MSG_TYPE_EXIT:
-	case NRM_MSG_TYPE_TICK:
-	default:
-		break;
-	}
-	free(*msg);
+	nrm_msg_arena_destroy(nrm_msg_arena_of(*msg));
 	*msg = NULL;
 }
 
@@ -727,17 +887,48 @@ nrm_actuator_t *nrm_actuator_create_frommsg(nrm_msg_actuator_t *msg)
 	return ret;
 }
 
+/* older senders use plain arrays of indexes */
+static int nrm_msg_bitmap_parse(struct nrm_bitmap *map,
+                                size_t nranges,
+                                int32_t *ranges,
+                                size_t nitems,
+                                int32_t *items)
+{
+	if (nranges != 0)
+		return nrm_bitmap_from_ranges(map, nranges, ranges);
+	return nrm_bitmap_from_array(map, nitems, items);
+}
+
+static int nrm_msg_scope_parse(nrm_scope_t *scope, nrm_msg_scope_t *msg)
+{
+	int err;
+	err = nrm_msg_bitmap_parse(&scope->maps[NRM_SCOPE_TYPE_CPU],
+	                           msg->n_cpu_ranges, msg->cpu_ranges,
+	                           msg->n_cpus, msg->cpus);
+	if (err)
+		return err;
+	err = nrm_msg_bitmap_parse(&scope->maps[NRM_SCOPE_TYPE_NUMA],
+	                           msg->n_numa_ranges, msg->numa_ranges,
+	                           msg->n_numas, msg->numas);
+	if (err)
+		return err;
+	return nrm_msg_bitmap_parse(&scope->maps[NRM_SCOPE_TYPE_GPU],
+	                            msg->n_gpu_ranges, msg->gpu_ranges,
+	                            msg->n_gpus, msg->gpus);
+}
+
 nrm_scope_t *nrm_scope_create_frommsg(nrm_msg_scope_t *msg)
 {
 	if (msg == NULL)
 		return NULL;
 	nrm_scope_t *ret = nrm_scope_create(msg->uuid);
-	nrm_bitmap_from_array(&ret->maps[NRM_SCOPE_TYPE_CPU], msg->n_cpus,
-	                      msg->cpus);
-	nrm_bitmap_from_array(&ret->maps[NRM_SCOPE_TYPE_NUMA], msg->n_numas,
-	                      msg->numas);
-	nrm_bitmap_from_array(&ret->maps[NRM_SCOPE_TYPE_GPU], msg->n_gpus,
-	                      msg->gpus);
+	if (ret == NULL)
+		return NULL;
+	if (nrm_msg_scope_parse(ret, msg)) {
+		nrm_log_error("malformed scope %s\n", msg->uuid);
+		nrm_scope_destroy(ret);
+		return NULL;
+	}
 	return ret;
 }
 
@@ -788,13 +979,7 @@ int nrm_scope_update_frommsg(nrm_scope_t *scope, nrm_msg_scope_t *msg)
 {
 	if (scope == NULL || msg == NULL)
 		return -NRM_EINVAL;
-	nrm_bitmap_from_array(&scope->maps[NRM_SCOPE_TYPE_CPU], msg->n_cpus,
-	                      msg->cpus);
-	nrm_bitmap_from_array(&scope->maps[NRM_SCOPE_TYPE_NUMA], msg->n_numas,
-	                      msg->numas);
-	nrm_bitmap_from_array(&scope->maps[NRM_SCOPE_TYPE_GPU], msg->n_gpus,
-	                      msg->gpus);
-	return 0;
+	return nrm_msg_scope_parse(scope, msg);
 }
 
 int nrm_sensor_update_frommsg(nrm_sensor_t *sensor, nrm_msg_sensor_t *msg)
@@ -814,37 +999,52 @@ int nrm_slice_update_frommsg(nrm_slice_t *slice, nrm_msg_slice_t *msg)
  * Protobuf Management: ZMQ Management
  *******************************************************************************/
 
+/* the message is unpacked straight from the received frame, that stays owned
+ * by zm: protobuf-c copies anything it keeps, so the caller can destroy zm
+ * right after.
+ */
 static int nrm_msg_pop_packed_frames(zmsg_t *zm, nrm_msg_t **msg)
 {
 	/* empty frame delimiter */
-	zframe_t *frame = zmsg_pop(zm);
-	assert(zframe_size(frame) == 0);
-	zframe_destroy(&frame);
+	zframe_t *frame = zmsg_first(zm);
+	assert(frame != NULL && zframe_size(frame) == 0);
 	/* unpack */
-	frame = zmsg_pop(zm);
-	*msg = nrm__message__unpack(NULL, zframe_size(frame),
-	                            zframe_data(frame));
-	zframe_destroy(&frame);
+	frame = zmsg_next(zm);
+	assert(frame != NULL);
+	*msg = nrm_msg_unpack(zframe_size(frame), zframe_data(frame));
 	return 0;
 }
 
-static int nrm_msg_push_packed_frames(zmsg_t *zm, nrm_msg_t *msg)
+zframe_t *nrm_msg_pack(nrm_msg_t *msg)
+{
+	/* pack the data directly in its frame, zmq sends it from there */
+	size_t size = nrm__message__get_packed_size(msg);
+	zframe_t *frame = zframe_new(NULL, size);
+	if (frame == NULL)
+		return NULL;
+	nrm__message__pack(msg, zframe_data(frame));
+	return frame;
+}
+
+static int nrm_msg_push_packed_frame(zmsg_t *zm, zframe_t **frame)
 {
 	/* need to add a frame delimiter for zmq to consider this a separate
 	 * message
 	 */
-	zframe_t *frame = zframe_new_empty();
-	zmsg_append(zm, &frame);
-	/* now add the packed data */
-	size_t size = nrm__message__get_packed_size(msg);
-	unsigned char *buf = malloc(size);
-	assert(buf);
-	nrm__message__pack(msg, buf);
-	zmsg_addmem(zm, buf, size);
-	free(buf);
+	zframe_t *delim = zframe_new_empty();
+	zmsg_append(zm, &delim);
+	zmsg_append(zm, frame);
 	return 0;
 }
 
+static int nrm_msg_push_packed_frames(zmsg_t *zm, nrm_msg_t *msg)
+{
+	zframe_t *frame = nrm_msg_pack(msg);
+	if (frame == NULL)
+		return -NRM_ENOMEM;
+	return nrm_msg_push_packed_frame(zm, &frame);
+}
+
 /*******************************************************************************
  * General API, NOT PROTOBUF STUFF
  *******************************************************************************/
@@ -889,7 +1089,21 @@ int nrm_msg_send(zsock_t *socket, nrm_msg_t *msg)
 	zmsg_t *zm = zmsg_new();
 	if (zm == NULL)
 		return -NRM_ENOMEM;
-	nrm_msg_push_packed_frames(zm, msg);
+	if (nrm_msg_push_packed_frames(zm, msg)) {
+		zmsg_destroy(&zm);
+		return -NRM_ENOMEM;
+	}
+	return zmsg_send(&zm, socket);
+}
+
+int nrm_msg_send_packed(zsock_t *socket, zframe_t **frame)
+{
+	zmsg_t *zm = zmsg_new();
+	if (zm == NULL) {
+		zframe_destroy(frame);
+		return -NRM_ENOMEM;
+	}
+	nrm_msg_push_packed_frame(zm, frame);
 	return zmsg_send(&zm, socket);
 }
 
@@ -899,7 +1113,10 @@ int nrm_msg_sendto(zsock_t *socket, nrm_msg_t *msg, nrm_uuid_t *uuid)
 	if (zm == NULL)
 		return -NRM_ENOMEM;
 	nrm_msg_push_identity(zm, uuid);
-	nrm_msg_push_packed_frames(zm, msg);
+	if (nrm_msg_push_packed_frames(zm, msg)) {
+		zmsg_destroy(&zm);
+		return -NRM_ENOMEM;
+	}
 	return zmsg_send(&zm, socket);
 }
 
@@ -930,7 +1147,10 @@ int nrm_msg_pub(zsock_t *socket, nrm_string_t topic, nrm_msg_t *msg)
 	if (zm == NULL)
 		return -NRM_ENOMEM;
 	nrm_msg_push_topic(zm, topic);
-	nrm_msg_push_packed_frames(zm, msg);
+	if (nrm_msg_push_packed_frames(zm, msg)) {
+		zmsg_destroy(&zm);
+		return -NRM_ENOMEM;
+	}
 	return zmsg_send(&zm, socket);
 }
 
@@ -966,6 +1186,8 @@ static const nrm_msg_type_table_t nrm_msg_type_table[] = {
         {NRM_MSG_TYPE_ACTUATE, "ACTUATE"},
         {NRM_MSG_TYPE_EXIT, "EXIT"},
 	{NRM_MSG_TYPE_TICK, "TICK"},
+	{NRM_MSG_TYPE_RESOLVE, "RESOLVE"},
+	{NRM_MSG_TYPE_NACK, "NACK"},
         {0, NULL},
 };
 /* clang-format on */
@@ -994,13 +1216,15 @@ const char *nrm_msg_type_t2s(int type, const nrm_msg_type_table_t *table)
 	return "UNKNOWN";
 }
 
-json_t *nrm_msg_bitmap_to_json(size_t nitems, int32_t *items)
+json_t *nrm_msg_bitmap_to_json(size_t nranges,
+                               int32_t *ranges,
+                               size_t nitems,
+                               int32_t *items)
 {
-	json_t *ret;
-	ret = json_array();
-	for (size_t i = 0; i < nitems; i++)
-		json_array_append_new(ret, json_integer(items[i]));
-	return ret;
+	struct nrm_bitmap map;
+	if (nrm_msg_bitmap_parse(&map, nranges, ranges, nitems, items))
+		return json_null();
+	return nrm_bitmap_to_json(&map);
 }
 
 json_t *nrm_msg_darray_to_json(size_t nitems, double *items)
@@ -1065,11 +1289,15 @@ json_t *nrm_msg_scope_to_json(nrm_msg_scope_t *msg)
 {
 	json_t *ret;
 	json_t *cpus, *gpus, *numas;
-	cpus = nrm_msg_bitmap_to_json(msg->n_cpus, msg->cpus);
-	numas = nrm_msg_bitmap_to_json(msg->n_numas, msg->numas);
-	gpus = nrm_msg_bitmap_to_json(msg->n_gpus, msg->gpus);
-	ret = json_pack("{s:s, s:o, s:o, s:o}", "uuid", msg->uuid, "cpu", cpus,
-	                "numa", numas, "gpu", gpus);
+	cpus = nrm_msg_bitmap_to_json(msg->n_cpu_ranges, msg->cpu_ranges,
+	                              msg->n_cpus, msg->cpus);
+	numas = nrm_msg_bitmap_to_json(msg->n_numa_ranges, msg->numa_ranges,
+	                               msg->n_numas, msg->numas);
+	gpus = nrm_msg_bitmap_to_json(msg->n_gpu_ranges, msg->gpu_ranges,
+	                              msg->n_gpus, msg->gpus);
+	ret = json_pack("{s:s, s:I, s:o, s:o, s:o}", "uuid", msg->uuid, "id",
+	                (json_int_t)msg->id, "cpu", cpus, "numa", numas, "gpu",
+	                gpus);
 	return ret;
 }
 
@@ -1137,6 +1365,14 @@ json_t *nrm_msg_timeserie_to_json(nrm_msg_timeserie_t *msg)
 		json_array_append_new(events,
 		                      nrm_msg_event_to_json(msg->events[i]));
 	}
+	for (size_t i = 0; msg->n_events == 0 && i < msg->n_times &&
+	                   i < msg->n_values;
+	     i++) {
+		json_array_append_new(events,
+		                      json_pack("{s:I, s:f}", "time",
+		                                msg->start + msg->times[i],
+		                                "value", msg->values[i]));
+	}
 	scope = nrm_msg_scope_to_json(msg->scope);
 	ret = json_pack("{s:s, s:o, s:I, s:o}", "sensor_uuid", msg->sensor_uuid,
 	                "scope_uuid", scope, "start", msg->start, "events",
@@ -1159,19 +1395,31 @@ json_t *nrm_msg_add_to_json(nrm_msg_add_t *msg)
 {
 	json_t *ret;
 	json_t *sub;
-	switch (msg->type) {
-	case NRM_MSG_TARGET_TYPE_ACTUATOR:
+	switch (msg->data_case) {
+	case NRM__ADD__DATA_ACTUATOR:
 		sub = nrm_msg_actuator_to_json(msg->actuator);
 		break;
-	case NRM_MSG_TARGET_TYPE_SLICE:
+	case NRM__ADD__DATA_SLICE:
 		sub = nrm_msg_slice_to_json(msg->slice);
 		break;
-	case NRM_MSG_TARGET_TYPE_SENSOR:
+	case NRM__ADD__DATA_SENSOR:
 		sub = nrm_msg_sensor_to_json(msg->sensor);
 		break;
-	case NRM_MSG_TARGET_TYPE_SCOPE:
+	case NRM__ADD__DATA_SCOPE:
 		sub = nrm_msg_scope_to_json(msg->scope);
 		break;
+	case NRM__ADD__DATA_ACTUATORS:
+		sub = nrm_msg_actuatorlist_to_json(msg->actuators);
+		break;
+	case NRM__ADD__DATA_SLICES:
+		sub = nrm_msg_slicelist_to_json(msg->slices);
+		break;
+	case NRM__ADD__DATA_SENSORS:
+		sub = nrm_msg_sensorlist_to_json(msg->sensors);
+		break;
+	case NRM__ADD__DATA_SCOPES:
+		sub = nrm_msg_scopelist_to_json(msg->scopes);
+		break;
 	default:
 		sub = NULL;
 		break;
@@ -1206,6 +1454,22 @@ json_t *nrm_msg_list_to_json(nrm_msg_list_t *msg)
 	ret = json_pack("{s:s, s:o?}", "type",
 	                nrm_msg_type_t2s(msg->type, nrm_msg_target_table),
 	                "data", sub);
+	switch (msg->filter_case) {
+	case NRM_MSG_LIST_FILTER_UUID:
+		sub = json_pack("{s:s}", "uuid", msg->uuid);
+		break;
+	case NRM_MSG_LIST_FILTER_PREFIX:
+		sub = json_pack("{s:s}", "prefix", msg->prefix);
+		break;
+	case NRM_MSG_LIST_FILTER_PATTERN:
+		sub = json_pack("{s:s}", "pattern", msg->pattern);
+		break;
+	default:
+		sub = NULL;
+		break;
+	}
+	if (sub != NULL)
+		json_object_set_new(ret, "filter", sub);
 	return ret;
 }
 
@@ -1245,6 +1509,10 @@ json_t *nrm_msg_to_json(nrm_msg_t *msg)
 	case NRM_MSG_TYPE_REMOVE:
 		sub = nrm_msg_remove_to_json(msg->remove);
 		break;
+	case NRM_MSG_TYPE_RESOLVE:
+		sub = msg->resolve != NULL ? nrm_msg_scope_to_json(msg->resolve)
+		                           : NULL;
+		break;
 	default:
 		sub = NULL;
 		break;
@@ -1328,7 +1596,9 @@ int nrm_ctrlmsg__recv(zsock_t *socket, int *type, void **p1, void **p2)
 	char *s;
 	void *p, *q;
 	err = zsock_recv(socket, "spp", &s, &p, &q);
-	assert(err == 0);
+	/* interrupted, or the socket is going away */
+	if (err)
+		return -NRM_FAILURE;
 	*type = nrm_ctrlmsg_s2t(s);
 	nrm_log_debug("received %s:%u\n", s, *type);
 	if (p1 != NULL) {
@@ -1369,7 +1639,8 @@ nrm_msg_t *nrm_ctrlmsg_recvmsg(zsock_t *socket, int *type, nrm_uuid_t **from)
 	int err;
 	void *p, *q;
 	err = nrm_ctrlmsg__recv(socket, type, &p, &q);
-	assert(err == 0);
+	if (err)
+		return NULL;
 	nrm_log_printmsg(NRM_LOG_DEBUG, (nrm_msg_t *)p);
 	if (from != NULL) {
 		*from = (nrm_uuid_t *)q;
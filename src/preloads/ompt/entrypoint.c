@@ -54,29 +54,14 @@ int find_allowed_scope(nrm_client_t *client, nrm_scope_t **scope)
 	nrm_scope_t *allowed = nrm_scope_create_hwloc_allowed(name);
 	nrm_string_decref(name);
 
-	nrm_vector_t *nrmd_scopes;
-	nrm_client_list_scopes(client, &nrmd_scopes);
-
-	size_t numscopes;
-	int newscope = 0;
-	nrm_vector_length(nrmd_scopes, &numscopes);
-	for (size_t i = 0; i < numscopes; i++) {
-		nrm_scope_t *s;
-		nrm_vector_pop_back(nrmd_scopes, &s);
-		if (!nrm_scope_cmp(s, allowed)) {
-			nrm_scope_destroy(allowed);
-			allowed = s;
-			newscope = 1;
-			continue;
-		}
-		nrm_scope_destroy(s);
-	}
-	if (!newscope) {
+	nrm_scope_t *match;
+	int err = nrm_client_resolve_scope(client, allowed, &match);
+	nrm_scope_destroy(allowed);
+	if (err) {
 		nrm_log_error("Could not find an existing scope to match\n");
 		return -NRM_EINVAL;
 	}
-	nrm_vector_destroy(&nrmd_scopes);
-	*scope = allowed;
+	*scope = match;
 	return 0;
 }
 
@@ -31,6 +31,10 @@
 
 #include "nrm_mpi.h"
 
+/* events are sent by batches of that many, or once the oldest is 100ms old */
+#define NRM_MPI_BUFFER_EVENTS 1024
+#define NRM_MPI_BUFFER_AGE 100000000
+
 static nrm_client_t *client;
 static nrm_scope_t *scope;
 static nrm_sensor_t *sensor;
@@ -85,6 +89,9 @@ NRM_MPI_DECL(MPI_Comm_rank, int, MPI_Comm comm, int *rank)
 NRM_MPI_DECL(MPI_Finalize, int, void)
 {
 	NRM_MPI_RESOLVE(MPI_Finalize);
+	/* send what is left before MPI shuts down */
+	if (client)
+		nrm_client_flush(client);
 	if (scope)
 		nrm_scope_destroy(scope);
 	if (client)
@@ -102,29 +109,14 @@ int find_scope(nrm_client_t *client, int rank, nrm_scope_t **scope)
 	nrm_string_decref(name);
 	nrm_scope_threadshared(ret);
 
-	nrm_vector_t *nrmd_scopes;
-	nrm_client_list_scopes(client, &nrmd_scopes);
-
-	size_t numscopes;
-	int newscope = 0;
-	nrm_vector_length(nrmd_scopes, &numscopes);
-	for (size_t i = 0; i < numscopes; i++) {
-		nrm_scope_t *s;
-		nrm_vector_pop_back(nrmd_scopes, &s);
-		if (!nrm_scope_cmp(s, ret)) {
-			nrm_scope_destroy(ret);
-			ret = s;
-			newscope = 1;
-			continue;
-		}
-		nrm_scope_destroy(s);
-	}
-	if (!newscope) {
+	nrm_scope_t *match;
+	int err = nrm_client_resolve_scope(client, ret, &match);
+	nrm_scope_destroy(ret);
+	if (err) {
 		nrm_log_error("Could not find an existing scope to match\n");
 		return -NRM_EINVAL;
 	}
-	nrm_vector_destroy(&nrmd_scopes);
-	*scope = ret;
+	*scope = match;
 	return 0;
 }
 
@@ -146,6 +138,8 @@ NRM_MPI_DECL(MPI_Init, int, int *argc, char ***argv)
 	                             nrm_upstream_pub_port,
 	                             nrm_upstream_rpc_port)) != 0)
 		goto end;
+	nrm_client_set_buffering(client, NRM_MPI_BUFFER_EVENTS, 0,
+	                         nrm_time_fromns(NRM_MPI_BUFFER_AGE));
 
 	if ((ret = find_scope(client, rank, &scope)) != 0)
 		goto end;
@@ -11,6 +11,8 @@
 #include "config.h"
 
 #include "nrm.h"
+#include <sched.h>
+#include <sys/eventfd.h>
 #include <sys/signalfd.h>
 
 #include "internal/nrmi.h"
@@ -30,6 +32,98 @@ struct nrm_client_cmd_cb_s {
 	void *arg;
 };
 
+/* packed messages are handed to the broker through a bounded lock-free queue
+ * instead of the pipe, so that application threads sending events don't have
+ * to serialize on it. Any number of threads push, only the broker pops, and
+ * an eventfd wakes it up.
+ *
+ * Each cell carries a sequence number telling whose turn it is: a producer
+ * can fill cell i when its sequence is i, the broker can empty it when it is
+ * i + 1.
+ */
+#define NRM_CLIENT_QUEUE_SIZE 256
+#define NRM_CLIENT_QUEUE_MASK (NRM_CLIENT_QUEUE_SIZE - 1)
+
+struct nrm_client_queue_cell_s {
+	size_t seq;
+	zframe_t *frame;
+};
+
+struct nrm_client_queue_s {
+	struct nrm_client_queue_cell_s cells[NRM_CLIENT_QUEUE_SIZE];
+	/* next cell to push to, shared by all producers */
+	size_t head;
+	/* next cell to pop from, only used by the broker */
+	size_t tail;
+	int efd;
+};
+
+static int nrm_client_queue_init(struct nrm_client_queue_s *q)
+{
+	for (size_t i = 0; i < NRM_CLIENT_QUEUE_SIZE; i++) {
+		q->cells[i].seq = i;
+		q->cells[i].frame = NULL;
+	}
+	q->head = 0;
+	q->tail = 0;
+	q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->efd == -1)
+		return -NRM_FAILURE;
+	return 0;
+}
+
+static int nrm_client_queue_push(struct nrm_client_queue_s *q, zframe_t *frame)
+{
+	struct nrm_client_queue_cell_s *cell;
+	size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &q->cells[pos & NRM_CLIENT_QUEUE_MASK];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+			                                1, __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0)
+			return -NRM_EBUSY;
+		else
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	}
+	cell->frame = frame;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static zframe_t *nrm_client_queue_pop(struct nrm_client_queue_s *q)
+{
+	struct nrm_client_queue_cell_s *cell =
+	        &q->cells[q->tail & NRM_CLIENT_QUEUE_MASK];
+	size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+	if (seq != q->tail + 1)
+		return NULL;
+	zframe_t *ret = cell->frame;
+	__atomic_store_n(&cell->seq, q->tail + NRM_CLIENT_QUEUE_SIZE,
+	                 __ATOMIC_RELEASE);
+	q->tail++;
+	return ret;
+}
+
+static void nrm_client_queue_wake(struct nrm_client_queue_s *q)
+{
+	uint64_t one = 1;
+	ssize_t s = write(q->efd, &one, sizeof(one));
+	(void)s;
+}
+
+static void nrm_client_queue_fini(struct nrm_client_queue_s *q)
+{
+	zframe_t *frame;
+	while ((frame = nrm_client_queue_pop(q)) != NULL)
+		zframe_destroy(&frame);
+	close(q->efd);
+}
+
 /* actor thread that takes care of actually communicating with the rest of the
  * NRM infrastructure.
  */
@@ -46,6 +140,8 @@ struct nrm_client_broker_s {
 	struct nrm_client_sub_cb_s *sub_cb;
 	/* pointer to the cmd callback */
 	struct nrm_client_cmd_cb_s *cmd_cb;
+	/* packed messages to send out */
+	struct nrm_client_queue_s *queue;
 };
 
 struct nrm_client_broker_args {
@@ -59,14 +155,38 @@ struct nrm_client_broker_args {
 	struct nrm_client_sub_cb_s *sub_cb;
 	/* pointer to the cmd callback */
 	struct nrm_client_cmd_cb_s *cmd_cb;
+	/* pointer to the queue of packed messages */
+	struct nrm_client_queue_s *queue;
 };
 
 struct nrm_role_client_s {
 	zactor_t *broker;
 	struct nrm_client_sub_cb_s sub_cb;
 	struct nrm_client_cmd_cb_s cmd_cb;
+	struct nrm_client_queue_s queue;
 };
 
+/* sends everything queued so far, in order */
+static void nrm_client_broker_drain(struct nrm_client_broker_s *self)
+{
+	zframe_t *frame;
+	while ((frame = nrm_client_queue_pop(self->queue)) != NULL)
+		nrm_msg_send_packed(self->rpc, &frame);
+}
+
+int nrm_client_broker_queue_handler(zloop_t *loop,
+                                    zmq_pollitem_t *poller,
+                                    void *arg)
+{
+	(void)loop;
+	struct nrm_client_broker_s *self = (struct nrm_client_broker_s *)arg;
+	uint64_t count;
+	ssize_t s = read(poller->fd, &count, sizeof(count));
+	(void)s;
+	nrm_client_broker_drain(self);
+	return 0;
+}
+
 int nrm_client_broker_pipe_handler(zloop_t *loop, zsock_t *socket, void *arg)
 {
 	(void)loop;
@@ -79,7 +199,10 @@ int nrm_client_broker_pipe_handler(zloop_t *loop, zsock_t *socket, void *arg)
 	void *p, *q;
 	nrm_msg_t *msg = NULL;
 	nrm_string_t s = NULL;
-	nrm_ctrlmsg__recv(socket, &msg_type, &p, &q);
+	if (nrm_ctrlmsg__recv(socket, &msg_type, &p, &q))
+		return -1;
+	/* anything queued before this request must go out first */
+	nrm_client_broker_drain(self);
 	switch (msg_type) {
 	case NRM_CTRLMSG_TYPE_SEND:
 		NRM_CTRLMSG_2SEND(p, q, msg);
@@ -171,6 +294,7 @@ void nrm_client_broker_fn(zsock_t *pipe, void *args)
 
 	self->sub_cb = params->sub_cb;
 	self->cmd_cb = params->cmd_cb;
+	self->queue = params->queue;
 
 	/* init network */
 	nrm_log_debug("client: creating rpc socket\n");
@@ -222,6 +346,9 @@ void nrm_client_broker_fn(zsock_t *pipe, void *args)
 	zloop_reader(self->loop, self->sub,
 	             (zloop_reader_fn *)nrm_client_broker_sub_handler,
 	             (void *)self);
+	zmq_pollitem_t queue_poller = {0, self->queue->efd, ZMQ_POLLIN, 0};
+	zloop_poller(self->loop, &queue_poller,
+	             nrm_client_broker_queue_handler, (void *)self);
 	/* notify we are ready */
 	zsock_signal(self->pipe, 0);
 
@@ -259,12 +386,17 @@ nrm_role_client_create_fromparams(const char *uri, int sub_port, int rpc_port)
 	bargs.rpc_port = rpc_port;
 	bargs.sub_cb = &(data->sub_cb);
 	bargs.cmd_cb = &(data->cmd_cb);
+	bargs.queue = &(data->queue);
+	if (nrm_client_queue_init(&data->queue)) {
+		nrm_log_perror("can't create client eventfd\n");
+		goto err;
+	}
 
 	/* create broker */
 	data->broker = zactor_new(nrm_client_broker_fn, &bargs);
 	if (data->broker == NULL) {
 		nrm_log_error("failed to create client zactor\n");
-		goto err;
+		goto err_queue;
 	}
 	zsock_set_unbounded(data->broker);
 	int err = zsock_wait(data->broker);
@@ -275,6 +407,8 @@ nrm_role_client_create_fromparams(const char *uri, int sub_port, int rpc_port)
 	return role;
 err_actor:
 	zactor_destroy(&data->broker);
+err_queue:
+	nrm_client_queue_fini(&data->queue);
 err:
 	free(role);
 	return NULL;
@@ -290,6 +424,7 @@ void nrm_role_client_destroy(nrm_role_t **role)
 	/* now exit: in principle this should just send a message on the pipe
 	 * and wait for the actor to exit by itself */
 	zactor_destroy(&client->broker);
+	nrm_client_queue_fini(&client->queue);
 
 	free(*role);
 	*role = NULL;
@@ -305,6 +440,22 @@ int nrm_role_client_send(const struct nrm_role_data *data,
 	return 0;
 }
 
+/* the frame is owned by the broker from now on. Safe to call from any
+ * thread without locking.
+ */
+int nrm_role_client_send_packed(const struct nrm_role_data *data,
+                                zframe_t *frame)
+{
+	struct nrm_role_client_s *client = (struct nrm_role_client_s *)data;
+	while (nrm_client_queue_push(&client->queue, frame) == -NRM_EBUSY) {
+		/* full: make sure the broker is draining and let it run */
+		nrm_client_queue_wake(&client->queue);
+		sched_yield();
+	}
+	nrm_client_queue_wake(&client->queue);
+	return 0;
+}
+
 nrm_msg_t *nrm_role_client_recv(const struct nrm_role_data *data,
                                 nrm_uuid_t **from)
 {
@@ -312,6 +463,8 @@ nrm_msg_t *nrm_role_client_recv(const struct nrm_role_data *data,
 	nrm_msg_t *msg;
 	int msgtype;
 	msg = nrm_ctrlmsg_recvmsg((zsock_t *)client->broker, &msgtype, from);
+	if (msg == NULL)
+		return NULL;
 	assert(msgtype == NRM_CTRLMSG_TYPE_RECV);
 	return msg;
 }
@@ -345,6 +498,7 @@ int nrm_role_client_sub(const struct nrm_role_data *data, nrm_string_t topic)
 
 struct nrm_role_ops nrm_role_client_ops = {
         nrm_role_client_send,
+        nrm_role_client_send_packed,
         nrm_role_client_recv,
         NULL,
         nrm_role_client_register_sub_cb,
@@ -67,7 +67,8 @@ int nrm_controller_broker_pipe_handler(zloop_t *loop,
 	nrm_msg_t *msg;
 	nrm_string_t s;
 	void *p, *q;
-	nrm_ctrlmsg__recv(socket, &msg_type, &p, &q);
+	if (nrm_ctrlmsg__recv(socket, &msg_type, &p, &q))
+		return -1;
 	nrm_log_debug("received ctrlmsg type: %u\n", msg_type);
 	switch (msg_type) {
 	case NRM_CTRLMSG_TYPE_TERM:
@@ -214,6 +215,8 @@ nrm_msg_t *nrm_role_controller_recv(const struct nrm_role_data *data,
 	int msgtype;
 	msg = nrm_ctrlmsg_recvmsg((zsock_t *)controller->broker, &msgtype,
 	                          from);
+	if (msg == NULL)
+		return NULL;
 	assert(msgtype == NRM_CTRLMSG_TYPE_RECV);
 	return msg;
 }
@@ -243,6 +246,7 @@ int nrm_role_controller_pub(const struct nrm_role_data *data,
 
 struct nrm_role_ops nrm_role_controller_ops = {
         nrm_role_controller_send,
+        NULL,
         nrm_role_controller_recv,
         nrm_role_controller_pub,
         NULL,
@@ -21,6 +21,13 @@ int nrm_role_send(const nrm_role_t *role, nrm_msg_t *msg, nrm_uuid_t *to)
 	return role->ops->send(role->data, msg, to);
 }
 
+int nrm_role_send_packed(const nrm_role_t *role, zframe_t *frame)
+{
+	if (role == NULL || role->ops == NULL || role->ops->send_packed == NULL)
+		return -NRM_ENOTSUP;
+	return role->ops->send_packed(role->data, frame);
+}
+
 nrm_msg_t *nrm_role_recv(const nrm_role_t *role, nrm_uuid_t **from)
 {
 	if (role == NULL || role->ops == NULL || role->ops->recv == NULL)
@@ -11,6 +11,7 @@
 #include "config.h"
 
 #include "nrm.h"
+#include <fnmatch.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,8 +28,17 @@ struct nrm_server_s {
 	nrm_state_t *state;
 	zloop_t *loop;
 	nrm_server_user_callbacks_t callbacks;
+	/* id of the request being handled, copied in its reply */
+	uint64_t reqid;
 };
 
+static int
+nrm_server_reply(nrm_server_t *self, nrm_msg_t *msg, nrm_uuid_t *clientid)
+{
+	msg->id = self->reqid;
+	return nrm_role_send(self->role, msg, clientid);
+}
+
 int nrm_server_actuate_callback(nrm_server_t *self,
                                 nrm_uuid_t *clientid,
                                 nrm_msg_actuate_t *msg)
@@ -56,7 +66,7 @@ int nrm_server_actuate_callback(nrm_server_t *self,
 	}
 	nrm_msg_t *ret = nrm_msg_create();
 	nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);
-	nrm_role_send(self->role, ret, clientid);
+	nrm_server_reply(self, ret, clientid);
 	return 0;
 }
 
@@ -66,35 +76,178 @@ int nrm_server_events_callback(nrm_server_t *self,
 {
 	(void)clientid;
 
-	/* unroll the entire timeseries */
+	/* a single buffer for the batches of all the timeseries */
+	size_t max = 0;
+	for (size_t i = 0; i < msg->n_series; i++) {
+		size_t n;
+		nrm_msg_timeserie_length(msg->series[i], &n);
+		if (n > max)
+			max = n;
+	}
+	if (max == 0)
+		return 0;
+	nrm_event_t *batch = malloc(max * sizeof(nrm_event_t));
+	if (batch == NULL)
+		return -NRM_ENOMEM;
+
+	/* unroll the entire timeseries, resolving the sensor and scope once
+	 * per timeserie. Objects known to the state carry an id that makes
+	 * their use down the line cheaper, the others are only valid for the
+	 * duration of the callback.
+	 */
 	for (size_t i = 0; i < msg->n_series; i++) {
 		nrm_msg_timeserie_t *ts = msg->series[i];
-		/* TODO ensure both sensor and scope are in the state */
+		nrm_sensor_t *sensor = NULL, *tmpsensor = NULL;
+		nrm_scope_t *scope = NULL, *tmpscope = NULL;
+		size_t n;
+		if (ts->scope == NULL || nrm_msg_timeserie_length(ts, &n))
+			continue;
+
 		nrm_string_t uuid = nrm_string_fromchar(ts->sensor_uuid);
-		nrm_scope_t *scope = nrm_scope_create_frommsg(ts->scope);
-		for (size_t j = 0; j < ts->n_events; j++) {
-			nrm_msg_event_t *e = ts->events[j];
-			nrm_time_t time = nrm_time_fromns(e->time);
-			self->callbacks.event(self, uuid, scope, time,
-			                      e->value);
+		nrm_hash_find(self->state->sensors, uuid, (void *)&sensor);
+		nrm_string_decref(uuid);
+		if (sensor == NULL)
+			sensor = tmpsensor = nrm_sensor_create(ts->sensor_uuid);
+
+		/* clients refer to a scope we know by id, with its uuid in case
+		 * the id is stale: the scope was removed since, or we restarted
+		 * and gave the id to another scope.
+		 */
+		if (ts->scope->id != 0) {
+			scope = nrm_state_get_scope(self->state, ts->scope->id);
+			if (scope != NULL && ts->scope->uuid[0] != '\0' &&
+			    strcmp(scope->uuid, ts->scope->uuid) != 0)
+				scope = NULL;
+		}
+		if (scope == NULL && ts->scope->uuid[0] != '\0') {
+			uuid = nrm_string_fromchar(ts->scope->uuid);
+			nrm_hash_find(self->state->scopes, uuid,
+			              (void *)&scope);
+			nrm_string_decref(uuid);
+			if (scope == NULL)
+				scope = tmpscope =
+				        nrm_scope_create_frommsg(ts->scope);
+		}
+		if (scope == NULL) {
+			nrm_log_error("unknown scope id %zu\n",
+			              (size_t)ts->scope->id);
+			nrm_sensor_destroy(&tmpsensor);
+			continue;
 		}
+
+		for (size_t j = 0; j < n; j++)
+			nrm_msg_timeserie_get_event(ts, j, &batch[j]);
+		if (self->callbacks.events != NULL)
+			self->callbacks.events(self, sensor, scope, batch, n);
+		else if (self->callbacks.event != NULL) {
+			for (size_t j = 0; j < n; j++)
+				self->callbacks.event(
+				        self, sensor, scope,
+				        nrm_time_fromns(batch[j].time),
+				        batch[j].value);
+		}
+		nrm_sensor_destroy(&tmpsensor);
+		if (tmpscope != NULL)
+			nrm_scope_destroy(tmpscope);
 	}
+	free(batch);
 	return 0;
 }
 
+/* an object already in the state under the same uuid is not added again: the
+ * new copy is dropped and the reply carries the existing one, so that the
+ * client learns its id.
+ */
+static void *nrm_server_find_uuid(nrm_hash_t *table, const char *uuid)
+{
+	void *ret = NULL;
+	if (uuid == NULL)
+		return NULL;
+	nrm_string_t key = nrm_string_fromchar(uuid);
+	if (key == NULL)
+		return NULL;
+	nrm_hash_find(table, key, &ret);
+	nrm_string_decref(key);
+	return ret;
+}
+
+static void nrm_server_drop_actuator(nrm_actuator_t *actuator)
+{
+	nrm_actuator_destroy(&actuator);
+}
+
+static void nrm_server_drop_scope(nrm_scope_t *scope)
+{
+	if (scope != NULL)
+		nrm_scope_destroy(scope);
+}
+
+static void nrm_server_drop_sensor(nrm_sensor_t *sensor)
+{
+	nrm_sensor_destroy(&sensor);
+}
+
+static void nrm_server_drop_slice(nrm_slice_t *slice)
+{
+	nrm_slice_destroy(&slice);
+}
+
+static nrm_actuator_t *nrm_server_new_actuator(nrm_server_t *self,
+                                               nrm_uuid_t *clientid,
+                                               nrm_msg_actuator_t *msg)
+{
+	nrm_actuator_t *actuator =
+	        nrm_server_find_uuid(self->state->actuators, msg->uuid);
+	if (actuator != NULL) {
+		nrm_log_debug("actuator %s already known\n", msg->uuid);
+		return actuator;
+	}
+	actuator = nrm_actuator_create_frommsg(msg);
+	if (actuator == NULL)
+		return NULL;
+	nrm_actuator_set_clientid(
+	        actuator, nrm_uuid_create_fromchar(nrm_uuid_to_char(clientid)));
+	if (nrm_state_add_actuator(self->state, actuator)) {
+		nrm_server_drop_actuator(actuator);
+		return NULL;
+	}
+	return actuator;
+}
+
+#define NRM_SERVER_NEW_FUNC(type)                                              \
+	static nrm_##type##_t *nrm_server_new_##type(                          \
+	        nrm_server_t *self, nrm_uuid_t *clientid,                      \
+	        nrm_msg_##type##_t *msg)                                       \
+	{                                                                      \
+		(void)clientid;                                                \
+		nrm_##type##_t *r =                                            \
+		        nrm_server_find_uuid(self->state->type##s, msg->uuid); \
+		if (r != NULL) {                                               \
+			nrm_log_debug(#type " %s already known\n", msg->uuid); \
+			return r;                                              \
+		}                                                              \
+		r = nrm_##type##_create_frommsg(msg);                          \
+		if (r == NULL)                                                 \
+			return NULL;                                           \
+		if (nrm_state_add_##type(self->state, r)) {                    \
+			nrm_server_drop_##type(r);                             \
+			return NULL;                                           \
+		}                                                              \
+		return r;                                                      \
+	}
+
+NRM_SERVER_NEW_FUNC(scope)
+NRM_SERVER_NEW_FUNC(sensor)
+NRM_SERVER_NEW_FUNC(slice)
+
 nrm_msg_t *nrm_server_add_actuator(nrm_server_t *self,
                                    nrm_uuid_t *clientid,
                                    nrm_msg_actuator_t *msg)
 {
 	nrm_msg_t *ret = nrm_msg_create();
-	nrm_actuator_t *actuator = nrm_actuator_create_frommsg(msg);
-	nrm_actuator_set_clientid(
-	        actuator, nrm_uuid_create_fromchar(nrm_uuid_to_char(clientid)));
-
-	int err = nrm_state_add_actuator(self->state, actuator);
-	if (err) {
-		/* TODO: NACK */
-		nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);
+	nrm_actuator_t *actuator = nrm_server_new_actuator(self, clientid, msg);
+	if (actuator == NULL) {
+		nrm_msg_fill(ret, NRM_MSG_TYPE_NACK);
 		return ret;
 	}
 	nrm_msg_fill(ret, NRM_MSG_TYPE_ADD);
@@ -107,12 +260,9 @@ nrm_msg_t *nrm_server_add_actuator(nrm_server_t *self,
 	                                 nrm_msg_##type##_t *msg)              \
 	{                                                                      \
 		nrm_msg_t *ret = nrm_msg_create();                             \
-		nrm_##type##_t *r = nrm_##type##_create_frommsg(msg);          \
-                                                                               \
-		int err = nrm_state_add_##type(self->state, r);                \
-		if (err) {                                                     \
-			/* TODO: NACK */                                       \
-			nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);                   \
+		nrm_##type##_t *r = nrm_server_new_##type(self, NULL, msg);    \
+		if (r == NULL) {                                               \
+			nrm_msg_fill(ret, NRM_MSG_TYPE_NACK);                  \
 			return ret;                                            \
 		}                                                              \
 		nrm_msg_fill(ret, NRM_MSG_TYPE_ADD);                           \
@@ -124,51 +274,203 @@ NRM_SERVER_ADD_FUNC(scope)
 NRM_SERVER_ADD_FUNC(sensor)
 NRM_SERVER_ADD_FUNC(slice)
 
+/* a whole batch is added in a single reply, or not at all: the batch is
+ * checked before touching the state, and objects added before a failure are
+ * removed again. Items repeating a uuid, within the batch or from the state,
+ * resolve to the object already there.
+ */
+#define NRM_SERVER_ADD_LIST_FUNC(type, getuuid)                                \
+	static nrm_msg_t *nrm_server_add_##type##list(                         \
+	        nrm_server_t *self, nrm_uuid_t *clientid, size_t n,            \
+	        nrm_msg_##type##_t **items)                                    \
+	{                                                                      \
+		nrm_msg_t *ret = nrm_msg_create();                             \
+		nrm_vector_t *reply, *added;                                   \
+		nrm_vector_create(&reply, sizeof(nrm_##type##_t *));           \
+		nrm_vector_create(&added, sizeof(nrm_##type##_t *));           \
+		for (size_t i = 0; i < n; i++) {                               \
+			if (items[i]->uuid == NULL ||                          \
+			    items[i]->uuid[0] == '\0') {                       \
+				nrm_log_error("invalid " #type " in batch\n"); \
+				goto err;                                      \
+			}                                                      \
+		}                                                              \
+		for (size_t i = 0; i < n; i++) {                               \
+			void *known = nrm_server_find_uuid(                    \
+			        self->state->type##s, items[i]->uuid);         \
+			nrm_##type##_t *r =                                    \
+			        nrm_server_new_##type(self, clientid,          \
+			                              items[i]);               \
+			if (r == NULL)                                         \
+				goto err_rollback;                             \
+			if (known == NULL &&                                   \
+			    nrm_vector_push_back(added, &r)) {                 \
+				nrm_state_remove_##type(self->state,           \
+				                        getuuid(r));           \
+				goto err_rollback;                             \
+			}                                                      \
+			if (nrm_vector_push_back(reply, &r))                   \
+				goto err_rollback;                             \
+		}                                                              \
+		nrm_msg_fill(ret, NRM_MSG_TYPE_ADD);                           \
+		nrm_msg_set_add_##type##s(ret, reply);                         \
+		goto end;                                                      \
+	err_rollback:                                                          \
+		nrm_vector_foreach(added, iter)                                \
+		{                                                              \
+			nrm_##type##_t **r = nrm_vector_iterator_get(iter);    \
+			nrm_state_remove_##type(self->state, getuuid(*r));     \
+		}                                                              \
+	err:                                                                   \
+		nrm_msg_fill(ret, NRM_MSG_TYPE_NACK);                          \
+	end:                                                                   \
+		nrm_vector_destroy(&added);                                    \
+		nrm_vector_destroy(&reply);                                    \
+		return ret;                                                    \
+	}
+
+#define NRM_SERVER_UUID(object) ((object)->uuid)
+
+NRM_SERVER_ADD_LIST_FUNC(actuator, nrm_actuator_uuid)
+NRM_SERVER_ADD_LIST_FUNC(scope, NRM_SERVER_UUID)
+NRM_SERVER_ADD_LIST_FUNC(sensor, NRM_SERVER_UUID)
+NRM_SERVER_ADD_LIST_FUNC(slice, NRM_SERVER_UUID)
+
+nrm_msg_t *nrm_server_add_actuators(nrm_server_t *self,
+                                    nrm_uuid_t *clientid,
+                                    nrm_msg_actuatorlist_t *msg)
+{
+	return nrm_server_add_actuatorlist(self, clientid, msg->n_actuators,
+	                                   msg->actuators);
+}
+
+nrm_msg_t *nrm_server_add_scopes(nrm_server_t *self, nrm_msg_scopelist_t *msg)
+{
+	return nrm_server_add_scopelist(self, NULL, msg->n_scopes, msg->scopes);
+}
+
+nrm_msg_t *nrm_server_add_sensors(nrm_server_t *self,
+                                  nrm_msg_sensorlist_t *msg)
+{
+	return nrm_server_add_sensorlist(self, NULL, msg->n_sensors,
+	                                 msg->sensors);
+}
+
+nrm_msg_t *nrm_server_add_slices(nrm_server_t *self, nrm_msg_slicelist_t *msg)
+{
+	return nrm_server_add_slicelist(self, NULL, msg->n_slices, msg->slices);
+}
+
 int nrm_server_add_callback(nrm_server_t *self,
                             nrm_uuid_t *clientid,
                             nrm_msg_add_t *msg)
 {
 	nrm_msg_t *ret = NULL;
-	switch (msg->type) {
-	case NRM_MSG_TARGET_TYPE_ACTUATOR:
+	switch (msg->data_case) {
+	case NRM__ADD__DATA_ACTUATOR:
 		nrm_log_info("adding an actuator\n");
 		ret = nrm_server_add_actuator(self, clientid, msg->actuator);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
-	case NRM_MSG_TARGET_TYPE_SLICE:
+	case NRM__ADD__DATA_SLICE:
 		nrm_log_info("adding a slice\n");
 		ret = nrm_server_add_slice(self, msg->slice);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
-	case NRM_MSG_TARGET_TYPE_SENSOR:
+	case NRM__ADD__DATA_SENSOR:
 		nrm_log_info("adding a sensor\n");
 		ret = nrm_server_add_sensor(self, msg->sensor);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
-	case NRM_MSG_TARGET_TYPE_SCOPE:
+	case NRM__ADD__DATA_SCOPE:
 		nrm_log_info("adding a scope\n");
 		ret = nrm_server_add_scope(self, msg->scope);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
+	case NRM__ADD__DATA_ACTUATORS:
+		nrm_log_info("adding %zu actuators\n",
+		             msg->actuators->n_actuators);
+		ret = nrm_server_add_actuators(self, clientid, msg->actuators);
+		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+		break;
+	case NRM__ADD__DATA_SLICES:
+		nrm_log_info("adding %zu slices\n", msg->slices->n_slices);
+		ret = nrm_server_add_slices(self, msg->slices);
+		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+		break;
+	case NRM__ADD__DATA_SENSORS:
+		nrm_log_info("adding %zu sensors\n", msg->sensors->n_sensors);
+		ret = nrm_server_add_sensors(self, msg->sensors);
+		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+		break;
+	case NRM__ADD__DATA_SCOPES:
+		nrm_log_info("adding %zu scopes\n", msg->scopes->n_scopes);
+		ret = nrm_server_add_scopes(self, msg->scopes);
+		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+		break;
 	default:
 		nrm_log_error("wrong add request type %u\n", msg->type);
 		break;
 	}
 	if (ret == NULL)
 		return -1;
-	nrm_role_send(self->role, ret, clientid);
+	nrm_server_reply(self, ret, clientid);
 	/* we don't return an error here unless it's a failure of the server
 	 * code itself */
 	return 0;
 }
 
+static int nrm_server_list_match(nrm_msg_list_t *msg, const char *uuid)
+{
+	switch (msg->filter_case) {
+	case NRM_MSG_LIST_FILTER_UUID:
+		return !strcmp(msg->uuid, uuid);
+	case NRM_MSG_LIST_FILTER_PREFIX:
+		return !strncmp(msg->prefix, uuid, strlen(msg->prefix));
+	case NRM_MSG_LIST_FILTER_PATTERN:
+		return !fnmatch(msg->pattern, uuid, 0);
+	default:
+		return 1;
+	}
+}
+
+/* filter before building the reply, so that its size only depends on the
+ * number of matches. Exact uuids don't even need a scan.
+ */
+static void nrm_server_list_filter(nrm_hash_t *table,
+                                   nrm_msg_list_t *msg,
+                                   nrm_vector_t *vec)
+{
+	if (msg->filter_case == NRM_MSG_LIST_FILTER_UUID) {
+		void *obj = NULL;
+		nrm_string_t uuid = nrm_string_fromchar(msg->uuid);
+		nrm_hash_find(table, uuid, &obj);
+		nrm_string_decref(uuid);
+		if (obj != NULL)
+			nrm_vector_push_back(vec, obj);
+		return;
+	}
+	nrm_hash_foreach(table, iter)
+	{
+		nrm_string_t uuid = nrm_hash_iterator_get_uuid(iter);
+		if (nrm_server_list_match(msg, uuid))
+			nrm_vector_push_back(vec, nrm_hash_iterator_get(iter));
+	}
+}
+
 #define NRM_SERVER_LIST_FUNC(type)                                             \
-	nrm_msg_t *nrm_server_list_##type##s(nrm_server_t *self)               \
+	nrm_msg_t *nrm_server_list_##type##s(nrm_server_t *self,               \
+	                                     nrm_msg_list_t *msg)              \
 	{                                                                      \
 		nrm_msg_t *ret = nrm_msg_create();                             \
 		nrm_vector_t *vec;                                             \
 		nrm_vector_create(&vec, sizeof(nrm_##type##_t));               \
-		int err = nrm_state_list_##type##s(self->state, vec);          \
+		int err = 0;                                                   \
+		if (msg->filter_case == NRM_MSG_LIST_FILTER_NONE)              \
+			err = nrm_state_list_##type##s(self->state, vec);      \
+		else                                                           \
+			nrm_server_list_filter(self->state->type##s, msg,      \
+			                       vec);                           \
 		if (err) {                                                     \
 			/* TODO: NACK */                                       \
 			nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);                   \
@@ -194,22 +496,22 @@ int nrm_server_list_callback(nrm_server_t *self,
 	switch (msg->type) {
 	case NRM_MSG_TARGET_TYPE_ACTUATOR:
 		nrm_log_info("listing actuators\n");
-		ret = nrm_server_list_actuators(self);
+		ret = nrm_server_list_actuators(self, msg);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
 	case NRM_MSG_TARGET_TYPE_SLICE:
 		nrm_log_info("listing slices\n");
-		ret = nrm_server_list_slices(self);
+		ret = nrm_server_list_slices(self, msg);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
 	case NRM_MSG_TARGET_TYPE_SENSOR:
 		nrm_log_info("listing sensors\n");
-		ret = nrm_server_list_sensors(self);
+		ret = nrm_server_list_sensors(self, msg);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
 	case NRM_MSG_TARGET_TYPE_SCOPE:
 		nrm_log_info("listing scopes\n");
-		ret = nrm_server_list_scopes(self);
+		ret = nrm_server_list_scopes(self, msg);
 		nrm_log_printmsg(NRM_LOG_DEBUG, ret);
 		break;
 	default:
@@ -218,27 +520,33 @@ int nrm_server_list_callback(nrm_server_t *self,
 	}
 	if (ret == NULL)
 		return -1;
-	nrm_role_send(self->role, ret, clientid);
+	nrm_server_reply(self, ret, clientid);
 	/* we don't return an error here unless it's a failure of the server
 	 * code itself */
 	return 0;
 }
 
-#define NRM_SERVER_REMOVE_FUNC(type)                                           \
+#define NRM_SERVER_REMOVE_FUNC(type, TYPE)                                     \
 	nrm_msg_t *nrm_server_remove_##type(nrm_server_t *self,                \
 	                                    const char *uuid)                  \
 	{                                                                      \
 		nrm_msg_t *ret = nrm_msg_create();                             \
 		nrm_state_remove_##type(self->state, uuid);                    \
+		if (self->callbacks.remove != NULL) {                          \
+			nrm_string_t id = nrm_string_fromchar(uuid);           \
+			int t = NRM_MSG_TARGET_TYPE_##TYPE;                    \
+			self->callbacks.remove(self, t, id);                   \
+			nrm_string_decref(id);                                 \
+		}                                                              \
 		/* TODO: NACK */                                               \
 		nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);                           \
 		return ret;                                                    \
 	}
 
-NRM_SERVER_REMOVE_FUNC(actuator)
-NRM_SERVER_REMOVE_FUNC(scope)
-NRM_SERVER_REMOVE_FUNC(sensor)
-NRM_SERVER_REMOVE_FUNC(slice)
+NRM_SERVER_REMOVE_FUNC(actuator, ACTUATOR)
+NRM_SERVER_REMOVE_FUNC(scope, SCOPE)
+NRM_SERVER_REMOVE_FUNC(sensor, SENSOR)
+NRM_SERVER_REMOVE_FUNC(slice, SLICE)
 
 int nrm_server_remove_callback(nrm_server_t *self,
                                nrm_uuid_t *clientid,
@@ -272,17 +580,38 @@ int nrm_server_remove_callback(nrm_server_t *self,
 	}
 	if (ret == NULL)
 		return -1;
-	nrm_role_send(self->role, ret, clientid);
+	nrm_server_reply(self, ret, clientid);
 	/* we don't return an error here unless it's a failure of the server
 	 * code itself */
 	return 0;
 }
 
+int nrm_server_resolve_callback(nrm_server_t *self,
+                                nrm_uuid_t *clientid,
+                                nrm_msg_scope_t *msg)
+{
+	nrm_msg_t *ret = nrm_msg_create();
+	nrm_msg_fill(ret, NRM_MSG_TYPE_RESOLVE);
+	if (msg != NULL) {
+		nrm_log_info("resolving a scope\n");
+		nrm_scope_t *scope = nrm_scope_create_frommsg(msg);
+		if (scope != NULL) {
+			nrm_scope_t *match =
+			        nrm_state_resolve_scope(self->state, scope);
+			nrm_msg_set_resolve(ret, match);
+			nrm_scope_destroy(scope);
+		}
+	}
+	nrm_log_printmsg(NRM_LOG_DEBUG, ret);
+	nrm_server_reply(self, ret, clientid);
+	return 0;
+}
+
 int nrm_server_exit_callback(nrm_server_t *self, nrm_uuid_t *uuid)
 {
 	nrm_msg_t *ret = nrm_msg_create();
 	nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);
-	nrm_role_send(self->role, ret, uuid);
+	nrm_server_reply(self, ret, uuid);
 	/* trigger exit */
 	return -1;
 }
@@ -294,7 +623,7 @@ int nrm_server_tick_callback(nrm_server_t *self, nrm_uuid_t *uuid)
 		err = self->callbacks.tick(self);
 	nrm_msg_t *ret = nrm_msg_create();
 	nrm_msg_fill(ret, NRM_MSG_TYPE_ACK);
-	nrm_role_send(self->role, ret, uuid);
+	nrm_server_reply(self, ret, uuid);
 	return err;
 }
 
@@ -308,9 +637,15 @@ int nrm_server_role_callback(zloop_t *loop, zsock_t *socket, void *arg)
 	nrm_uuid_t *uuid;
 	nrm_log_debug("receiving message...\n");
 	msg = nrm_role_recv(self->role, &uuid);
+	if (msg == NULL) {
+		/* only happens when interrupted, stop the loop */
+		nrm_log_error("failed to receive a message\n");
+		return -1;
+	}
 	nrm_log_printmsg(NRM_LOG_DEBUG, msg);
 
 	int err;
+	self->reqid = msg->id;
 	switch (msg->type) {
 	case NRM_MSG_TYPE_ACTUATE:
 		err = nrm_server_actuate_callback(self, uuid, msg->actuate);
@@ -333,6 +668,9 @@ int nrm_server_role_callback(zloop_t *loop, zsock_t *socket, void *arg)
 	case NRM_MSG_TYPE_TICK:
 		err = nrm_server_tick_callback(self, uuid);
 		break;
+	case NRM_MSG_TYPE_RESOLVE:
+		err = nrm_server_resolve_callback(self, uuid, msg->resolve);
+		break;
 	default:
 		nrm_log_error("message type not handled\n");
 		return -NRM_EINVAL;
@@ -459,16 +797,35 @@ int nrm_server_publish(nrm_server_t *server,
                        nrm_string_t sensor_uuid,
                        nrm_scope_t *scope,
                        double value)
+{
+	nrm_event_t event = {nrm_time_tons(&now), value};
+	return nrm_server_publish_events(server, topic, sensor_uuid, scope,
+	                                 &event, 1);
+}
+
+int nrm_server_publish_events(nrm_server_t *server,
+                              nrm_string_t topic,
+                              nrm_string_t sensor_uuid,
+                              nrm_scope_t *scope,
+                              const nrm_event_t *events,
+                              size_t nevents)
 {
 	if (server == NULL || topic == NULL || sensor_uuid == NULL ||
-	    scope == NULL)
+	    scope == NULL || (events == NULL && nevents != 0))
 		return -NRM_EINVAL;
 
 	nrm_timeserie_t *timeserie;
 	nrm_timeserie_create(&timeserie, sensor_uuid, scope);
 	assert(timeserie != NULL);
-
-	nrm_timeserie_add_event(timeserie, now, value);
+	/* subscribers do not share the ids of the state, the scope always goes
+	 * out whole
+	 */
+	timeserie->scope_id = 0;
+
+	for (size_t i = 0; i < nevents; i++)
+		nrm_timeserie_add_event(timeserie,
+		                        nrm_time_fromns(events[i].time),
+		                        events[i].value);
 	nrm_vector_t *timeseries;
 	nrm_vector_create(&timeseries, sizeof(nrm_timeserie_t *));
 	nrm_vector_push_back(timeseries, &timeserie);
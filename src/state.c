@@ -21,9 +21,166 @@
 nrm_state_t *nrm_state_create()
 {
 	nrm_state_t *ret = calloc(1, sizeof(nrm_state_t));
+	if (ret == NULL)
+		return NULL;
+
+	/* id 0 means not interned, burn it */
+	void *none = NULL;
+	if (nrm_vector_create(&ret->sensorids, sizeof(void *)) ||
+	    nrm_vector_create(&ret->scopeids, sizeof(void *)) ||
+	    nrm_vector_push_back(ret->sensorids, &none) ||
+	    nrm_vector_push_back(ret->scopeids, &none)) {
+		nrm_vector_destroy(&ret->sensorids);
+		nrm_vector_destroy(&ret->scopeids);
+		free(ret);
+		return NULL;
+	}
 	return ret;
 }
 
+/* give the next id to an object, ids are never reused so that stale ones
+ * can't point to the wrong object.
+ */
+static int nrm_state_intern(nrm_vector_t *ids, void *ptr, size_t *id)
+{
+	size_t len;
+	nrm_vector_length(ids, &len);
+	int err = nrm_vector_push_back(ids, &ptr);
+	if (err)
+		return err;
+	*id = len;
+	return 0;
+}
+
+static void nrm_state_unintern(nrm_vector_t *ids, size_t id)
+{
+	void **slot = NULL;
+	if (id == 0)
+		return;
+	nrm_vector_get(ids, id, (void **)&slot);
+	if (slot != NULL)
+		*slot = NULL;
+}
+
+static void *nrm_state_get_byid(nrm_vector_t *ids, size_t id)
+{
+	void **slot = NULL;
+	if (id == 0)
+		return NULL;
+	nrm_vector_get(ids, id, (void **)&slot);
+	return slot != NULL ? *slot : NULL;
+}
+
+nrm_sensor_t *nrm_state_get_sensor(nrm_state_t *state, size_t id)
+{
+	return nrm_state_get_byid(state->sensorids, id);
+}
+
+nrm_scope_t *nrm_state_get_scope(nrm_state_t *state, size_t id)
+{
+	return nrm_state_get_byid(state->scopeids, id);
+}
+
+/* scopes are also indexed by content, the key listing the non-zero words of
+ * each bitmap. Only the oldest scope for a given key is in the index.
+ */
+struct nrm_state_scopekey_s {
+	nrm_string_t key;
+	nrm_scope_t *scope;
+};
+
+/* "word:mask," takes at most 20 characters, plus a separator per type */
+#define NRM_STATE_SCOPEKEY_SIZE                                                \
+	(NRM_SCOPE_TYPE_MAX * (NRM_BITMAP_SIZE * 20 + 1) + 1)
+
+static nrm_string_t nrm_state_scope_key(const nrm_scope_t *scope)
+{
+	char buf[NRM_STATE_SCOPEKEY_SIZE];
+	size_t len = 0;
+	for (int i = 0; i < NRM_SCOPE_TYPE_MAX; i++) {
+		const struct nrm_bitmap *map = &scope->maps[i];
+		for (size_t w = 0; w < NRM_BITMAP_SIZE; w++) {
+			if (map->mask[w] == 0)
+				continue;
+			len += snprintf(buf + len, sizeof(buf) - len,
+			                "%zx:%lx,", w, map->mask[w]);
+		}
+		buf[len++] = '|';
+	}
+	return nrm_string_frombuf(buf, len);
+}
+
+static int nrm_state_index_scope(nrm_state_t *state, nrm_scope_t *scope)
+{
+	struct nrm_state_scopekey_s *e = NULL;
+	nrm_string_t key = nrm_state_scope_key(scope);
+	if (key == NULL)
+		return -NRM_ENOMEM;
+	nrm_hash_find(state->scopekeys, key, (void *)&e);
+	if (e != NULL) {
+		nrm_string_decref(key);
+		return 0;
+	}
+	e = malloc(sizeof(struct nrm_state_scopekey_s));
+	if (e == NULL) {
+		nrm_string_decref(key);
+		return -NRM_ENOMEM;
+	}
+	e->key = key;
+	e->scope = scope;
+	int err = nrm_hash_add(&state->scopekeys, key, e);
+	if (err) {
+		nrm_string_decref(key);
+		free(e);
+	}
+	return err;
+}
+
+/* must be called once the scope is out of state->scopes */
+static void nrm_state_unindex_scope(nrm_state_t *state, nrm_scope_t *scope)
+{
+	struct nrm_state_scopekey_s *e = NULL;
+	nrm_string_t key = nrm_state_scope_key(scope);
+	if (key == NULL)
+		return;
+	nrm_hash_find(state->scopekeys, key, (void *)&e);
+	if (e == NULL || e->scope != scope)
+		goto end;
+
+	/* hand the entry over to the next oldest scope with the same content,
+	 * removals are rare enough for a scan.
+	 */
+	e->scope = NULL;
+	nrm_hash_foreach(state->scopes, iter)
+	{
+		nrm_scope_t *s = nrm_hash_iterator_get(iter);
+		if (!nrm_scope_cmp(s, scope)) {
+			e->scope = s;
+			break;
+		}
+	}
+	if (e->scope == NULL) {
+		nrm_hash_remove(&state->scopekeys, key, (void *)&e);
+		nrm_string_decref(e->key);
+		free(e);
+	}
+end:
+	nrm_string_decref(key);
+}
+
+nrm_scope_t *nrm_state_resolve_scope(nrm_state_t *state, nrm_scope_t *scope)
+{
+	struct nrm_state_scopekey_s *e = NULL;
+	if (state == NULL || scope == NULL)
+		return NULL;
+	nrm_string_t key = nrm_state_scope_key(scope);
+	if (key == NULL)
+		return NULL;
+	nrm_hash_find(state->scopekeys, key, (void *)&e);
+	nrm_string_decref(key);
+	return e != NULL ? e->scope : NULL;
+}
+
 int nrm_state_remove_actuator(nrm_state_t *state, const char *uuid)
 {
 	nrm_actuator_t *actuator = NULL;
@@ -39,7 +196,11 @@ int nrm_state_remove_scope(nrm_state_t *state, const char *uuid)
 	nrm_scope_t *scope = NULL;
 	nrm_string_t id = nrm_string_fromchar(uuid);
 	nrm_hash_remove(&state->scopes, id, (void *)&scope);
-	nrm_scope_destroy(scope);
+	if (scope != NULL) {
+		nrm_state_unintern(state->scopeids, scope->id);
+		nrm_state_unindex_scope(state, scope);
+		nrm_scope_destroy(scope);
+	}
 	nrm_string_decref(id);
 	return 0;
 }
@@ -49,6 +210,8 @@ int nrm_state_remove_sensor(nrm_state_t *state, const char *uuid)
 	nrm_sensor_t *sensor = NULL;
 	nrm_string_t id = nrm_string_fromchar(uuid);
 	nrm_hash_remove(&state->sensors, id, (void *)&sensor);
+	if (sensor != NULL)
+		nrm_state_unintern(state->sensorids, sensor->id);
 	nrm_sensor_destroy(&sensor);
 	nrm_string_decref(id);
 	return 0;
@@ -106,26 +269,46 @@ int nrm_state_list_slices(nrm_state_t *state, nrm_vector_t *vec)
 
 int nrm_state_add_actuator(nrm_state_t *state, nrm_actuator_t *actuator)
 {
-	nrm_hash_add(&state->actuators, nrm_actuator_uuid(actuator), actuator);
-	return 0;
+	return nrm_hash_add(&state->actuators, nrm_actuator_uuid(actuator),
+	                    actuator);
 }
 
 int nrm_state_add_scope(nrm_state_t *state, nrm_scope_t *scope)
 {
-	nrm_hash_add(&state->scopes, scope->uuid, scope);
+	void *tmp;
+	int err = nrm_hash_add(&state->scopes, scope->uuid, scope);
+	if (err)
+		return err;
+	err = nrm_state_intern(state->scopeids, scope, &scope->id);
+	if (err)
+		goto err_hash;
+	err = nrm_state_index_scope(state, scope);
+	if (err)
+		goto err_intern;
 	return 0;
+err_intern:
+	nrm_state_unintern(state->scopeids, scope->id);
+	scope->id = 0;
+err_hash:
+	nrm_hash_remove(&state->scopes, scope->uuid, &tmp);
+	return err;
 }
 
 int nrm_state_add_sensor(nrm_state_t *state, nrm_sensor_t *sensor)
 {
-	nrm_hash_add(&state->sensors, sensor->uuid, sensor);
-	return 0;
+	void *tmp;
+	int err = nrm_hash_add(&state->sensors, sensor->uuid, sensor);
+	if (err)
+		return err;
+	err = nrm_state_intern(state->sensorids, sensor, &sensor->id);
+	if (err)
+		nrm_hash_remove(&state->sensors, sensor->uuid, &tmp);
+	return err;
 }
 
 int nrm_state_add_slice(nrm_state_t *state, nrm_slice_t *slice)
 {
-	nrm_hash_add(&state->slices, slice->uuid, slice);
-	return 0;
+	return nrm_hash_add(&state->slices, slice->uuid, slice);
 }
 
 void nrm_state_destroy(nrm_state_t **state)
@@ -162,6 +345,16 @@ void nrm_state_destroy(nrm_state_t **state)
 	}
 	nrm_hash_destroy(&s->scopes);
 
+	nrm_hash_foreach(s->scopekeys, iter)
+	{
+		struct nrm_state_scopekey_s *e = nrm_hash_iterator_get(iter);
+		nrm_string_decref(e->key);
+		free(e);
+	}
+	nrm_hash_destroy(&s->scopekeys);
+
+	nrm_vector_destroy(&s->sensorids);
+	nrm_vector_destroy(&s->scopeids);
 	free(s);
 	*state = NULL;
 }
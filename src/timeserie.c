@@ -32,7 +32,7 @@ int nrm_timeserie_create(nrm_timeserie_t **ts,
 	t->sensor_uuid = sensor_uuid;
 	nrm_string_incref(sensor_uuid);
 	t->scope = scope;
-	t->start = nrm_time_fromns(0);
+	t->start = 0;
 
 	int err = nrm_vector_create(&t->events, sizeof(nrm_event_t));
 	if (err)
@@ -62,12 +62,12 @@ int nrm_timeserie_add_event(nrm_timeserie_t *ts, nrm_time_t time, double val)
 		return -NRM_EINVAL;
 
 	nrm_event_t e;
-	e.time = time;
+	e.time = nrm_time_tons(&time);
 	e.value = val;
 	nrm_vector_push_back(ts->events, &e);
 
-	if (nrm_time_tons(&ts->start) < nrm_time_tons(&time))
-		ts->start = time;
+	if (ts->start < e.time)
+		ts->start = e.time;
 	return 0;
 }
 
@@ -79,7 +79,9 @@ int nrm_timeserie_add_events(nrm_timeserie_t *ts, nrm_vector_t *events)
 	nrm_vector_foreach(events, iter)
 	{
 		nrm_event_t *e = nrm_vector_iterator_get(iter);
-		nrm_timeserie_add_event(ts, e->time, e->value);
+		nrm_vector_push_back(ts->events, e);
+		if (ts->start < e->time)
+			ts->start = e->time;
 	}
 	return 0;
 }
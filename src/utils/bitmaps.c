@@ -143,19 +143,19 @@ char *nrm_bitmap_to_string(const struct nrm_bitmap *bitmap)
 	return buf;
 }
 
+/* bitmaps are printed as [start, length] pairs, one per run of bits set */
 json_t *nrm_bitmap_to_json(struct nrm_bitmap *bitmap)
 {
 	json_t *ret;
-	size_t size = nrm_bitmap_nset(bitmap);
+	int32_t ranges[NRM_BITMAP_MAX];
+	size_t size = nrm_bitmap_nranges(bitmap);
 
+	nrm_bitmap_to_ranges(bitmap, ranges);
 	ret = json_array();
-	for (size_t i = 0, printed = 0; i < NRM_BITMAP_MAX && printed < size;
-	     i++) {
-		if (nrm_bitmap_isset(bitmap, i)) {
-			json_t *val = json_integer(i);
-			json_array_append_new(ret, val);
-			printed++;
-		}
+	for (size_t i = 0; i < size; i++) {
+		json_t *val = json_pack("[i, i]", ranges[2 * i],
+		                        ranges[2 * i + 1]);
+		json_array_append_new(ret, val);
 	}
 	return ret;
 }
@@ -182,10 +182,71 @@ int nrm_bitmap_from_array(struct nrm_bitmap *map, size_t nitems, int32_t *items)
 {
 	nrm_bitmap_reset(map);
 	for (size_t i = 0; i < nitems; i++)
-		nrm_bitmap_set(map, items[i]);
+		if (items[i] < 0 || nrm_bitmap_set(map, items[i]))
+			return -NRM_EINVAL;
+	return 0;
+}
+
+int nrm_bitmap_nranges(const struct nrm_bitmap *bitmap)
+{
+	int nranges = 0;
+	unsigned long carry = 0;
+
+	if (bitmap == NULL)
+		return -1;
+
+	/* count the bits set right after a bit that isn't */
+	for (size_t n = 0; n < NRM_BITMAP_SIZE; n++) {
+		unsigned long b = bitmap->mask[n];
+		nranges += __builtin_popcountl(b & ~((b << 1) | carry));
+		carry = b >> (NRM_BITMAP_NBITS - 1);
+	}
+	return nranges;
+}
+
+int nrm_bitmap_to_ranges(const struct nrm_bitmap *bitmap, int32_t *items)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	while (i < NRM_BITMAP_MAX) {
+		/* skip empty words */
+		if (NRM_BITMAP_ITH(i) == 0 &&
+		    bitmap->mask[NRM_BITMAP_NTH(i)] == NRM_BITMAP_EMPTY) {
+			i += NRM_BITMAP_NBITS;
+			continue;
+		}
+		if (!nrm_bitmap_isset(bitmap, i)) {
+			i++;
+			continue;
+		}
+		size_t start = i;
+		while (i < NRM_BITMAP_MAX && nrm_bitmap_isset(bitmap, i))
+			i++;
+		items[n++] = start;
+		items[n++] = i - start;
+	}
+	return 0;
+}
+
+int nrm_bitmap_from_ranges(struct nrm_bitmap *map,
+                           size_t nitems,
+                           int32_t *items)
+{
+	if (nitems % 2 != 0)
+		return -NRM_EINVAL;
+	nrm_bitmap_reset(map);
+	for (size_t i = 0; i < nitems; i += 2) {
+		if (items[i] < 0 || items[i + 1] < 0 ||
+		    (int64_t)items[i] + items[i + 1] > NRM_BITMAP_MAX)
+			return -NRM_EINVAL;
+		for (int32_t j = 0; j < items[i + 1]; j++)
+			nrm_bitmap_set(map, items[i] + j);
+	}
 	return 0;
 }
 
+/* each item is either an index or a [start, length] pair */
 int nrm_bitmap_from_json(struct nrm_bitmap *bitmap, json_t *json)
 {
 	if (!json_is_array(json))
@@ -196,8 +257,16 @@ int nrm_bitmap_from_json(struct nrm_bitmap *bitmap, json_t *json)
 	nrm_bitmap_reset(bitmap);
 	json_array_foreach(json, index, value)
 	{
-		json_int_t i = json_integer_value(value);
-		nrm_bitmap_set(bitmap, i);
+		json_int_t start, length = 1;
+		if (json_is_array(value)) {
+			if (json_unpack(value, "[I, I]", &start, &length))
+				return -NRM_EINVAL;
+		} else
+			start = json_integer_value(value);
+		if (start < 0 || length < 0 || start + length > NRM_BITMAP_MAX)
+			return -NRM_EINVAL;
+		for (json_int_t i = 0; i < length; i++)
+			nrm_bitmap_set(bitmap, start + i);
 	}
 	return 0;
 }
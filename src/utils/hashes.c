@@ -52,10 +52,11 @@ int nrm_hash_remove(nrm_hash_t **hash_table, nrm_string_t uuid, void **ptr)
 		return -NRM_EINVAL;
 
 	nrm_hash_t *tmp;
-	HASH_FIND(hh, (*hash_table), &uuid, nrm_string_strlen(uuid), tmp);
+	HASH_FIND(hh, (*hash_table), uuid, nrm_string_strlen(uuid), tmp);
 
-	*ptr = tmp;
+	*ptr = NULL;
 	if (tmp != NULL) {
+		*ptr = tmp->ptr;
 		HASH_DEL((*hash_table), tmp);
 		free(tmp);
 	}
@@ -0,0 +1,237 @@
+/*******************************************************************************
+ * Copyright 2019 UChicago Argonne, LLC.
+ * (c.f. AUTHORS, LICENSE)
+ *
+ * This file is part of the libnrm project.
+ * For more info, see https://github.com/anlsys/libnrm
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ ******************************************************************************/
+
+#include "nrm.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* values closer to zero than this are counted as zero */
+#define NRM_SKETCH_MIN_VALUE 1e-9
+
+/* maximum number of bins per store: at 1% accuracy this covers more than 17
+ * orders of magnitude, beyond that the lowest bins are collapsed together.
+ */
+#define NRM_SKETCH_MAX_BINS 2048
+
+/* bin i counts the values in (gamma^(i-1), gamma^i] */
+struct nrm_sketch_store {
+	int offset;
+	size_t length;
+	uint64_t *bins;
+};
+
+struct nrm_sketch_s {
+	double accuracy;
+	double gamma;
+	double lngamma;
+	uint64_t count;
+	uint64_t zeros;
+	/* positive values, and absolute value of negative ones */
+	struct nrm_sketch_store positives;
+	struct nrm_sketch_store negatives;
+};
+
+int nrm_sketch_create(nrm_sketch_t **sketch, double accuracy)
+{
+	if (sketch == NULL || !(accuracy > 0.0 && accuracy < 1.0))
+		return -NRM_EINVAL;
+
+	nrm_sketch_t *ret = calloc(1, sizeof(nrm_sketch_t));
+	if (ret == NULL)
+		return -NRM_ENOMEM;
+
+	ret->accuracy = accuracy;
+	ret->gamma = (1.0 + accuracy) / (1.0 - accuracy);
+	ret->lngamma = log(ret->gamma);
+	*sketch = ret;
+	return NRM_SUCCESS;
+}
+
+/* grow the store to cover bins [lo, hi], hi being at least the current
+ * highest bin. Anything below lo ends up in lo.
+ */
+static int nrm_sketch_store_resize(struct nrm_sketch_store *s, int lo, int hi)
+{
+	size_t length = hi - lo + 1;
+	uint64_t *bins = calloc(length, sizeof(uint64_t));
+	if (bins == NULL)
+		return -NRM_ENOMEM;
+
+	for (size_t i = 0; i < s->length; i++) {
+		int idx = s->offset + (int)i;
+		bins[(idx < lo ? lo : idx) - lo] += s->bins[i];
+	}
+	free(s->bins);
+	s->bins = bins;
+	s->offset = lo;
+	s->length = length;
+	return NRM_SUCCESS;
+}
+
+static int
+nrm_sketch_store_add(struct nrm_sketch_store *s, int idx, uint64_t count)
+{
+	int lo = idx, hi = idx;
+	if (s->length != 0) {
+		int top = s->offset + (int)s->length - 1;
+		if (idx >= s->offset && idx <= top) {
+			s->bins[idx - s->offset] += count;
+			return NRM_SUCCESS;
+		}
+		lo = idx < s->offset ? idx : s->offset;
+		hi = idx > top ? idx : top;
+	}
+
+	/* we care more about high values, collapse the low ones */
+	if (hi - lo + 1 > NRM_SKETCH_MAX_BINS)
+		lo = hi - NRM_SKETCH_MAX_BINS + 1;
+	if (idx < lo)
+		idx = lo;
+
+	int err = nrm_sketch_store_resize(s, lo, hi);
+	if (err)
+		return err;
+	s->bins[idx - s->offset] += count;
+	return NRM_SUCCESS;
+}
+
+static inline int nrm_sketch_index(const nrm_sketch_t *sketch, double value)
+{
+	return (int)ceil(log(value) / sketch->lngamma);
+}
+
+/* the value with the lowest relative error to anything in the bin */
+static inline double nrm_sketch_value(const nrm_sketch_t *sketch, int idx)
+{
+	return 2.0 * pow(sketch->gamma, idx) / (sketch->gamma + 1.0);
+}
+
+int nrm_sketch_add(nrm_sketch_t *sketch, double value)
+{
+	int err = NRM_SUCCESS;
+	if (sketch == NULL || isnan(value))
+		return -NRM_EINVAL;
+
+	if (value > NRM_SKETCH_MIN_VALUE)
+		err = nrm_sketch_store_add(&sketch->positives,
+		                           nrm_sketch_index(sketch, value), 1);
+	else if (value < -NRM_SKETCH_MIN_VALUE)
+		err = nrm_sketch_store_add(&sketch->negatives,
+		                           nrm_sketch_index(sketch, -value), 1);
+	else
+		sketch->zeros++;
+	if (err)
+		return err;
+	sketch->count++;
+	return NRM_SUCCESS;
+}
+
+static int nrm_sketch_store_merge(struct nrm_sketch_store *dst,
+                                  const struct nrm_sketch_store *src)
+{
+	for (size_t i = 0; i < src->length; i++) {
+		if (src->bins[i] == 0)
+			continue;
+		int err = nrm_sketch_store_add(dst, src->offset + (int)i,
+		                               src->bins[i]);
+		if (err)
+			return err;
+	}
+	return NRM_SUCCESS;
+}
+
+int nrm_sketch_merge(nrm_sketch_t *dst, const nrm_sketch_t *src)
+{
+	if (dst == NULL || src == NULL || dst->accuracy != src->accuracy)
+		return -NRM_EINVAL;
+
+	int err = nrm_sketch_store_merge(&dst->positives, &src->positives);
+	if (err)
+		return err;
+	err = nrm_sketch_store_merge(&dst->negatives, &src->negatives);
+	if (err)
+		return err;
+	dst->zeros += src->zeros;
+	dst->count += src->count;
+	return NRM_SUCCESS;
+}
+
+int nrm_sketch_count(const nrm_sketch_t *sketch, size_t *count)
+{
+	if (sketch == NULL || count == NULL)
+		return -NRM_EINVAL;
+	*count = sketch->count;
+	return NRM_SUCCESS;
+}
+
+int nrm_sketch_quantile(const nrm_sketch_t *sketch, double q, double *value)
+{
+	if (sketch == NULL || value == NULL || !(q >= 0.0 && q <= 1.0))
+		return -NRM_EINVAL;
+	if (sketch->count == 0)
+		return -NRM_EDOM;
+
+	/* walk the bins in increasing value order: negatives from the largest
+	 * magnitude, zeros, then positives.
+	 */
+	uint64_t rank = (uint64_t)(q * (sketch->count - 1));
+	uint64_t seen = 0;
+	const struct nrm_sketch_store *s = &sketch->negatives;
+	for (size_t i = s->length; i > 0; i--) {
+		seen += s->bins[i - 1];
+		if (seen > rank) {
+			*value = -nrm_sketch_value(sketch,
+			                           s->offset + (int)i - 1);
+			return NRM_SUCCESS;
+		}
+	}
+	seen += sketch->zeros;
+	if (seen > rank) {
+		*value = 0.0;
+		return NRM_SUCCESS;
+	}
+	s = &sketch->positives;
+	for (size_t i = 0; i < s->length; i++) {
+		seen += s->bins[i];
+		if (seen > rank) {
+			*value = nrm_sketch_value(sketch, s->offset + (int)i);
+			return NRM_SUCCESS;
+		}
+	}
+	/* unreachable if the counts are consistent */
+	return -NRM_FAILURE;
+}
+
+int nrm_sketch_clear(nrm_sketch_t *sketch)
+{
+	if (sketch == NULL)
+		return -NRM_EINVAL;
+
+	/* keep the bins allocated, the next values are likely to need them */
+	for (size_t i = 0; i < sketch->positives.length; i++)
+		sketch->positives.bins[i] = 0;
+	for (size_t i = 0; i < sketch->negatives.length; i++)
+		sketch->negatives.bins[i] = 0;
+	sketch->zeros = 0;
+	sketch->count = 0;
+	return NRM_SUCCESS;
+}
+
+void nrm_sketch_destroy(nrm_sketch_t **sketch)
+{
+	if (sketch == NULL || *sketch == NULL)
+		return;
+
+	free((*sketch)->positives.bins);
+	free((*sketch)->negatives.bins);
+	free(*sketch);
+	*sketch = NULL;
+}
@@ -48,7 +48,7 @@ utarray_error:
 
 void nrm_vector_destroy(nrm_vector_t **vector)
 {
-	if (vector == NULL)
+	if (vector == NULL || *vector == NULL)
 		return;
 
 	utarray_free((*vector)->array);
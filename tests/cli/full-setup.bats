@@ -36,6 +36,14 @@ setup_file() {
 	echo "$output" | jq .[0].uuid | grep "nrm-dummy-extra-sensor"
 }
 
+@test "find dummy sensor by prefix" {
+	run -0 --separate-stderr $LOG_COMPILER $LOG_FLAGS $ABS_TOP_BUILDDIR/nrmc find-sensor --prefix "nrm-dummy-extra"
+	echo "$output" | jq .[0].uuid | grep "nrm-dummy-extra-sensor"
+	# nothing else should come back
+	run -0 --separate-stderr $LOG_COMPILER $LOG_FLAGS $ABS_TOP_BUILDDIR/nrmc find-sensor --prefix "no-such-sensor"
+	test "$(echo "$output" | jq length)" -eq 0
+}
+
 @test "list dummy actuator" {
 	# can we list actuators
 	run -0 --separate-stderr $LOG_COMPILER $LOG_FLAGS $ABS_TOP_BUILDDIR/nrmc list-actuators
@@ -0,0 +1,633 @@
+/*******************************************************************************
+ * Copyright 2019 UChicago Argonne, LLC.
+ * (c.f. AUTHORS, LICENSE)
+ *
+ * This file is part of the libnrm project.
+ * For more info, see https://github.com/anlsys/libnrm
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ ******************************************************************************/
+
+#include <check.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nrm.h"
+
+#include "internal/messages.h"
+#include "internal/nrmi.h"
+
+/* fixtures: a client talking to sockets the test drives as the daemon */
+nrm_client_t *client;
+zsock_t *rpc, *pub;
+
+void setup_fake(void)
+{
+	/* the daemon side must exist before the client connects */
+	ck_assert_int_eq(nrm_net_rpc_server_init(&rpc), 0);
+	ck_assert_int_eq(nrm_net_bind_2(rpc, NRM_DEFAULT_UPSTREAM_URI,
+	                                NRM_DEFAULT_UPSTREAM_RPC_PORT),
+	                 0);
+	ck_assert_int_eq(nrm_net_pub_init(&pub), 0);
+	ck_assert_int_eq(nrm_net_bind_2(pub, NRM_DEFAULT_UPSTREAM_URI,
+	                                NRM_DEFAULT_UPSTREAM_PUB_PORT),
+	                 0);
+	ck_assert_int_eq(nrm_client_create(&client, NRM_DEFAULT_UPSTREAM_URI,
+	                                   NRM_DEFAULT_UPSTREAM_PUB_PORT,
+	                                   NRM_DEFAULT_UPSTREAM_RPC_PORT),
+	                 0);
+}
+
+void teardown_fake(void)
+{
+	nrm_client_destroy(&client);
+	zsock_destroy(&rpc);
+	zsock_destroy(&pub);
+}
+
+/* fixtures: a client talking to a real server running in a thread */
+nrm_state_t *state;
+nrm_server_t *server;
+pthread_t server_thread;
+
+/* the events the daemon received so far, and the last scope they were for */
+pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t seen_cond = PTHREAD_COND_INITIALIZER;
+size_t seen;
+char seen_scope[256];
+
+static int daemon_events(nrm_server_t *self,
+                         nrm_sensor_t *sensor,
+                         nrm_scope_t *scope,
+                         const nrm_event_t *events,
+                         size_t n)
+{
+	pthread_mutex_lock(&seen_lock);
+	snprintf(seen_scope, sizeof(seen_scope), "%s", scope->uuid);
+	seen += n;
+	pthread_cond_broadcast(&seen_cond);
+	pthread_mutex_unlock(&seen_lock);
+	return 0;
+}
+
+/* wait a second at most for the daemon to have received n events */
+static size_t daemon_wait_events(size_t n)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 1;
+	pthread_mutex_lock(&seen_lock);
+	while (seen < n &&
+	       !pthread_cond_timedwait(&seen_cond, &seen_lock, &deadline))
+		;
+	size_t ret = seen;
+	pthread_mutex_unlock(&seen_lock);
+	return ret;
+}
+
+static void *daemon_run(void *arg)
+{
+	nrm_server_start(arg);
+	return NULL;
+}
+
+static void daemon_start(int hwloc)
+{
+	state = nrm_state_create();
+	ck_assert_ptr_nonnull(state);
+	if (hwloc)
+		ck_assert_int_eq(nrm_scope_hwloc_scopes(state), 0);
+	ck_assert_int_eq(nrm_server_create(&server, state,
+	                                   NRM_DEFAULT_UPSTREAM_URI,
+	                                   NRM_DEFAULT_UPSTREAM_PUB_PORT,
+	                                   NRM_DEFAULT_UPSTREAM_RPC_PORT),
+	                 0);
+	nrm_server_user_callbacks_t callbacks = {.events = daemon_events};
+	ck_assert_int_eq(nrm_server_setcallbacks(server, callbacks), 0);
+	seen = 0;
+	ck_assert_int_eq(
+	        pthread_create(&server_thread, NULL, daemon_run, server), 0);
+	ck_assert_int_eq(nrm_client_create(&client, NRM_DEFAULT_UPSTREAM_URI,
+	                                   NRM_DEFAULT_UPSTREAM_PUB_PORT,
+	                                   NRM_DEFAULT_UPSTREAM_RPC_PORT),
+	                 0);
+}
+
+void setup_daemon(void)
+{
+	daemon_start(0);
+}
+
+/* the daemon as nrmd runs it, with a scope for each hwloc object */
+void setup_hwloc(void)
+{
+	daemon_start(1);
+}
+
+void teardown_daemon(void)
+{
+	/* the server loop stops on exit requests */
+	ck_assert_int_eq(nrm_client_send_exit(client), 0);
+	pthread_join(server_thread, NULL);
+	nrm_client_destroy(&client);
+	nrm_server_destroy(&server);
+	nrm_state_destroy(&state);
+}
+
+static size_t daemon_nscopes(void)
+{
+	size_t n;
+	nrm_vector_t *scopes;
+	ck_assert_int_eq(nrm_client_list_scopes(client, &scopes), 0);
+	nrm_vector_length(scopes, &n);
+	nrm_vector_foreach(scopes, iter)
+	{
+		nrm_scope_t **s = nrm_vector_iterator_get(iter);
+		nrm_scope_destroy(*s);
+	}
+	nrm_vector_destroy(&scopes);
+	return n;
+}
+
+/* reply to an add request with the scope it carried */
+static void fake_reply_scope(nrm_msg_t *request, nrm_uuid_t *from)
+{
+	ck_assert_int_eq(request->type, NRM_MSG_TYPE_ADD);
+	ck_assert_int_eq(request->add->data_case, NRM__ADD__DATA_SCOPE);
+	nrm_scope_t *scope = nrm_scope_create_frommsg(request->add->scope);
+	ck_assert_ptr_nonnull(scope);
+	nrm_msg_t *reply = nrm_msg_create();
+	nrm_msg_fill(reply, NRM_MSG_TYPE_ADD);
+	nrm_msg_set_add_scope(reply, scope);
+	reply->id = request->id;
+	ck_assert_int_eq(nrm_msg_sendto(rpc, reply, from), 0);
+	nrm_msg_destroy_created(&reply);
+	nrm_scope_destroy(scope);
+}
+
+/* whether the client sent something within timeout milliseconds */
+static int fake_pending(long timeout)
+{
+	zmq_pollitem_t item = {zsock_resolve(rpc), 0, ZMQ_POLLIN, 0};
+	return zmq_poll(&item, 1, timeout) > 0;
+}
+
+/* receive an events message, returning how many events it carried */
+static size_t fake_recv_events(void)
+{
+	nrm_uuid_t *from;
+	nrm_msg_t *msg = nrm_msg_recvfrom(rpc, &from);
+	ck_assert_ptr_nonnull(msg);
+	ck_assert_int_eq(msg->type, NRM_MSG_TYPE_EVENTS);
+	size_t n = 0;
+	for (size_t i = 0; i < msg->events->n_series; i++) {
+		size_t len;
+		ck_assert_int_eq(nrm_msg_timeserie_length(
+		                         msg->events->series[i], &len),
+		                 0);
+		n += len;
+	}
+	nrm_msg_destroy_received(&msg);
+	nrm_uuid_destroy(&from);
+	return n;
+}
+
+/* threads sending events as fast as they can, each with its own sensor so
+ * that the daemon side can tell their events apart.
+ */
+struct producer_s {
+	pthread_t thread;
+	int id;
+	size_t nevents;
+	int err;
+};
+
+static void *producer_run(void *arg)
+{
+	struct producer_s *p = arg;
+	char uuid[64];
+	snprintf(uuid, sizeof(uuid), "nrm.sensor.clienttest.%d", p->id);
+	nrm_sensor_t *sensor = nrm_sensor_create(uuid);
+	nrm_scope_t *scope = nrm_scope_create("nrm.scope.clienttest");
+	nrm_time_t now;
+	nrm_time_gettime(&now);
+	for (size_t i = 0; i < p->nevents && !p->err; i++)
+		p->err = nrm_client_send_event(client, now, sensor, scope,
+		                               (double)i);
+	nrm_sensor_destroy(&sensor);
+	nrm_scope_destroy(scope);
+	return NULL;
+}
+
+static void producers_start(struct producer_s *p, int n, size_t nevents)
+{
+	for (int i = 0; i < n; i++) {
+		p[i].id = i;
+		p[i].nevents = nevents;
+		p[i].err = 0;
+		ck_assert_int_eq(
+		        pthread_create(&p[i].thread, NULL, producer_run, &p[i]),
+		        0);
+	}
+}
+
+static void producers_join(struct producer_s *p, int n)
+{
+	for (int i = 0; i < n; i++) {
+		pthread_join(p[i].thread, NULL);
+		ck_assert_int_eq(p[i].err, 0);
+	}
+}
+
+/* receive an events message, checking that the values of each producer
+ * come in order from next[id]. Returns the number of events, and the id of
+ * the producer if they all come from the same one, -1 otherwise.
+ */
+static size_t fake_recv_producers(double *next, int *id)
+{
+	nrm_uuid_t *from;
+	nrm_msg_t *msg = nrm_msg_recvfrom(rpc, &from);
+	ck_assert_ptr_nonnull(msg);
+	ck_assert_int_eq(msg->type, NRM_MSG_TYPE_EVENTS);
+	size_t n = 0;
+	*id = -2;
+	for (size_t i = 0; i < msg->events->n_series; i++) {
+		nrm_msg_timeserie_t *ts = msg->events->series[i];
+		int k = atoi(strrchr(ts->sensor_uuid, '.') + 1);
+		*id = *id == -2 || *id == k ? k : -1;
+		size_t len;
+		ck_assert_int_eq(nrm_msg_timeserie_length(ts, &len), 0);
+		for (size_t j = 0; j < len; j++) {
+			nrm_event_t e;
+			nrm_msg_timeserie_get_event(ts, j, &e);
+			ck_assert_double_eq(e.value, next[k]);
+			next[k] += 1.0;
+		}
+		n += len;
+	}
+	nrm_msg_destroy_received(&msg);
+	nrm_uuid_destroy(&from);
+	return n;
+}
+
+START_TEST(test_out_of_order)
+{
+	nrm_scope_t *a = nrm_scope_create("nrm.scope.clienttest.a");
+	nrm_scope_t *b = nrm_scope_create("nrm.scope.clienttest.b");
+	nrm_scope_add(a, NRM_SCOPE_TYPE_CPU, 1);
+	nrm_scope_add(b, NRM_SCOPE_TYPE_CPU, 2);
+
+	nrm_client_request_t *ra, *rb;
+	ck_assert_int_eq(nrm_client_add_scope_async(client, a, &ra), 0);
+	ck_assert_int_eq(nrm_client_add_scope_async(client, b, &rb), 0);
+
+	nrm_uuid_t *froma, *fromb;
+	nrm_msg_t *qa = nrm_msg_recvfrom(rpc, &froma);
+	nrm_msg_t *qb = nrm_msg_recvfrom(rpc, &fromb);
+	ck_assert_ptr_nonnull(qa);
+	ck_assert_ptr_nonnull(qb);
+	ck_assert_int_ne(qa->id, 0);
+	ck_assert_int_ne(qa->id, qb->id);
+
+	/* answer the second request first: each reply must still update the
+	 * scope of its own request.
+	 */
+	fake_reply_scope(qb, fromb);
+	fake_reply_scope(qa, froma);
+	ck_assert_int_eq(nrm_client_wait(client, &ra), 0);
+	ck_assert_ptr_null(ra);
+	ck_assert_int_eq(nrm_client_wait(client, &rb), 0);
+	ck_assert(nrm_bitmap_isset(&a->maps[NRM_SCOPE_TYPE_CPU], 1));
+	ck_assert(!nrm_bitmap_isset(&a->maps[NRM_SCOPE_TYPE_CPU], 2));
+	ck_assert(nrm_bitmap_isset(&b->maps[NRM_SCOPE_TYPE_CPU], 2));
+	ck_assert(!nrm_bitmap_isset(&b->maps[NRM_SCOPE_TYPE_CPU], 1));
+
+	nrm_msg_destroy_received(&qa);
+	nrm_msg_destroy_received(&qb);
+	nrm_uuid_destroy(&froma);
+	nrm_uuid_destroy(&fromb);
+	nrm_scope_destroy(a);
+	nrm_scope_destroy(b);
+}
+END_TEST
+
+START_TEST(test_add_scopes)
+{
+	const char *uuids[] = {
+	        "nrm.scope.clienttest.a",
+	        "nrm.scope.clienttest.b",
+	        "nrm.scope.clienttest.c",
+	};
+	nrm_scope_t *scopes[3];
+	nrm_vector_t *batch;
+	nrm_vector_create(&batch, sizeof(nrm_scope_t *));
+	for (int i = 0; i < 3; i++) {
+		scopes[i] = nrm_scope_create(uuids[i]);
+		nrm_scope_add(scopes[i], NRM_SCOPE_TYPE_CPU, i);
+		nrm_vector_push_back(batch, &scopes[i]);
+	}
+
+	/* one request, one reply, all of them added */
+	ck_assert_int_eq(nrm_client_add_scopes(client, batch), 0);
+	ck_assert_int_eq(daemon_nscopes(), 3);
+	for (int i = 0; i < 3; i++) {
+		ck_assert_str_eq(scopes[i]->uuid, uuids[i]);
+		ck_assert(nrm_bitmap_isset(&scopes[i]->maps[NRM_SCOPE_TYPE_CPU],
+		                           i));
+		nrm_scope_destroy(scopes[i]);
+	}
+	nrm_vector_destroy(&batch);
+}
+END_TEST
+
+START_TEST(test_add_scopes_duplicate)
+{
+	nrm_scope_t *a = nrm_scope_create("nrm.scope.clienttest.a");
+	nrm_scope_add(a, NRM_SCOPE_TYPE_CPU, 1);
+	ck_assert_int_eq(nrm_client_add_scope(client, a), 0);
+
+	/* b twice in the same batch, and a again with other resources: all
+	 * of them resolve to the scopes the daemon added first.
+	 */
+	nrm_scope_t *b = nrm_scope_create("nrm.scope.clienttest.b");
+	nrm_scope_t *b2 = nrm_scope_create("nrm.scope.clienttest.b");
+	nrm_scope_t *a2 = nrm_scope_create("nrm.scope.clienttest.a");
+	nrm_scope_add(b, NRM_SCOPE_TYPE_CPU, 2);
+	nrm_scope_add(b2, NRM_SCOPE_TYPE_CPU, 3);
+	nrm_scope_add(a2, NRM_SCOPE_TYPE_CPU, 4);
+	nrm_vector_t *batch;
+	nrm_vector_create(&batch, sizeof(nrm_scope_t *));
+	nrm_vector_push_back(batch, &b);
+	nrm_vector_push_back(batch, &b2);
+	nrm_vector_push_back(batch, &a2);
+	ck_assert_int_eq(nrm_client_add_scopes(client, batch), 0);
+	ck_assert(nrm_bitmap_isset(&b2->maps[NRM_SCOPE_TYPE_CPU], 2));
+	ck_assert(!nrm_bitmap_isset(&b2->maps[NRM_SCOPE_TYPE_CPU], 3));
+	ck_assert(nrm_bitmap_isset(&a2->maps[NRM_SCOPE_TYPE_CPU], 1));
+	ck_assert(!nrm_bitmap_isset(&a2->maps[NRM_SCOPE_TYPE_CPU], 4));
+	ck_assert_int_eq(daemon_nscopes(), 2);
+
+	/* a batch with an invalid item is refused as a whole */
+	nrm_scope_t *c = nrm_scope_create("nrm.scope.clienttest.c");
+	nrm_scope_t *bad = nrm_scope_create("");
+	nrm_vector_clear(batch);
+	nrm_vector_push_back(batch, &c);
+	nrm_vector_push_back(batch, &bad);
+	ck_assert_int_eq(nrm_client_add_scopes(client, batch), -NRM_EINVAL);
+	ck_assert_int_eq(daemon_nscopes(), 2);
+
+	nrm_vector_destroy(&batch);
+	nrm_scope_destroy(a);
+	nrm_scope_destroy(a2);
+	nrm_scope_destroy(b);
+	nrm_scope_destroy(b2);
+	nrm_scope_destroy(c);
+	nrm_scope_destroy(bad);
+}
+END_TEST
+
+START_TEST(test_stale_scope_id)
+{
+	nrm_scope_t *a = nrm_scope_create("nrm.scope.clienttest.a");
+	nrm_scope_add(a, NRM_SCOPE_TYPE_CPU, 1);
+	ck_assert_int_eq(nrm_client_add_scope(client, a), 0);
+	nrm_sensor_t *sensor = nrm_sensor_create("nrm.sensor.clienttest");
+
+	/* another client removes the scope, ours still sends events with the
+	 * id it was given: the daemon must not drop them.
+	 */
+	nrm_client_t *other;
+	ck_assert_int_eq(nrm_client_create(&other, NRM_DEFAULT_UPSTREAM_URI,
+	                                   NRM_DEFAULT_UPSTREAM_PUB_PORT,
+	                                   NRM_DEFAULT_UPSTREAM_RPC_PORT),
+	                 0);
+	ck_assert_int_eq(nrm_client_remove_scope(other, a), 0);
+	nrm_client_destroy(&other);
+
+	nrm_time_t now;
+	nrm_time_gettime(&now);
+	ck_assert_int_eq(nrm_client_send_event(client, now, sensor, a, 1.0), 0);
+	ck_assert_int_eq(daemon_wait_events(1), 1);
+	ck_assert_str_eq(seen_scope, "nrm.scope.clienttest.a");
+
+	nrm_sensor_destroy(&sensor);
+	nrm_scope_destroy(a);
+}
+END_TEST
+
+START_TEST(test_resolve)
+{
+	nrm_scope_t *a = nrm_scope_create("nrm.scope.clienttest.a");
+	nrm_scope_add(a, NRM_SCOPE_TYPE_CPU, 1);
+	nrm_scope_add(a, NRM_SCOPE_TYPE_NUMA, 0);
+	ck_assert_int_eq(nrm_client_add_scope(client, a), 0);
+
+	/* the daemon matches on resources, whatever the uuid asked for */
+	nrm_scope_t *query = nrm_scope_create("nrm.scope.clienttest.query");
+	nrm_scope_add(query, NRM_SCOPE_TYPE_CPU, 1);
+	nrm_scope_add(query, NRM_SCOPE_TYPE_NUMA, 0);
+	nrm_scope_t *match = NULL;
+	ck_assert_int_eq(nrm_client_resolve_scope(client, query, &match), 0);
+	ck_assert_ptr_nonnull(match);
+	ck_assert_str_eq(match->uuid, a->uuid);
+	ck_assert_int_eq(nrm_scope_cmp(match, a), 0);
+	nrm_scope_destroy(match);
+	nrm_scope_destroy(query);
+
+	query = nrm_scope_create("nrm.scope.clienttest.query");
+	nrm_scope_add(query, NRM_SCOPE_TYPE_CPU, 2);
+	match = NULL;
+	ck_assert_int_eq(nrm_client_resolve_scope(client, query, &match),
+	                 -NRM_ENOTFOUND);
+	ck_assert_ptr_null(match);
+	nrm_scope_destroy(query);
+
+	nrm_scope_destroy(a);
+}
+END_TEST
+
+START_TEST(test_resolve_hwloc)
+{
+	/* what the pmpi preload looks for */
+	nrm_scope_t *query = nrm_scope_create("nrm.scope.clienttest.thread");
+	nrm_scope_threadshared(query);
+	nrm_scope_t *match = NULL;
+	ck_assert_int_eq(nrm_client_resolve_scope(client, query, &match), 0);
+	ck_assert_ptr_nonnull(match);
+	ck_assert_int_eq(strncmp(match->uuid, "nrm.hwloc.", 10), 0);
+	ck_assert_int_eq(nrm_scope_cmp(match, query), 0);
+	nrm_scope_destroy(match);
+	nrm_scope_destroy(query);
+}
+END_TEST
+
+START_TEST(test_flush_count)
+{
+	nrm_scope_t *scope = nrm_scope_create("nrm.scope.clienttest");
+	nrm_sensor_t *sensor = nrm_sensor_create("nrm.sensor.clienttest");
+	nrm_time_t now, never = nrm_time_fromns(0);
+	ck_assert_int_eq(nrm_client_set_buffering(client, 4, 0, never), 0);
+
+	/* nothing goes out until the fourth event */
+	nrm_time_gettime(&now);
+	for (int i = 0; i < 3; i++) {
+		int err = nrm_client_send_event(client, now, sensor, scope, i);
+		ck_assert_int_eq(err, 0);
+	}
+	ck_assert(!fake_pending(100));
+	ck_assert_int_eq(nrm_client_send_event(client, now, sensor, scope, 3),
+	                 0);
+	ck_assert(fake_pending(1000));
+	ck_assert_int_eq(fake_recv_events(), 4);
+
+	/* an explicit flush sends whatever is there */
+	ck_assert_int_eq(nrm_client_send_event(client, now, sensor, scope, 4),
+	                 0);
+	ck_assert_int_eq(nrm_client_flush(client), 0);
+	ck_assert(fake_pending(1000));
+	ck_assert_int_eq(fake_recv_events(), 1);
+
+	nrm_sensor_destroy(&sensor);
+	nrm_scope_destroy(scope);
+}
+END_TEST
+
+START_TEST(test_flush_age)
+{
+	nrm_scope_t *scope = nrm_scope_create("nrm.scope.clienttest");
+	nrm_sensor_t *sensor = nrm_sensor_create("nrm.sensor.clienttest");
+	nrm_time_t now, age = nrm_time_fromns(50000000);
+	ck_assert_int_eq(nrm_client_set_buffering(client, 0, 0, age), 0);
+
+	/* a single event, with no other one coming to check its age: it
+	 * still goes out once it is old enough.
+	 */
+	nrm_time_gettime(&now);
+	ck_assert_int_eq(nrm_client_send_event(client, now, sensor, scope, 1),
+	                 0);
+	ck_assert(!fake_pending(20));
+	ck_assert(fake_pending(1000));
+	ck_assert_int_eq(fake_recv_events(), 1);
+
+	nrm_sensor_destroy(&sensor);
+	nrm_scope_destroy(scope);
+}
+END_TEST
+
+#define QUEUE_PRODUCERS 8
+#define QUEUE_EVENTS 100000
+
+START_TEST(test_queue)
+{
+	/* unbuffered, each event is a frame of its own: the producers fill
+	 * the queue to the broker way faster than it can drain it.
+	 */
+	struct producer_s p[QUEUE_PRODUCERS];
+	double next[QUEUE_PRODUCERS] = {0};
+	producers_start(p, QUEUE_PRODUCERS, QUEUE_EVENTS);
+	size_t total = 0;
+	while (total < QUEUE_PRODUCERS * QUEUE_EVENTS) {
+		int id;
+		ck_assert_int_eq(fake_recv_producers(next, &id), 1);
+		total++;
+	}
+	producers_join(p, QUEUE_PRODUCERS);
+	for (int i = 0; i < QUEUE_PRODUCERS; i++)
+		ck_assert_double_eq(next[i], QUEUE_EVENTS);
+	ck_assert(!fake_pending(100));
+}
+END_TEST
+
+START_TEST(test_thread_buffers)
+{
+	nrm_time_t never = nrm_time_fromns(0);
+	ck_assert_int_eq(nrm_client_set_buffering(client, 10, 0, never), 0);
+
+	/* each thread fills its own buffer, none of them mixes events of
+	 * different threads.
+	 */
+	struct producer_s p[4];
+	double next[4] = {0};
+	producers_start(p, 4, 10);
+	producers_join(p, 4);
+	for (int i = 0; i < 4; i++) {
+		int id;
+		ck_assert(fake_pending(1000));
+		ck_assert_int_eq(fake_recv_producers(next, &id), 10);
+		ck_assert_int_ge(id, 0);
+	}
+	ck_assert(!fake_pending(100));
+	for (int i = 0; i < 4; i++)
+		ck_assert_double_eq(next[i], 10.0);
+}
+END_TEST
+
+START_TEST(test_thread_exit)
+{
+	nrm_time_t never = nrm_time_fromns(0);
+	ck_assert_int_eq(nrm_client_set_buffering(client, 100, 0, never), 0);
+
+	/* far from any limit, but the thread going away sends its events */
+	struct producer_s p;
+	double next = 0.0;
+	int id;
+	producers_start(&p, 1, 3);
+	producers_join(&p, 1);
+	ck_assert(fake_pending(1000));
+	ck_assert_int_eq(fake_recv_producers(&next, &id), 3);
+	ck_assert_int_eq(id, 0);
+}
+END_TEST
+
+Suite *client_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("client");
+
+	TCase *tc_fake = tcase_create("fake");
+	tcase_add_checked_fixture(tc_fake, setup_fake, teardown_fake);
+	tcase_add_test(tc_fake, test_out_of_order);
+	tcase_add_test(tc_fake, test_flush_count);
+	tcase_add_test(tc_fake, test_flush_age);
+	tcase_add_test(tc_fake, test_queue);
+	tcase_add_test(tc_fake, test_thread_buffers);
+	tcase_add_test(tc_fake, test_thread_exit);
+	/* the queue test moves 800k messages */
+	tcase_set_timeout(tc_fake, 60);
+	suite_add_tcase(s, tc_fake);
+
+	TCase *tc_daemon = tcase_create("daemon");
+	tcase_add_checked_fixture(tc_daemon, setup_daemon, teardown_daemon);
+	tcase_add_test(tc_daemon, test_add_scopes);
+	tcase_add_test(tc_daemon, test_add_scopes_duplicate);
+	tcase_add_test(tc_daemon, test_resolve);
+	tcase_add_test(tc_daemon, test_stale_scope_id);
+	suite_add_tcase(s, tc_daemon);
+
+	TCase *tc_hwloc = tcase_create("hwloc");
+	tcase_add_checked_fixture(tc_hwloc, setup_hwloc, teardown_daemon);
+	tcase_add_test(tc_hwloc, test_resolve_hwloc);
+	suite_add_tcase(s, tc_hwloc);
+
+	return s;
+}
+
+int main(void)
+{
+	int failed;
+	Suite *s;
+	SRunner *sr;
+
+	nrm_init(NULL, NULL);
+	s = client_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	nrm_finalize();
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
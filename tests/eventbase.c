@@ -10,6 +10,8 @@
 
 #include "nrm.h"
 #include <check.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "internal/nrmi.h"
@@ -162,6 +164,890 @@ START_TEST(test_push_tick_last_normal)
 }
 END_TEST
 
+START_TEST(test_tick_expire)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	nrm_time_t since = nrm_time_fromns(0);
+
+	/* ticks every millisecond from an aligned base, so that slices never
+	 * straddle a tick. Pulls stop at the current time, stay in the past.
+	 */
+	const int64_t period = 1000000;
+	int64_t base = nrm_time_tons(&now) - 10 * period;
+	base -= base % period;
+	int64_t first = base + period;
+
+	/* an old event, one in the last slice before the first tick and one
+	 * in the slice starting at it.
+	 */
+	int64_t times[] = {base, first - 1, first};
+	for (int i = 0; i < 3; i++) {
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+		                               nrm_time_fromns(times[i]), 1.0);
+		ck_assert_int_eq(err, 0);
+	}
+
+	/* maxperiods ticks are not enough to expire anything */
+	for (int i = 1; i <= 5; i++) {
+		err = nrm_eventbase_tick(eventbase,
+		                         nrm_time_fromns(base + i * period));
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 3);
+	nrm_timeserie_destroy(&ts);
+
+	/* one more and the first period falls out: the slice ending exactly
+	 * at the first tick goes with it, the one starting there stays.
+	 */
+	err = nrm_eventbase_tick(eventbase, nrm_time_fromns(base + 6 * period));
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 1);
+	nrm_event_t *e;
+	nrm_vector_get_withtype(nrm_event_t, nrm_timeserie_get_events(ts), 0,
+	                        e);
+	ck_assert_int_eq(e->time, first);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_remove)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	nrm_time_t past = nrm_time_fromns(nrm_time_tons(&now) - 1000000000);
+
+	err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, past,
+	                               1.0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_remove_scope(eventbase, nrm_scope_uuid(scope));
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope, past,
+	                                   &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 0);
+	nrm_timeserie_destroy(&ts);
+
+	err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, past,
+	                               1.0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_remove_sensor(eventbase, sensor_uuid);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope, past,
+	                                   &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 0);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_pull_sorted)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	/* spread over several slices, out of order */
+	int64_t offsets[] = {5000, 10, 3000, 20, 1000000, 4000, 0};
+	size_t n = sizeof(offsets) / sizeof(offsets[0]);
+
+	for (size_t i = 0; i < n; i++) {
+		nrm_time_t t = nrm_time_fromns(base + offsets[i]);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)offsets[i]);
+		ck_assert_int_eq(err, 0);
+	}
+
+	nrm_time_t since = nrm_time_fromns(base + 3000);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_t *e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, 4);
+	double prev = 0.0;
+	nrm_vector_foreach(e, iter)
+	{
+		nrm_event_t *event = nrm_vector_iterator_get(iter);
+		ck_assert_double_ge(event->value, prev);
+		prev = event->value;
+	}
+	nrm_timeserie_destroy(&ts);
+
+	since = nrm_time_fromns(base);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, n);
+	prev = -1.0;
+	nrm_vector_foreach(e, iter)
+	{
+		nrm_event_t *event = nrm_vector_iterator_get(iter);
+		ck_assert_double_gt(event->value, prev);
+		prev = event->value;
+	}
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_periods)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	err = nrm_eventbase_set_period(eventbase, 0);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	err = nrm_eventbase_set_sensor_period(eventbase, sensor_uuid, 1000000);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_set_adaptive(eventbase, 16);
+	ck_assert_int_eq(err, 0);
+
+	/* wide slices first, then narrow ones filling the gaps */
+	for (int64_t i = 0; i < 100; i += 2) {
+		nrm_time_t t = nrm_time_fromns(base + i * 100000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, now);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_set_sensor_period(eventbase, sensor_uuid, 0);
+	ck_assert_int_eq(err, 0);
+	for (int64_t i = 1; i < 100; i += 2) {
+		nrm_time_t t = nrm_time_fromns(base + i * 100000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, now);
+	ck_assert_int_eq(err, 0);
+
+	nrm_time_t since = nrm_time_fromns(base);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_t *e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, 100);
+	double expected = 0.0;
+	nrm_vector_foreach(e, iter)
+	{
+		nrm_event_t *event = nrm_vector_iterator_get(iter);
+		ck_assert_double_eq(event->value, expected);
+		expected += 1.0;
+	}
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_pull_stats)
+{
+	int err;
+	nrm_eventbase_stats_t stats;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	/* values 0..99, one every 10us */
+	for (int64_t i = 0; i < 100; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 10000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+
+	/* events 10 to 29 */
+	nrm_time_t since = nrm_time_fromns(base + 100000);
+	nrm_time_t until = nrm_time_fromns(base + 300000);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope, since,
+	                               until, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 20);
+	ck_assert_double_eq(stats.sum, 390.0);
+	ck_assert_double_eq(stats.min, 10.0);
+	ck_assert_double_eq(stats.max, 29.0);
+	ck_assert_double_eq(stats.mean, 19.5);
+	ck_assert_double_eq_tol(stats.rate, 390.0 / 200e-6, 1e-3);
+
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope, until,
+	                               since, &stats);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope, now, now,
+	                               &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 0);
+}
+END_TEST
+
+START_TEST(test_pull_aggregate)
+{
+	int err;
+	size_t len;
+	nrm_vector_t *aggs;
+	nrm_eventbase_aggregate_t *a;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	base -= base % 1000000;
+
+	/* values 0..99, one every 10us, in 1ms buckets */
+	for (int64_t i = 0; i < 100; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 10000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+
+	nrm_time_t since = nrm_time_fromns(base);
+	nrm_time_t until = nrm_time_fromns(base + 2000000);
+	nrm_time_t step = nrm_time_fromns(300000);
+	err = nrm_eventbase_pull_aggregate(eventbase, sensor_uuid, scope,
+	                                   since, until, step, &aggs);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(aggs, &len);
+	ck_assert_int_eq(len, 4);
+	nrm_vector_get_withtype(nrm_eventbase_aggregate_t, aggs, 1, a);
+	ck_assert_int_eq(nrm_time_tons(&a->time), base + 300000);
+	ck_assert_int_eq(a->count, 30);
+	ck_assert_double_eq(a->sum, 30 * 44.5);
+	ck_assert_double_eq(a->min, 30.0);
+	ck_assert_double_eq(a->max, 59.0);
+	ck_assert_double_eq(a->first, 30.0);
+	ck_assert_double_eq(a->last, 59.0);
+	nrm_vector_get_withtype(nrm_eventbase_aggregate_t, aggs, 3, a);
+	ck_assert_int_eq(a->count, 10);
+	nrm_vector_destroy(&aggs);
+
+	err = nrm_eventbase_pull_aggregate(eventbase, sensor_uuid, scope,
+	                                   since, until, nrm_time_fromns(0),
+	                                   &aggs);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+}
+END_TEST
+
+START_TEST(test_pull_aggregate_split)
+{
+	int err;
+	size_t len;
+	nrm_vector_t *aggs;
+	nrm_eventbase_aggregate_t *a;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	base -= base % 1000000;
+
+	/* values 0..199, one every 10us in 1ms slices, the first one sealed */
+	err = nrm_eventbase_set_period(eventbase, 1000000);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_set_compression(eventbase, 1);
+	ck_assert_int_eq(err, 0);
+	for (int64_t i = 0; i < 200; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 10000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, nrm_time_fromns(base + 1000000));
+	ck_assert_int_eq(err, 0);
+
+	/* buckets of 300us from event 5: both slices cross bucket edges and
+	 * the fourth bucket spans the two of them.
+	 */
+	nrm_time_t since = nrm_time_fromns(base + 50000);
+	nrm_time_t until = nrm_time_fromns(base + 2000000);
+	nrm_time_t step = nrm_time_fromns(300000);
+	err = nrm_eventbase_pull_aggregate(eventbase, sensor_uuid, scope,
+	                                   since, until, step, &aggs);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(aggs, &len);
+	ck_assert_int_eq(len, 7);
+	nrm_vector_get_withtype(nrm_eventbase_aggregate_t, aggs, 0, a);
+	ck_assert_int_eq(nrm_time_tons(&a->time), base + 50000);
+	ck_assert_int_eq(a->count, 30);
+	ck_assert_double_eq(a->first, 5.0);
+	ck_assert_double_eq(a->last, 34.0);
+	nrm_vector_get_withtype(nrm_eventbase_aggregate_t, aggs, 3, a);
+	ck_assert_int_eq(nrm_time_tons(&a->time), base + 950000);
+	ck_assert_int_eq(a->count, 30);
+	ck_assert_double_eq(a->sum, 30 * 109.5);
+	ck_assert_double_eq(a->min, 95.0);
+	ck_assert_double_eq(a->max, 124.0);
+	ck_assert_double_eq(a->first, 95.0);
+	ck_assert_double_eq(a->last, 124.0);
+	nrm_vector_get_withtype(nrm_eventbase_aggregate_t, aggs, 6, a);
+	ck_assert_int_eq(a->count, 15);
+	ck_assert_double_eq(a->last, 199.0);
+	nrm_vector_destroy(&aggs);
+}
+END_TEST
+
+START_TEST(test_pull_quantile)
+{
+	int err;
+	double value;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	nrm_time_t since = nrm_time_fromns(base);
+
+	err = nrm_eventbase_set_quantiles(eventbase, 0.01);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  0.5, &value);
+	ck_assert_int_eq(err, -NRM_ENOTFOUND);
+
+	/* values 1..100 one every 1ms, then 101..200 in the next period */
+	for (int64_t i = 1; i <= 200; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 1000000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+		if (i == 100) {
+			err = nrm_eventbase_tick(eventbase, t);
+			ck_assert_int_eq(err, 0);
+		}
+	}
+
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 100.0, 1.0);
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  0.99, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 198.0, 2.0);
+
+	/* only the last period */
+	since = nrm_time_fromns(base + 150000000);
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 150.0, 1.5);
+	err = nrm_eventbase_pull_rate_quantile(eventbase, sensor_uuid, scope,
+	                                       since, 0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 150000.0, 1500.0);
+
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  2.0, &value);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	err = nrm_eventbase_set_quantiles(eventbase, 0.0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_quantile(eventbase, sensor_uuid, scope, since,
+	                                  0.5, &value);
+	ck_assert_int_eq(err, -NRM_ENOTFOUND);
+}
+END_TEST
+
+START_TEST(test_compression)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_eventbase_stats_t stats;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	nrm_time_t since = nrm_time_fromns(base);
+
+	err = nrm_eventbase_set_period(eventbase, 1000000);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_set_compression(eventbase, 1);
+	ck_assert_int_eq(err, 0);
+
+	/* jittery times and a mix of repeated, small and large values, over
+	 * 10 slices.
+	 */
+	for (int64_t i = 0; i < 1000; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 10000 + (i % 7) * 13);
+		double v = (i % 3 == 0) ? 42.0 : (i % 10) * -0.5 + i * 1e6;
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               v);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, nrm_time_fromns(base + 20000000));
+	ck_assert_int_eq(err, 0);
+
+	/* a late event in the middle of a sealed slice */
+	err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base + 5000001), -1.0);
+	ck_assert_int_eq(err, 0);
+
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   since, &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_t *e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, 1001);
+	int64_t i = 0;
+	nrm_vector_foreach(e, iter)
+	{
+		nrm_event_t *event = nrm_vector_iterator_get(iter);
+		int64_t t = event->time;
+		if (t == base + 5000001) {
+			ck_assert_double_eq(event->value, -1.0);
+			continue;
+		}
+		double v = (i % 3 == 0) ? 42.0 : (i % 10) * -0.5 + i * 1e6;
+		ck_assert_int_eq(t, base + i * 10000 + (i % 7) * 13);
+		ck_assert_double_eq(event->value, v);
+		i++;
+	}
+	nrm_timeserie_destroy(&ts);
+
+	/* events 150 to 249, over parts of two sealed slices */
+	nrm_time_t from = nrm_time_fromns(base + 1500000);
+	nrm_time_t until = nrm_time_fromns(base + 2500000);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope, from,
+	                               until, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 100);
+	ck_assert_double_eq(stats.max, 248 * 1e6 - 4.0);
+
+	err = nrm_eventbase_set_compression(eventbase, 0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope, since,
+	                               until, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 250);
+}
+END_TEST
+
+START_TEST(test_push_ids)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_state_t *state = nrm_state_create();
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	/* the fixtures belong to the state for this test */
+	nrm_state_add_sensor(state, sensor);
+	nrm_state_add_scope(state, scope);
+	ck_assert_int_ne(sensor->id, 0);
+	ck_assert_int_ne(scope->id, 0);
+	ck_assert_ptr_eq(nrm_state_get_sensor(state, sensor->id), sensor);
+	ck_assert_ptr_eq(nrm_state_get_scope(state, scope->id), scope);
+	ck_assert_ptr_null(nrm_state_get_sensor(state, 0));
+	ck_assert_ptr_null(nrm_state_get_sensor(state, sensor->id + 1));
+
+	/* by id and by uuid end up in the same place */
+	for (int64_t i = 0; i < 10; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 1000);
+		if (i % 2)
+			err = nrm_eventbase_push_sensor_event(eventbase, sensor,
+			                                      scope, t, 1.0);
+		else
+			err = nrm_eventbase_push_event(eventbase, sensor_uuid,
+			                               scope, t, 1.0);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   nrm_time_fromns(base), &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 10);
+	nrm_timeserie_destroy(&ts);
+
+	/* purged data must not be reachable by id anymore */
+	err = nrm_eventbase_remove_scope(eventbase, scope->uuid);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_push_sensor_event(eventbase, sensor, scope,
+	                                      nrm_time_fromns(base), 1.0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   nrm_time_fromns(base), &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 1);
+	nrm_timeserie_destroy(&ts);
+
+	size_t id = sensor->id;
+	nrm_state_remove_sensor(state, sensor_uuid);
+	ck_assert_ptr_null(nrm_state_get_sensor(state, id));
+	sensor = NULL;
+	nrm_state_remove_scope(state, scope->uuid);
+	scope = nrm_scope_create("nrm.scope.eventbasetest");
+	nrm_state_destroy(&state);
+}
+END_TEST
+
+START_TEST(test_push_events)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_eventbase_stats_t stats;
+	nrm_event_t events[100];
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	base -= base % 1000000;
+
+	err = nrm_eventbase_set_period(eventbase, 1000000);
+	ck_assert_int_eq(err, 0);
+
+	/* one every 25us over 2.5 slices, with a late one in the middle */
+	for (int64_t i = 0; i < 100; i++) {
+		events[i].time = base + i * 25000;
+		events[i].value = (double)i;
+	}
+	events[50].time = base + 10;
+	err = nrm_eventbase_push_events(eventbase, sensor, scope, events, 100);
+	ck_assert_int_eq(err, 0);
+
+	/* and the same thing again through a timeserie */
+	err = nrm_timeserie_create(&ts, sensor_uuid, scope);
+	ck_assert_int_eq(err, 0);
+	for (int64_t i = 0; i < 100; i++)
+		nrm_timeserie_add_event(ts, nrm_time_fromns(events[i].time),
+		                        events[i].value);
+	err = nrm_eventbase_push_timeserie(eventbase, ts);
+	ck_assert_int_eq(err, 0);
+	nrm_timeserie_destroy(&ts);
+
+	err = nrm_eventbase_pull_timeserie(eventbase, sensor_uuid, scope,
+	                                   nrm_time_fromns(base), &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_t *e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, 200);
+	int64_t last = 0;
+	nrm_vector_foreach(e, iter)
+	{
+		nrm_event_t *event = nrm_vector_iterator_get(iter);
+		ck_assert_int_ge(event->time, last);
+		last = event->time;
+	}
+	nrm_timeserie_destroy(&ts);
+
+	/* the first slice: events 0 to 39, twice */
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base),
+	                               nrm_time_fromns(base + 1000000), &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 82);
+	ck_assert_double_eq(stats.sum, 2 * (39 * 40 / 2 + 50));
+	ck_assert_double_eq(stats.min, 0.0);
+	ck_assert_double_eq(stats.max, 50.0);
+
+	err = nrm_eventbase_push_events(eventbase, sensor, scope, NULL, 0);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_push_events(eventbase, sensor, scope, NULL, 1);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+}
+END_TEST
+
+START_TEST(test_view)
+{
+	int err;
+	size_t n, total = 0, runs = 0;
+	const int64_t *times;
+	const double *values;
+	nrm_eventbase_view_t view;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+	base -= base % 1000000;
+
+	err = nrm_eventbase_set_period(eventbase, 1000000);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_set_compression(eventbase, 1);
+	ck_assert_int_eq(err, 0);
+
+	/* 10 slices of 100 events, the first 5 sealed */
+	for (int64_t i = 0; i < 1000; i++) {
+		nrm_time_t t = nrm_time_fromns(base + i * 10000);
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope, t,
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, nrm_time_fromns(base + 5000000));
+	ck_assert_int_eq(err, 0);
+
+	/* events 50 to 949 */
+	err = nrm_eventbase_view_begin(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base + 500000),
+	                               nrm_time_fromns(base + 9500000), &view);
+	ck_assert_int_eq(err, 0);
+	while (!nrm_eventbase_view_next(&view, &times, &values, &n) && n != 0) {
+		ck_assert_int_le(n, 100);
+		for (size_t i = 0; i < n; i++) {
+			int64_t j = 50 + total + i;
+			ck_assert_int_eq(times[i], base + j * 10000);
+			ck_assert_double_eq(values[i], (double)j);
+		}
+		total += n;
+		runs++;
+	}
+	nrm_eventbase_view_end(&view);
+	ck_assert_int_eq(total, 900);
+	/* open slices come in one run each */
+	ck_assert_int_lt(runs, 20);
+
+	/* unknown scopes give empty views */
+	nrm_scope_t *other = nrm_scope_create("nrm.scope.viewtest");
+	err = nrm_eventbase_view_begin(eventbase, sensor_uuid, other,
+	                               nrm_time_fromns(base), now, &view);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_view_next(&view, &times, &values, &n);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(n, 0);
+	nrm_eventbase_view_end(&view);
+	nrm_scope_destroy(other);
+
+	err = nrm_eventbase_view_next(&view, &times, &values, &n);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	err = nrm_eventbase_view_begin(eventbase, sensor_uuid, scope, now,
+	                               nrm_time_fromns(base), &view);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+}
+END_TEST
+
+START_TEST(test_view_pinned)
+{
+	int err;
+	size_t n, total;
+	const int64_t *times;
+	const double *values;
+	nrm_eventbase_view_t view;
+	nrm_eventbase_stats_t stats;
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	for (int64_t i = 0; i < 10; i++) {
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+		                               nrm_time_fromns(base + i * 1000),
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+
+	/* the thread holding the view can push and tick, its events wait
+	 * for the view to end.
+	 */
+	err = nrm_eventbase_view_begin(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base), now, &view);
+	ck_assert_int_eq(err, 0);
+	for (int64_t i = 10; i < 15; i++) {
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+		                               nrm_time_fromns(base + i * 1000),
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_tick(eventbase, now);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base), now, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 10);
+	total = 0;
+	while (!nrm_eventbase_view_next(&view, &times, &values, &n) && n != 0)
+		total += n;
+	ck_assert_int_eq(total, 10);
+	nrm_eventbase_view_end(&view);
+
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base), now, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 15);
+	ck_assert_double_eq(stats.max, 14.0);
+
+	/* a scope removed under a view lives until the view ends */
+	err = nrm_eventbase_view_begin(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base), now, &view);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_remove_scope(eventbase, nrm_scope_uuid(scope));
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_pull_stats(eventbase, sensor_uuid, scope,
+	                               nrm_time_fromns(base), now, &stats);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(stats.count, 0);
+	total = 0;
+	while (!nrm_eventbase_view_next(&view, &times, &values, &n) && n != 0)
+		total += n;
+	ck_assert_int_eq(total, 15);
+	nrm_eventbase_view_end(&view);
+}
+END_TEST
+
+START_TEST(test_cursor)
+{
+	int err;
+	size_t numevents;
+	nrm_timeserie_t *ts;
+	nrm_event_t *event;
+	nrm_eventbase_cursor_t cursor = {0, 0};
+	nrm_string_t sensor_uuid = nrm_sensor_uuid(sensor);
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	for (int64_t i = 0; i < 10; i++) {
+		err = nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+		                               nrm_time_fromns(base + i * 1000),
+		                               (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_eventbase_pull_cursor(eventbase, sensor_uuid, scope, &cursor,
+	                                &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 10);
+	ck_assert_int_eq(cursor.watermark, base + 9000);
+	nrm_timeserie_destroy(&ts);
+
+	/* nothing new */
+	err = nrm_eventbase_pull_cursor(eventbase, sensor_uuid, scope, &cursor,
+	                                &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 0);
+	nrm_timeserie_destroy(&ts);
+
+	/* a late event in the middle, one at the watermark, and a new one */
+	nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                         nrm_time_fromns(base + 4500), 100.0);
+	nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                         nrm_time_fromns(base + 9000), 101.0);
+	nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                         nrm_time_fromns(base + 10000), 102.0);
+	err = nrm_eventbase_pull_cursor(eventbase, sensor_uuid, scope, &cursor,
+	                                &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_t *e = nrm_timeserie_get_events(ts);
+	nrm_vector_length(e, &numevents);
+	ck_assert_int_eq(numevents, 3);
+	nrm_vector_get_withtype(nrm_event_t, e, 0, event);
+	ck_assert_double_eq(event->value, 102.0);
+	nrm_vector_get_withtype(nrm_event_t, e, 1, event);
+	ck_assert_double_eq(event->value, 100.0);
+	nrm_vector_get_withtype(nrm_event_t, e, 2, event);
+	ck_assert_double_eq(event->value, 101.0);
+	nrm_timeserie_destroy(&ts);
+
+	/* a late event that a new cursor sees in its window, only once */
+	nrm_eventbase_cursor_t other = {0, 0};
+	err = nrm_eventbase_pull_cursor(eventbase, sensor_uuid, scope, &other,
+	                                &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 13);
+	nrm_timeserie_destroy(&ts);
+
+	/* views give the window first, then the late events */
+	nrm_eventbase_view_t view;
+	const int64_t *times;
+	const double *values;
+	nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                         nrm_time_fromns(base + 500), 103.0);
+	nrm_eventbase_push_event(eventbase, sensor_uuid, scope,
+	                         nrm_time_fromns(base + 11000), 104.0);
+	err = nrm_eventbase_view_cursor(eventbase, sensor_uuid, scope, &cursor,
+	                                &view);
+	ck_assert_int_eq(err, 0);
+	err = nrm_eventbase_view_next(&view, &times, &values, &numevents);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(numevents, 1);
+	ck_assert_double_eq(values[0], 104.0);
+	err = nrm_eventbase_view_next(&view, &times, &values, &numevents);
+	ck_assert_int_eq(numevents, 0);
+	err = nrm_eventbase_view_next_late(&view, &times, &values, &numevents);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(numevents, 1);
+	ck_assert_int_eq(times[0], base + 500);
+	ck_assert_double_eq(values[0], 103.0);
+	err = nrm_eventbase_view_next_late(&view, &times, &values, &numevents);
+	ck_assert_int_eq(numevents, 0);
+	nrm_eventbase_view_end(&view);
+	err = nrm_eventbase_pull_cursor(eventbase, sensor_uuid, scope, &cursor,
+	                                &ts);
+	ck_assert_int_eq(err, 0);
+	nrm_vector_length(nrm_timeserie_get_events(ts), &numevents);
+	ck_assert_int_eq(numevents, 0);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+/* pushes for one sensor, from its own thread */
+struct pusher {
+	nrm_sensor_t *sensor;
+	int64_t base;
+	int err;
+};
+
+static void *push_thread(void *arg)
+{
+	struct pusher *p = arg;
+	nrm_event_t e;
+	for (int64_t i = 0; i < 1000 && !p->err; i++) {
+		e.time = p->base + i * 1000;
+		e.value = 1.0;
+		p->err = nrm_eventbase_push_events(eventbase, p->sensor, scope,
+		                                   &e, 1);
+	}
+	return NULL;
+}
+
+START_TEST(test_concurrent_push)
+{
+	int err;
+	char name[64];
+	pthread_t threads[8];
+	struct pusher pushers[8];
+	nrm_eventbase_stats_t stats;
+	int64_t base = nrm_time_tons(&now) - 1000000000;
+
+	for (int i = 0; i < 8; i++) {
+		snprintf(name, sizeof(name), "nrm.sensor.concurrent.%d", i);
+		pushers[i].sensor = nrm_sensor_create(name);
+		pushers[i].sensor->id = i + 1;
+		pushers[i].base = base;
+		pushers[i].err = 0;
+		err = pthread_create(&threads[i], NULL, push_thread,
+		                     &pushers[i]);
+		ck_assert_int_eq(err, 0);
+	}
+
+	/* readers and ticks can come in at any time */
+	for (int i = 0; i < 100; i++) {
+		nrm_string_t uuid = nrm_sensor_uuid(pushers[i % 8].sensor);
+		err = nrm_eventbase_pull_stats(eventbase, uuid, scope,
+		                               nrm_time_fromns(base), now,
+		                               &stats);
+		ck_assert_int_eq(err, 0);
+		ck_assert_int_le(stats.count, 1000);
+		if (i % 10 == 0)
+			nrm_eventbase_tick(eventbase, nrm_time_fromns(base));
+	}
+
+	for (int i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+		ck_assert_int_eq(pushers[i].err, 0);
+
+		nrm_string_t uuid = nrm_sensor_uuid(pushers[i].sensor);
+		err = nrm_eventbase_pull_stats(eventbase, uuid, scope,
+		                               nrm_time_fromns(base), now,
+		                               &stats);
+		ck_assert_int_eq(err, 0);
+		ck_assert_int_eq(stats.count, 1000);
+		ck_assert_double_eq(stats.sum, 1000.0);
+		nrm_sensor_destroy(&pushers[i].sensor);
+	}
+}
+END_TEST
+
 Suite *eventbase_suite(void)
 {
 	Suite *s;
@@ -175,6 +1061,21 @@ Suite *eventbase_suite(void)
 	tcase_add_test(tc_dc, test_push_two_sensors);
 	tcase_add_test(tc_dc, test_push_two_scopes);
 	tcase_add_test(tc_dc, test_push_tick_last_normal);
+	tcase_add_test(tc_dc, test_tick_expire);
+	tcase_add_test(tc_dc, test_remove);
+	tcase_add_test(tc_dc, test_pull_sorted);
+	tcase_add_test(tc_dc, test_periods);
+	tcase_add_test(tc_dc, test_pull_stats);
+	tcase_add_test(tc_dc, test_pull_aggregate);
+	tcase_add_test(tc_dc, test_pull_aggregate_split);
+	tcase_add_test(tc_dc, test_pull_quantile);
+	tcase_add_test(tc_dc, test_compression);
+	tcase_add_test(tc_dc, test_push_ids);
+	tcase_add_test(tc_dc, test_push_events);
+	tcase_add_test(tc_dc, test_concurrent_push);
+	tcase_add_test(tc_dc, test_view);
+	tcase_add_test(tc_dc, test_view_pinned);
+	tcase_add_test(tc_dc, test_cursor);
 	suite_add_tcase(s, tc_dc);
 
 	return s;
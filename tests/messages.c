@@ -0,0 +1,339 @@
+/*******************************************************************************
+ * Copyright 2019 UChicago Argonne, LLC.
+ * (c.f. AUTHORS, LICENSE)
+ *
+ * This file is part of the libnrm project.
+ * For more info, see https://github.com/anlsys/libnrm
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ ******************************************************************************/
+
+#include <check.h>
+#include <stdlib.h>
+
+#include "nrm.h"
+
+#include "internal/messages.h"
+#include "internal/nrmi.h"
+
+/* fixtures: a socket pair to send messages through */
+zsock_t *in, *out;
+nrm_scope_t *scope;
+nrm_string_t sensor_uuid;
+
+void setup(void)
+{
+	out = zsock_new_pair("@inproc://nrm-test-messages");
+	in = zsock_new_pair(">inproc://nrm-test-messages");
+	ck_assert_ptr_nonnull(out);
+	ck_assert_ptr_nonnull(in);
+	scope = nrm_scope_create("nrm.scope.messagestest");
+	nrm_scope_add(scope, NRM_SCOPE_TYPE_CPU, 0);
+	nrm_scope_add(scope, NRM_SCOPE_TYPE_CPU, 1);
+	nrm_scope_add(scope, NRM_SCOPE_TYPE_NUMA, 0);
+	sensor_uuid = nrm_string_fromchar("nrm.sensor.messagestest");
+}
+
+void teardown(void)
+{
+	nrm_string_decref(sensor_uuid);
+	nrm_scope_destroy(scope);
+	zsock_destroy(&in);
+	zsock_destroy(&out);
+}
+
+/* pack a message, send it and return what the other end received */
+static nrm_msg_t *roundtrip(nrm_msg_t *msg)
+{
+	zframe_t *frame = nrm_msg_pack(msg);
+	ck_assert_ptr_nonnull(frame);
+	ck_assert_int_eq(nrm_msg_send_packed(out, &frame), 0);
+	nrm_msg_t *ret = nrm_msg_recv(in);
+	ck_assert_ptr_nonnull(ret);
+	return ret;
+}
+
+static nrm_msg_t *events_msg(nrm_timeserie_t *ts)
+{
+	nrm_vector_t *timeseries;
+	nrm_vector_create(&timeseries, sizeof(nrm_timeserie_t *));
+	nrm_vector_push_back(timeseries, &ts);
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_EVENTS);
+	ck_assert_int_eq(nrm_msg_set_events(msg, timeseries), 0);
+	nrm_vector_destroy(&timeseries);
+	return msg;
+}
+
+/* number of events in a serie, that must be well formed */
+static size_t serie_length(nrm_msg_timeserie_t *mts)
+{
+	size_t len;
+	ck_assert_int_eq(nrm_msg_timeserie_length(mts, &len), 0);
+	return len;
+}
+
+START_TEST(test_events_packed)
+{
+	nrm_timeserie_t *ts;
+	int64_t base = 1000000000;
+	ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope), 0);
+	for (int i = 0; i < 10; i++)
+		nrm_timeserie_add_event(ts, nrm_time_fromns(base + i * 1000),
+		                        (double)i);
+
+	nrm_msg_t *msg = events_msg(ts);
+	nrm_msg_t *recv = roundtrip(msg);
+	ck_assert_int_eq(recv->type, NRM_MSG_TYPE_EVENTS);
+	ck_assert_int_eq(recv->events->n_series, 1);
+
+	/* times go as deltas from the start of the serie */
+	nrm_msg_timeserie_t *mts = recv->events->series[0];
+	ck_assert_int_eq(mts->n_events, 0);
+	ck_assert_int_eq(mts->n_times, 10);
+	ck_assert_int_eq(mts->n_values, 10);
+	ck_assert_int_eq(serie_length(mts), 10);
+	for (size_t i = 0; i < 10; i++) {
+		nrm_event_t e;
+		nrm_msg_timeserie_get_event(mts, i, &e);
+		ck_assert_int_eq(e.time, base + (int64_t)i * 1000);
+		ck_assert_double_eq(e.value, (double)i);
+	}
+	ck_assert_str_eq(mts->sensor_uuid, "nrm.sensor.messagestest");
+	ck_assert_str_eq(mts->scope->uuid, "nrm.scope.messagestest");
+
+	nrm_msg_destroy_received(&recv);
+	nrm_msg_destroy_created(&msg);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_events_mismatch)
+{
+	nrm_timeserie_t *ts;
+	ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope), 0);
+	for (int64_t i = 0; i < 3; i++)
+		nrm_timeserie_add_event(ts, nrm_time_fromns(1000 + i),
+		                        (double)i);
+
+	/* a value short: no way to tell which one is missing */
+	nrm_msg_t *msg = events_msg(ts);
+	msg->events->series[0]->n_values = 2;
+	nrm_msg_t *recv = roundtrip(msg);
+	nrm_msg_timeserie_t *mts = recv->events->series[0];
+	ck_assert_int_eq(mts->n_times, 3);
+	ck_assert_int_eq(mts->n_values, 2);
+	size_t len;
+	ck_assert_int_eq(nrm_msg_timeserie_length(mts, &len), -NRM_EINVAL);
+	ck_assert_int_eq(len, 0);
+
+	nrm_msg_destroy_received(&recv);
+	nrm_msg_destroy_created(&msg);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_events_legacy)
+{
+	/* older senders fill the events field instead of the columns */
+	nrm_timeserie_t *ts;
+	ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope), 0);
+	nrm_msg_t *msg = events_msg(ts);
+	nrm_msg_timeserie_t *mts = msg->events->series[0];
+
+	nrm_msg_event_t events[3], *pevents[3];
+	for (int i = 0; i < 3; i++) {
+		nrm_msg_event_init(&events[i]);
+		events[i].time = 1000 + i;
+		events[i].value = 10.0 * i;
+		pevents[i] = &events[i];
+	}
+	mts->n_events = 3;
+	mts->events = pevents;
+
+	nrm_msg_t *recv = roundtrip(msg);
+	mts = recv->events->series[0];
+	ck_assert_int_eq(mts->n_times, 0);
+	ck_assert_int_eq(serie_length(mts), 3);
+	for (size_t i = 0; i < 3; i++) {
+		nrm_event_t e;
+		nrm_msg_timeserie_get_event(mts, i, &e);
+		ck_assert_int_eq(e.time, 1000 + (int64_t)i);
+		ck_assert_double_eq(e.value, 10.0 * i);
+	}
+
+	nrm_msg_destroy_received(&recv);
+	nrm_msg_destroy_created(&msg);
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_scope_byid)
+{
+	nrm_timeserie_t *ts;
+	ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope), 0);
+	nrm_timeserie_add_event(ts, nrm_time_fromns(1000), 1.0);
+
+	/* without an id, the whole scope goes */
+	nrm_msg_t *msg = events_msg(ts);
+	nrm_msg_t *recv = roundtrip(msg);
+	nrm_msg_scope_t *mscope = recv->events->series[0]->scope;
+	ck_assert_int_eq(mscope->id, 0);
+	ck_assert_str_eq(mscope->uuid, "nrm.scope.messagestest");
+	nrm_scope_t *copy = nrm_scope_create_frommsg(mscope);
+	ck_assert_ptr_nonnull(copy);
+	ck_assert_int_eq(nrm_scope_cmp(scope, copy), 0);
+	nrm_scope_destroy(copy);
+	nrm_msg_destroy_received(&recv);
+	nrm_msg_destroy_created(&msg);
+
+	/* a scope known to the daemon only carries its id and uuid */
+	ts->scope_id = 42;
+	msg = events_msg(ts);
+	recv = roundtrip(msg);
+	mscope = recv->events->series[0]->scope;
+	ck_assert_int_eq(mscope->id, 42);
+	ck_assert_str_eq(mscope->uuid, "nrm.scope.messagestest");
+	ck_assert_int_eq(mscope->n_cpu_ranges, 0);
+	ck_assert_int_eq(mscope->n_numa_ranges, 0);
+	ck_assert_int_eq(mscope->n_gpu_ranges, 0);
+	ck_assert_int_eq(serie_length(recv->events->series[0]), 1);
+	nrm_msg_destroy_received(&recv);
+	nrm_msg_destroy_created(&msg);
+
+	nrm_timeserie_destroy(&ts);
+}
+END_TEST
+
+START_TEST(test_grow)
+{
+	/* enough series and events to outgrow the first block of the arena */
+	nrm_vector_t *timeseries;
+	nrm_vector_create(&timeseries, sizeof(nrm_timeserie_t *));
+	for (int i = 0; i < 32; i++) {
+		nrm_timeserie_t *ts;
+		ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope),
+		                 0);
+		for (int j = 0; j < 64; j++)
+			nrm_timeserie_add_event(ts, nrm_time_fromns(i + j),
+			                        (double)j);
+		nrm_vector_push_back(timeseries, &ts);
+	}
+
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_EVENTS);
+	ck_assert_int_eq(nrm_msg_set_events(msg, timeseries), 0);
+	nrm_msg_t *recv = roundtrip(msg);
+	ck_assert_int_eq(recv->events->n_series, 32);
+	for (size_t i = 0; i < 32; i++) {
+		nrm_msg_timeserie_t *mts = recv->events->series[i];
+		ck_assert_int_eq(serie_length(mts), 64);
+		nrm_event_t e;
+		nrm_msg_timeserie_get_event(mts, 63, &e);
+		ck_assert_int_eq(e.time, (int64_t)i + 63);
+		ck_assert_double_eq(e.value, 63.0);
+	}
+	nrm_msg_destroy_received(&recv);
+
+	nrm_msg_destroy_created(&msg);
+	nrm_vector_foreach(timeseries, iter)
+	{
+		nrm_timeserie_t **ts = nrm_vector_iterator_get(iter);
+		nrm_timeserie_destroy(ts);
+	}
+	nrm_vector_destroy(&timeseries);
+}
+END_TEST
+
+START_TEST(test_reset)
+{
+	/* enough series and events to outgrow the first block of the arena */
+	nrm_vector_t *timeseries;
+	nrm_vector_create(&timeseries, sizeof(nrm_timeserie_t *));
+	for (int i = 0; i < 32; i++) {
+		nrm_timeserie_t *ts;
+		ck_assert_int_eq(nrm_timeserie_create(&ts, sensor_uuid, scope),
+		                 0);
+		for (int j = 0; j < 64; j++)
+			nrm_timeserie_add_event(ts, nrm_time_fromns(i + j),
+			                        (double)j);
+		nrm_vector_push_back(timeseries, &ts);
+	}
+
+	nrm_msg_t *msg = nrm_msg_create();
+	nrm_msg_fill(msg, NRM_MSG_TYPE_EVENTS);
+	ck_assert_int_eq(nrm_msg_set_events(msg, timeseries), 0);
+	zframe_t *first = nrm_msg_pack(msg);
+	ck_assert_ptr_nonnull(first);
+
+	/* a reset message is empty, and packs the same once refilled, both
+	 * after the arena grew and once it fits in a single block.
+	 */
+	for (int i = 0; i < 2; i++) {
+		msg = nrm_msg_reset(msg);
+		ck_assert_ptr_nonnull(msg);
+		ck_assert_int_eq(msg->type, 0);
+		ck_assert_int_eq(msg->data_case, NRM__MESSAGE__DATA__NOT_SET);
+		nrm_msg_fill(msg, NRM_MSG_TYPE_EVENTS);
+		ck_assert_int_eq(nrm_msg_set_events(msg, timeseries), 0);
+		zframe_t *again = nrm_msg_pack(msg);
+		ck_assert_ptr_nonnull(again);
+		ck_assert(zframe_eq(first, again));
+		zframe_destroy(&again);
+	}
+
+	nrm_msg_t *recv = roundtrip(msg);
+	ck_assert_int_eq(recv->events->n_series, 32);
+	ck_assert_int_eq(serie_length(recv->events->series[31]), 64);
+	nrm_msg_destroy_received(&recv);
+
+	zframe_destroy(&first);
+	nrm_msg_destroy_created(&msg);
+	nrm_vector_foreach(timeseries, iter)
+	{
+		nrm_timeserie_t **ts = nrm_vector_iterator_get(iter);
+		nrm_timeserie_destroy(ts);
+	}
+	nrm_vector_destroy(&timeseries);
+}
+END_TEST
+
+Suite *messages_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("messages");
+
+	TCase *tc_events = tcase_create("events");
+	tcase_add_checked_fixture(tc_events, setup, teardown);
+	tcase_add_test(tc_events, test_events_packed);
+	tcase_add_test(tc_events, test_events_mismatch);
+	tcase_add_test(tc_events, test_events_legacy);
+	tcase_add_test(tc_events, test_scope_byid);
+	suite_add_tcase(s, tc_events);
+
+	TCase *tc_arena = tcase_create("arena");
+	tcase_add_checked_fixture(tc_arena, setup, teardown);
+	tcase_add_test(tc_arena, test_grow);
+	tcase_add_test(tc_arena, test_reset);
+	suite_add_tcase(s, tc_arena);
+
+	return s;
+}
+
+int main(void)
+{
+	int failed;
+	Suite *s;
+	SRunner *sr;
+
+	nrm_init(NULL, NULL);
+	s = messages_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	nrm_finalize();
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -28,6 +28,73 @@ START_TEST(test_from_json)
 }
 END_TEST
 
+START_TEST(test_ranges)
+{
+	int32_t ranges[6];
+	nrm_scope_t *scope = nrm_scope_create("test");
+	nrm_bitmap_t *cpus = &scope->maps[NRM_SCOPE_TYPE_CPU];
+
+	/* [0, 64), 70, [127, 129) */
+	for (int i = 0; i < 64; i++)
+		nrm_bitmap_set(cpus, i);
+	nrm_bitmap_set(cpus, 70);
+	nrm_bitmap_set(cpus, 127);
+	nrm_bitmap_set(cpus, 128);
+	ck_assert_int_eq(nrm_bitmap_nranges(cpus), 3);
+	nrm_bitmap_to_ranges(cpus, ranges);
+	ck_assert_int_eq(ranges[0], 0);
+	ck_assert_int_eq(ranges[1], 64);
+	ck_assert_int_eq(ranges[2], 70);
+	ck_assert_int_eq(ranges[3], 1);
+	ck_assert_int_eq(ranges[4], 127);
+	ck_assert_int_eq(ranges[5], 2);
+
+	nrm_bitmap_t copy;
+	ck_assert_int_eq(nrm_bitmap_from_ranges(&copy, 6, ranges), 0);
+	ck_assert_int_eq(nrm_bitmap_cmp(cpus, &copy), 0);
+	ck_assert_int_eq(nrm_bitmap_from_ranges(&copy, 5, ranges), -NRM_EINVAL);
+
+	/* json uses the same pairs, plain indexes are still accepted */
+	json_t *json = nrm_scope_to_json(scope);
+	char *s = json_dumps(json_object_get(json, "cpu"), JSON_COMPACT);
+	ck_assert_str_eq(s, "[[0,64],[70,1],[127,2]]");
+	free(s);
+	json_decref(json);
+
+	json = json_loads("{\"cpu\": [[0, 64], 70, [127, 2]]}", 0, NULL);
+	nrm_scope_t *other = nrm_scope_create("other");
+	nrm_scope_from_json(other, json);
+	ck_assert_int_eq(
+	        nrm_bitmap_cmp(cpus, &other->maps[NRM_SCOPE_TYPE_CPU]), 0);
+	json_decref(json);
+	nrm_scope_destroy(other);
+	nrm_scope_destroy(scope);
+}
+END_TEST
+
+START_TEST(test_frommsg_malformed)
+{
+	int32_t ranges[] = {0, 4, NRM_BITMAP_MAX - 1, 2};
+	nrm_msg_scope_t msg;
+	nrm_msg_scope_init(&msg);
+	msg.uuid = "test";
+	msg.cpu_ranges = ranges;
+
+	msg.n_cpu_ranges = 2;
+	nrm_scope_t *scope = nrm_scope_create_frommsg(&msg);
+	ck_assert_ptr_nonnull(scope);
+	ck_assert_int_eq(nrm_bitmap_nset(&scope->maps[NRM_SCOPE_TYPE_CPU]), 4);
+
+	/* odd pairs and ranges past the end are rejected */
+	msg.n_cpu_ranges = 3;
+	ck_assert_ptr_null(nrm_scope_create_frommsg(&msg));
+	ck_assert_int_eq(nrm_scope_update_frommsg(scope, &msg), -NRM_EINVAL);
+	msg.n_cpu_ranges = 4;
+	ck_assert_ptr_null(nrm_scope_create_frommsg(&msg));
+	nrm_scope_destroy(scope);
+}
+END_TEST
+
 Suite *scope_suite(void)
 {
 	Suite *s;
@@ -36,6 +103,8 @@ Suite *scope_suite(void)
 
 	TCase *tc_json = tcase_create("json");
 	tcase_add_test(tc_json, test_from_json);
+	tcase_add_test(tc_json, test_ranges);
+	tcase_add_test(tc_json, test_frommsg_malformed);
 	suite_add_tcase(s, tc_json);
 
 	return s;
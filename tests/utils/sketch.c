@@ -0,0 +1,200 @@
+/*******************************************************************************
+ * Copyright 2019 UChicago Argonne, LLC.
+ * (c.f. AUTHORS, LICENSE)
+ *
+ * This file is part of the libnrm project.
+ * For more info, see https://github.com/anlsys/libnrm
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ ******************************************************************************/
+
+#include "nrm.h"
+#include <check.h>
+#include <stdlib.h>
+
+/* fixtures for sketch */
+nrm_sketch_t *sketch = NULL;
+
+void setup(void)
+{
+	int err;
+	err = nrm_sketch_create(&sketch, 0.01);
+	ck_assert_int_eq(err, 0);
+	ck_assert_ptr_nonnull(sketch);
+}
+
+void teardown(void)
+{
+	nrm_sketch_destroy(&sketch);
+	ck_assert_ptr_null(sketch);
+}
+
+START_TEST(test_empty)
+{
+	int err;
+	size_t count;
+	double value;
+
+	err = nrm_sketch_count(sketch, &count);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(count, 0);
+
+	err = nrm_sketch_quantile(sketch, 0.5, &value);
+	ck_assert_int_eq(err, -NRM_EDOM);
+}
+END_TEST
+
+START_TEST(test_invalid_create)
+{
+	int err;
+	nrm_sketch_t *s = NULL;
+
+	err = nrm_sketch_create(NULL, 0.01);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+
+	err = nrm_sketch_create(&s, 0.0);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	ck_assert_ptr_null(s);
+
+	err = nrm_sketch_create(&s, 1.0);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	ck_assert_ptr_null(s);
+}
+END_TEST
+
+START_TEST(test_quantiles)
+{
+	int err;
+	size_t count;
+	double value;
+
+	for (int i = 1; i <= 1000; i++) {
+		err = nrm_sketch_add(sketch, (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_sketch_count(sketch, &count);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(count, 1000);
+
+	err = nrm_sketch_quantile(sketch, 0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 500.0, 5.0);
+	err = nrm_sketch_quantile(sketch, 0.9, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 900.0, 9.0);
+	err = nrm_sketch_quantile(sketch, 0.99, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 990.0, 9.9);
+	err = nrm_sketch_quantile(sketch, 0.0, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 1.0, 0.01);
+	err = nrm_sketch_quantile(sketch, 1.0, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 1000.0, 10.0);
+
+	err = nrm_sketch_quantile(sketch, 1.5, &value);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+
+	err = nrm_sketch_clear(sketch);
+	ck_assert_int_eq(err, 0);
+	err = nrm_sketch_quantile(sketch, 0.5, &value);
+	ck_assert_int_eq(err, -NRM_EDOM);
+}
+END_TEST
+
+START_TEST(test_signs)
+{
+	int err;
+	double value;
+
+	/* -2, -1, 0, 0, 1, 2, 3 */
+	for (int i = -2; i <= 3; i++) {
+		err = nrm_sketch_add(sketch, (double)i);
+		ck_assert_int_eq(err, 0);
+	}
+	err = nrm_sketch_add(sketch, 0.0);
+	ck_assert_int_eq(err, 0);
+
+	err = nrm_sketch_quantile(sketch, 0.0, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, -2.0, 0.02);
+	err = nrm_sketch_quantile(sketch, 0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq(value, 0.0);
+	err = nrm_sketch_quantile(sketch, 1.0, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 3.0, 0.03);
+}
+END_TEST
+
+START_TEST(test_merge)
+{
+	int err;
+	size_t count;
+	double value;
+	nrm_sketch_t *other, *wrong;
+
+	err = nrm_sketch_create(&other, 0.01);
+	ck_assert_int_eq(err, 0);
+	err = nrm_sketch_create(&wrong, 0.05);
+	ck_assert_int_eq(err, 0);
+
+	for (int i = 1; i <= 500; i++) {
+		nrm_sketch_add(sketch, (double)i);
+		nrm_sketch_add(other, (double)(i + 500));
+	}
+	err = nrm_sketch_merge(sketch, wrong);
+	ck_assert_int_eq(err, -NRM_EINVAL);
+	err = nrm_sketch_merge(sketch, other);
+	ck_assert_int_eq(err, 0);
+
+	err = nrm_sketch_count(sketch, &count);
+	ck_assert_int_eq(err, 0);
+	ck_assert_int_eq(count, 1000);
+	err = nrm_sketch_quantile(sketch, 0.5, &value);
+	ck_assert_int_eq(err, 0);
+	ck_assert_double_eq_tol(value, 500.0, 5.0);
+
+	nrm_sketch_destroy(&other);
+	nrm_sketch_destroy(&wrong);
+}
+END_TEST
+
+Suite *sketch_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("sketch");
+
+	tc = tcase_create("nofixture");
+	tcase_add_test(tc, test_invalid_create);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("basics");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_empty);
+	tcase_add_test(tc, test_quantiles);
+	tcase_add_test(tc, test_signs);
+	tcase_add_test(tc, test_merge);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+int main(void)
+{
+	int failed;
+	Suite *s;
+	SRunner *sr;
+
+	nrm_init(NULL, NULL);
+	s = sketch_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	nrm_finalize();
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}